@@ -14,6 +14,11 @@ Rectangle {
         GradientStop { position: 1.0; color: "#3C64B1" }
     }
 
+    // Last known totals; shown straight from the startup snapshot and
+    // refreshed once the database is open
+    readonly property var summary: databaseHandler.summary
+    readonly property bool hasSummary: summary.totalTrips !== undefined
+
     // Add some subtle transparency overlay
     Rectangle {
         anchors.fill: parent
@@ -50,6 +55,14 @@ Rectangle {
                     font.bold: true
                     Layout.alignment: Qt.AlignVCenter
                 }
+                Item { Layout.fillWidth: true }
+                Label {
+                    visible: hasSummary
+                    text: hasSummary ? summary.totalTrips + " trips" : ""
+                    font.pixelSize: 16
+                    color: "#e0ffffff"
+                    Layout.alignment: Qt.AlignVCenter
+                }
             }
         }
 
@@ -76,6 +89,15 @@ Rectangle {
                     font.bold: true
                     Layout.alignment: Qt.AlignVCenter
                 }
+                Item { Layout.fillWidth: true }
+                Label {
+                    visible: hasSummary
+                    text: hasSummary ? summary.totalDistance.toFixed(1) + " km · "
+                                       + summary.totalEnergyUsed.toFixed(1) + " kWh" : ""
+                    font.pixelSize: 16
+                    color: "#e0ffffff"
+                    Layout.alignment: Qt.AlignVCenter
+                }
             }
         }
 
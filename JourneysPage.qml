@@ -10,14 +10,11 @@ Rectangle {
     signal tripSelected(int tripId)
     signal addTripClicked
 
-    // Store the current page number
-    property int currentPage: 0
-    property int tripsPerPage: 10 // Or any other number
-
     BusyIndicator {
         id: busyIndicator
         anchors.centerIn: parent
-        running: false // Initially not running
+        z: 1
+        running: tripListModel.loading || databaseHandler.busy
     }
 
     gradient: Gradient {
@@ -25,16 +22,112 @@ Rectangle {
         GradientStop { position: 1.0; color: "#3C64B1" }
     }
 
+    // Search state; with no text and no filters the paged list is shown
+    property string driverFilter: ""
+    property string vehicleFilter: ""
+    property bool searchActive: searchField.text.trim().length > 0 || driverFilter !== ""
+                                || vehicleFilter !== "" || favoritesOnly.checked
+    property var driverFacets: []
+    property var vehicleFacets: []
+    // Counted over the first matches only, shown as "n+"
+    property bool driverFacetsPartial: false
+    property bool vehicleFacetsPartial: false
+    property string resultSummary: ""
+
+    ListModel {
+        id: searchResults
+    }
+
+    // The paged list patches itself; search results get the same edits here
+    Connections {
+        target: databaseHandler
+        function onTripsUpdated(updates) {
+            for (var u = 0; u < updates.length; ++u) {
+                for (var i = 0; i < searchResults.count; ++i) {
+                    if (searchResults.get(i).id !== updates[u].id)
+                        continue;
+                    if (updates[u].favorite !== undefined)
+                        searchResults.setProperty(i, "favorite", updates[u].favorite);
+                    if (updates[u].notes !== undefined)
+                        searchResults.setProperty(i, "notes", updates[u].notes);
+                    break;
+                }
+            }
+        }
+        function onTripsInserted(firstId, lastId) {
+            if (journeysRoot.searchActive)
+                searchDebounce.restart();
+        }
+    }
+
+    // Coalesces keystrokes; the handler also drops searches that a newer one replaced
+    Timer {
+        id: searchDebounce
+        interval: 120
+        onTriggered: journeysRoot.runSearch()
+    }
+
     ColumnLayout {
         anchors.fill: parent
         spacing: 0
 
+        ColumnLayout {
+            Layout.fillWidth: true
+            Layout.margins: 10
+            spacing: 6
+
+            TextField {
+                id: searchField
+                Layout.fillWidth: true
+                placeholderText: "Search notes, locations and drivers"
+                onTextChanged: searchDebounce.restart()
+            }
+
+            RowLayout {
+                Layout.fillWidth: true
+                spacing: 6
+
+                ComboBox {
+                    id: driverBox
+                    Layout.fillWidth: true
+                    model: ["All drivers"].concat(journeysRoot.driverFacets.map(f => f.value + " (" + f.count + (journeysRoot.driverFacetsPartial ? "+" : "") + ")"))
+                    onActivated: index => {
+                        journeysRoot.driverFilter = index > 0 ? journeysRoot.driverFacets[index - 1].value : "";
+                        searchDebounce.restart();
+                    }
+                }
+                ComboBox {
+                    id: vehicleBox
+                    Layout.fillWidth: true
+                    model: ["All vehicles"].concat(journeysRoot.vehicleFacets.map(f => f.value + " (" + f.count + (journeysRoot.vehicleFacetsPartial ? "+" : "") + ")"))
+                    onActivated: index => {
+                        journeysRoot.vehicleFilter = index > 0 ? journeysRoot.vehicleFacets[index - 1].value : "";
+                        searchDebounce.restart();
+                    }
+                }
+                CheckBox {
+                    id: favoritesOnly
+                    text: "Favorites"
+                    onToggled: searchDebounce.restart()
+                }
+            }
+
+            Text {
+                visible: journeysRoot.searchActive
+                text: journeysRoot.resultSummary
+                color: "#ffffff"
+                font.pixelSize: 12
+            }
+        }
+
         ListView {
             id: tripList
             Layout.fillWidth: true
             Layout.fillHeight: true
-            // The model is now a simple list model that we will populate
-            model: ListModel {}
+            clip: true
+            // C++ model with keyset paging; the ListView calls fetchMore()
+            // by itself as the user scrolls towards the end
+            model: journeysRoot.searchActive ? searchResults : tripListModel
             delegate: Rectangle {
                 width: parent.width
                 height: 80
@@ -89,47 +182,42 @@ Rectangle {
                     }
                 }
             }
-
-            // When the component is ready, load the first page of trips
-            Component.onCompleted: {
-                // Load the first page of trips when the component is ready
-                loadMoreTrips();
-            }
-
-            function loadMoreTrips() {
-                // Call the C++ backend to get the next page of trips
-                var newTrips = databaseHandler.getTrips(currentPage, tripsPerPage);
-
-                if (newTrips.length > 0) {
-                    for (var i = 0; i < newTrips.length; i++) {
-                        tripList.model.append(newTrips[i]);
-                    }
-                    currentPage++;
-                } else {
-                    console.log("No more trips to load.");
-                    // Optionally, disable the "Next" button here
-                }
-            }
         }
     }
 
-    // Function to load trips for a given page
-    function loadTrips(page) {
-        busyIndicator.running = true;
-        // Call the C++ method to get trips
-        var trips = dbHandler.getTrips(page, tripsPerPage);
-        busyIndicator.running = false;
-
-        if (trips.length > 0) {
-            currentPage = page;
-            tripList.model.clear();
-            for (var i = 0; i < trips.length; i++) {
-                tripList.model.append(trips[i]);
-            }
-        } else {
-            // Handle case where there are no more trips
-            console.log("No more trips to load.");
-            // Optionally, disable the "Next" button here
-        }
+    // Start again from the newest trip, e.g. after trips were imported
+    function reloadTrips() {
+        tripListModel.reload();
+        runSearch();
+    }
+
+    function runSearch() {
+        var query = {
+            text: searchField.text,
+            driver: driverFilter,
+            vehicle: vehicleFilter,
+            favoritesOnly: favoritesOnly.checked,
+            limit: 100
+        };
+        databaseHandler.searchTripsAsync(query, function(result) {
+            if (!result.results)
+                return;
+            searchResults.clear();
+            for (var i = 0; i < result.results.length; ++i)
+                searchResults.append(result.results[i]);
+            driverFacetsPartial = result.facets.driversAreLowerBound;
+            vehicleFacetsPartial = result.facets.vehiclesAreLowerBound;
+            driverFacets = result.facets.drivers;
+            vehicleFacets = result.facets.vehicles;
+            resultSummary = (result.totalIsLowerBound ? "More than " : "") + result.total + " trips, "
+                    + result.facets.favorites + (result.facets.favoritesIsLowerBound ? "+" : "")
+                    + " favorites (" + result.elapsedMs.toFixed(1) + " ms)";
+            // Keep the selected entries after the facet lists were replaced
+            driverBox.currentIndex = driverFilter === "" ? 0 : driverFacets.findIndex(f => f.value === driverFilter) + 1;
+            vehicleBox.currentIndex = vehicleFilter === "" ? 0 : vehicleFacets.findIndex(f => f.value === vehicleFilter) + 1;
+        });
     }
+
+    // Fills the filter lists with the unfiltered facet counts
+    Component.onCompleted: runSearch()
 }
@@ -106,10 +106,15 @@ ApplicationWindow {
         JourneysPage {
             onAddTripClicked: showAddTrip = true
             onTripSelected: function(tripId) {
-                var tripDetails = databaseHandler.getTripDetails(tripId);
-                stackView.push(tripDetailComponent, {
-                    "tripData": tripDetails,
-                    "databaseHandler": databaseHandler
+                databaseHandler.getTripDetailsAsync(tripId, function(tripDetails) {
+                    if (tripDetails.id === undefined) {
+                        console.warn("Could not load trip", tripId);
+                        return;
+                    }
+                    stackView.push(tripDetailComponent, {
+                        "tripData": tripDetails,
+                        "databaseHandler": databaseHandler
+                    });
                 });
             }
         }
@@ -3,15 +3,150 @@ import QtQuick.Controls 2.15
 import QtQuick.Layouts 1.15
 
 Rectangle {
+    id: mediaPage
     gradient: Gradient {
         GradientStop { position: 0.0; color: "#5D9CEC" }
         GradientStop { position: 1.0; color: "#3C64B1" }
     }
 
+    property int pageSize: 60
+    property bool loading: false
+    property bool atEnd: false
+    property var lastId: 0
+
+    // Photos of every trip, newest first, fetched a page at a time on the read pool
+    function loadMore() {
+        if (loading || atEnd)
+            return;
+        loading = true;
+        databaseHandler.getMediaAsync(-1, lastId, pageSize, function(page) {
+            // A failed read answers {}; the next scroll to the end retries
+            if (!page.items) {
+                loading = false;
+                return;
+            }
+            for (var i = 0; i < page.items.length; ++i)
+                mediaModel.append(page.items[i]);
+            if (page.items.length > 0)
+                lastId = page.items[page.items.length - 1].id;
+            atEnd = page.atEnd;
+            loading = false;
+        });
+    }
+
+    Component.onCompleted: loadMore()
+
+    ListModel { id: mediaModel }
+
     Label {
-        text: "Media Page"
+        text: "No photos yet. Attach them from a trip's detail page."
         anchors.centerIn: parent
+        width: parent.width * 0.8
+        horizontalAlignment: Text.AlignHCenter
+        wrapMode: Text.WordWrap
         color: "white"
-        font.pixelSize: 24
+        font.pixelSize: 18
+        visible: mediaModel.count === 0 && atEnd
+    }
+
+    GridView {
+        id: grid
+        anchors.fill: parent
+        anchors.margins: 4
+        clip: true
+        cellWidth: Math.floor(width / Math.max(1, Math.round(width / 130)))
+        cellHeight: cellWidth
+        // A row or two of decodes ahead of the viewport, not the whole list
+        cacheBuffer: cellHeight * 2
+        model: mediaModel
+
+        onAtYEndChanged: if (atYEnd) mediaPage.loadMore()
+
+        delegate: Item {
+            width: grid.cellWidth
+            height: grid.cellHeight
+
+            Rectangle {
+                anchors.fill: parent
+                anchors.margins: 2
+                color: "#20ffffff"
+                radius: 4
+                clip: true
+
+                // Decoded off the GUI thread by the thumbnail provider, which
+                // also owns the memory budget, so the pixmap cache is skipped
+                Image {
+                    anchors.fill: parent
+                    source: "image://thumbnails/" + model.hash
+                    sourceSize: Qt.size(grid.cellWidth, grid.cellHeight)
+                    fillMode: Image.PreserveAspectCrop
+                    cache: false
+                }
+
+                Label {
+                    anchors.left: parent.left
+                    anchors.bottom: parent.bottom
+                    anchors.margins: 4
+                    text: model.driver
+                    color: "white"
+                    font.pixelSize: 11
+                    style: Text.Outline
+                    styleColor: "#80000000"
+                }
+
+                MouseArea {
+                    anchors.fill: parent
+                    onClicked: {
+                        viewer.hash = model.hash;
+                        viewer.caption = model.driver + " · " + model.startDate;
+                        viewer.open();
+                    }
+                }
+            }
+        }
+    }
+
+    BusyIndicator {
+        anchors.bottom: parent.bottom
+        anchors.horizontalCenter: parent.horizontalCenter
+        running: mediaPage.loading
+    }
+
+    // Full resolution view, decoded from the mapped file at screen size
+    Popup {
+        id: viewer
+        property string hash: ""
+        property string caption: ""
+        width: mediaPage.width
+        height: mediaPage.height
+        padding: 0
+        background: Rectangle { color: "black" }
+
+        Image {
+            id: fullImage
+            anchors.fill: parent
+            source: viewer.opened && viewer.hash ? "image://media/" + viewer.hash : ""
+            sourceSize: Qt.size(viewer.width, viewer.height)
+            fillMode: Image.PreserveAspectFit
+            cache: false
+        }
+
+        BusyIndicator {
+            anchors.centerIn: parent
+            running: fullImage.status === Image.Loading
+        }
+
+        Label {
+            anchors.bottom: parent.bottom
+            anchors.horizontalCenter: parent.horizontalCenter
+            anchors.bottomMargin: 12
+            text: viewer.caption
+            color: "white"
+        }
+
+        MouseArea {
+            anchors.fill: parent
+            onClicked: viewer.close()
+        }
     }
 }
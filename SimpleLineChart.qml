@@ -4,18 +4,18 @@ import QtCharts 2.15
 ChartView {
     id: simpleLineChart
     property string title: "Line Chart"
-    signal updateRequested(var series, var axisX)
+    signal updateRequested(var series, var axisX, var axisY)
 
     backgroundColor: "transparent"
     
     LineSeries {
         id: internalLineSeries
         axisX: ValueAxis { id: valueAxisX }
-        axisY: ValueAxis { min: 0 }
+        axisY: ValueAxis { id: valueAxisY; min: 0 }
     }
 
     function updateChart() {
         internalLineSeries.clear();
-        updateRequested(internalLineSeries, valueAxisX);
+        updateRequested(internalLineSeries, valueAxisX, valueAxisY);
     }
 }
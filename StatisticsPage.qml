@@ -2,6 +2,7 @@ import QtQuick 2.15
 import QtQuick.Controls 2.15
 import QtQuick.Layouts 1.15
 import QtCharts 2.15
+import QtQuick.Dialogs
 import DigitalTripBook 1.0
 
 Rectangle {
@@ -11,20 +12,179 @@ Rectangle {
         GradientStop { position: 1.0; color: "#3C64B1" }
     }
 
-    property var statisticsData: null
-    property var tripStatsData: null
+    // Startup snapshot values show until the live query answers
+    property var statisticsData: databaseHandler.summary.totalTrips !== undefined ? databaseHandler.summary : null
+    property var chartData: null
+    // EnergyAnomalies::detect() result, see energyanomalies.h
+    property var anomalies: null
 
     Component.onCompleted: {
         console.log("StatisticsPage - Component.onCompleted");
-        try {
-            statisticsData = databaseHandler.getStatistics();
-            tripStatsData = databaseHandler.getTripStatisticsData();
+        loadStatistics();
+    }
+
+    // Both queries run in parallel on the read connection pool and come
+    // back together; the page shows "Loading..." until then
+    function loadStatistics() {
+        databaseHandler.getStatisticsPageAsync(function(page) {
+            if (!page.statistics || !page.chartData) {
+                console.warn("Failed to fetch statistics data");
+                return;
+            }
+            statisticsData = page.statistics;
+            chartData = page.chartData;
+            refreshCharts();
             console.log("Statistics data fetched successfully");
-        } catch (e) {
-            console.error("Error fetching statistics data:", e);
+        });
+        loadAnomalies();
+    }
+
+    // Scans the whole history off the GUI thread; the driver labels are
+    // updated once it answers
+    function loadAnomalies() {
+        databaseHandler.detectAnomaliesAsync({}, function(result) {
+            if (!result.flaggedDrivers)
+                return;
+            anomalies = result;
+            if (chartData) {
+                driverBarSeries.populate();
+                violationsBarSeries.populate();
+            }
+        });
+    }
+
+    Timer {
+        id: anomalyRefresh
+        interval: 10000
+        onTriggered: loadAnomalies()
+    }
+
+    // Patches the chart data with a statistics delta (see tripchanges.h)
+    // instead of loading every trip again
+    function applyDelta(delta) {
+        var data = Object.assign({}, chartData);
+        var drivers = Array.from(data.drivers);
+        var tripCounts = Array.from(data.driverTripCounts);
+        var energy = Array.from(data.driverEnergy);
+        var distance = Array.from(data.driverDistance);
+        var violations = Array.from(data.driverViolations);
+        var efficiency = Array.from(data.driverEfficiency);
+
+        for (var name in delta.drivers) {
+            var change = delta.drivers[name];
+            var d = drivers.indexOf(name);
+            if (d < 0) {
+                d = drivers.length;
+                drivers.push(name);
+                tripCounts.push(0);
+                energy.push(0);
+                distance.push(0);
+                violations.push(0);
+                efficiency.push(0);
+            }
+            tripCounts[d] += change.trips;
+            energy[d] += change.energy;
+            distance[d] += change.distance;
+            violations[d] += change.violations;
+            // kWh per km. insertedDelta() counts a trip without distance as
+            // 0.1 km like chartData() does, so a driver with trips always has
+            // some; the guard keeps a malformed delta from producing NaN
+            efficiency[d] = distance[d] > 0 ? energy[d] / distance[d] : 0;
+        }
+
+        // Per-trip series run oldest first, so new trips go on the end
+        // unless one of them started before the newest trip shown
+        var newTrips = delta.newTrips || [];
+        for (var i = 0; i < newTrips.length; ++i) {
+            if (newTrips[i].startTs < data.lastStartTs)
+                return false;
+        }
+        var tripEnergy = Array.from(data.energy);
+        var tripBattery = Array.from(data.batteryUsage);
+        var tripSpeed = Array.from(data.averageSpeed);
+        for (i = 0; i < newTrips.length; ++i) {
+            tripEnergy.push(newTrips[i].energy);
+            tripBattery.push(newTrips[i].batteryUsage);
+            tripSpeed.push(newTrips[i].averageSpeed);
+            data.maxEnergy = Math.max(data.maxEnergy, newTrips[i].energy);
+            data.maxBatteryUsage = Math.max(data.maxBatteryUsage, newTrips[i].batteryUsage);
+            data.maxSpeed = Math.max(data.maxSpeed, newTrips[i].averageSpeed);
+            data.lastStartTs = newTrips[i].startTs;
+        }
+
+        data.tripCount = tripEnergy.length;
+        data.energy = tripEnergy;
+        data.batteryUsage = tripBattery;
+        data.averageSpeed = tripSpeed;
+        data.drivers = drivers;
+        data.driverTripCounts = tripCounts;
+        data.driverEnergy = energy;
+        data.driverDistance = distance;
+        data.driverViolations = violations;
+        data.driverEfficiency = efficiency;
+        data.maxEfficiency = Math.max.apply(null, efficiency.concat([0]));
+        data.maxViolations = Math.max.apply(null, violations.concat([0]));
+        chartData = data;
+        return true;
+    }
+
+    property real exportFraction: 0
+    property string exportStatus: ""
+
+    Connections {
+        target: databaseHandler
+        function onExportProgress(rowsExported, rowsTotal, rowsPerSecond) {
+            exportFraction = rowsTotal > 0 ? rowsExported / rowsTotal : 0;
+            exportStatus = rowsExported + " rows, " + Math.round(rowsPerSecond) + " rows/s";
+        }
+        function onStatisticsChanged(delta) {
+            if (delta.reload || !chartData) {
+                loadStatistics();
+                return;
+            }
+            // The handler already applied the totals
+            statisticsData = databaseHandler.summary;
+            if (delta.drivers === undefined && delta.newTrips === undefined)
+                return; // only favorites changed; the charts do not show them
+            if (applyDelta(delta)) {
+                refreshCharts();
+                // New trips move the baselines, but the scan covers the whole
+                // history; one rescan per burst of imports is enough
+                if (!anomalyRefresh.running)
+                    anomalyRefresh.start();
+            } else {
+                loadStatistics();
+            }
+        }
+    }
+
+    FileDialog {
+        id: exportDialog
+        property string suffix: "csv"
+        title: "Export trips"
+        fileMode: FileDialog.SaveFile
+        defaultSuffix: suffix
+        nameFilters: suffix === "dtbc" ? ["Columnar trip export (*.dtbc)"] : ["CSV files (*.csv)"]
+        onAccepted: {
+            exportFraction = 0;
+            exportStatus = "Exporting...";
+            // Streams from a reader connection; progress arrives through exportProgress
+            databaseHandler.exportTripsAsync(selectedFile.toString(), "trips", function(result) {
+                exportFraction = result.ok ? 1 : 0;
+                exportStatus = result.ok ? result.rowsExported + " rows exported in " + result.elapsedMs + " ms"
+                                         : "Export failed: " + (result.error || "unknown error");
+            });
         }
     }
 
+    function refreshCharts() {
+        energyAreaSeries.populate();
+        batteryAreaSeries.populate();
+        speedBarSeries.populate();
+        driverBarSeries.populate();
+        violationsBarSeries.populate();
+    }
+
     ScrollView {
         anchors.fill: parent
         clip: true
@@ -113,8 +273,8 @@ Rectangle {
                             axisX: ValueAxis {
                                 id: energyAxisX
                                 min: 1
-                                max: tripStatsData ? tripStatsData.length : 10
-                                tickCount: Math.min(tripStatsData ? tripStatsData.length : 5, 10)
+                                max: chartData ? chartData.tripCount : 10
+                                tickCount: Math.min(chartData ? chartData.tripCount : 5, 10)
                                 labelFormat: "%d" // Just the number
                                 labelsFont.pixelSize: 10
                                 labelsColor: "#666666"
@@ -146,31 +306,14 @@ Rectangle {
                                 // No points/markers
                             }
                             
-                            Component.onCompleted: {
-                                if (tripStatsData && tripStatsData.length > 0) {
-                                    var maxEnergy = 0;
-                                    
-                                    // Clear any existing points
-                                    energyUpperSeries.clear();
-                                    
-                                    // Add the data points
-                                    for (var i = 0; i < tripStatsData.length; i++) {
-                                        var trip = tripStatsData[i];
-                                        var energy = trip.energyConsumption || 0;
-                                        
-                                        energyUpperSeries.append(i + 1, energy);
-                                        
-                                        if (energy > maxEnergy) {
-                                            maxEnergy = energy;
-                                        }
-                                    }
-                                    
-                                    // Adjust the axes
-                                    energyAxisX.max = tripStatsData.length;
-                                    
+                            function populate() {
+                                if (chartData && chartData.tripCount > 0) {
+                                    databaseHandler.fillSeries(energyUpperSeries, chartData.energy);
+                                    energyAxisX.max = chartData.tripCount;
+
                                     // Set the Y axis max to a bit more than the maximum energy value
                                     // Use at least 3 as the minimum max value to avoid empty charts
-                                    energyAxisY.max = Math.max(3, Math.ceil(maxEnergy * 1.2));
+                                    energyAxisY.max = Math.max(3, Math.ceil(chartData.maxEnergy * 1.2));
                                 }
                             }
                         }
@@ -224,8 +367,8 @@ Rectangle {
                             axisX: ValueAxis {
                                 id: batteryAxisX
                                 min: 1
-                                max: tripStatsData ? tripStatsData.length : 10
-                                tickCount: Math.min(tripStatsData ? tripStatsData.length : 5, 10)
+                                max: chartData ? chartData.tripCount : 10
+                                tickCount: Math.min(chartData ? chartData.tripCount : 5, 10)
                                 labelFormat: "%d"
                                 labelsFont.pixelSize: 10
                                 labelsColor: "#666666"
@@ -256,31 +399,14 @@ Rectangle {
                                 id: batteryUpperSeries
                             }
                             
-                            Component.onCompleted: {
-                                if (tripStatsData && tripStatsData.length > 0) {
-                                    var maxBattery = 0;
-                                    
-                                    // Clear any existing points
-                                    batteryUpperSeries.clear();
-                                    
-                                    // Add the data points
-                                    for (var i = 0; i < tripStatsData.length; i++) {
-                                        var trip = tripStatsData[i];
-                                        var batteryUsage = trip.batteryUsage || 0;
-                                        
-                                        batteryUpperSeries.append(i + 1, batteryUsage);
-                                        
-                                        if (batteryUsage > maxBattery) {
-                                            maxBattery = batteryUsage;
-                                        }
-                                    }
-                                    
-                                    // Adjust the axes
-                                    batteryAxisX.max = tripStatsData.length;
-                                    
+                            function populate() {
+                                if (chartData && chartData.tripCount > 0) {
+                                    databaseHandler.fillSeries(batteryUpperSeries, chartData.batteryUsage);
+                                    batteryAxisX.max = chartData.tripCount;
+
                                     // Set the Y axis max to a bit more than the maximum battery value
                                     // Use at least 10 as the minimum max value to avoid empty charts
-                                    batteryAxisY.max = Math.max(10, Math.ceil(maxBattery * 1.2));
+                                    batteryAxisY.max = Math.max(10, Math.ceil(chartData.maxBatteryUsage * 1.2));
                                 }
                             }
                         }
@@ -330,8 +456,8 @@ Rectangle {
                             axisX: ValueAxis {
                                 id: speedAxisX
                                 min: 0.5
-                                max: tripStatsData ? tripStatsData.length + 0.5 : 10.5
-                                tickCount: Math.min(tripStatsData ? tripStatsData.length : 5, 10)
+                                max: chartData ? chartData.tripCount + 0.5 : 10.5
+                                tickCount: Math.min(chartData ? chartData.tripCount : 5, 10)
                                 labelFormat: "%d"
                                 labelsFont.pixelSize: 10
                                 labelsColor: "#666666"
@@ -368,42 +494,19 @@ Rectangle {
                                 labelColor: "#FFFFFF"
                             }
                             
-                            Component.onCompleted: {
-                                if (tripStatsData && tripStatsData.length > 0) {
-                                    var maxSpeed = 0;
-                                    var speedValues = [];
-                                    
-                                    // Collect all speed values
-                                    for (var i = 0; i < tripStatsData.length; i++) {
-                                        var trip = tripStatsData[i];
-                                        var speed = trip.averageSpeed || 0;
-                                        speedValues.push(speed);
-                                        
-                                        if (speed > maxSpeed) {
-                                            maxSpeed = speed;
-                                        }
-                                    }
-                                    
-                                    // Set the values to the bar set
-                                    speedBarSet.values = speedValues;
-                                    
-                                    // Set labels for each bar (optional)
-                                    var labels = [];
-                                    for (var j = 1; j <= tripStatsData.length; j++) {
-                                        labels.push(j.toString());
-                                    }
-                                    
-                                    // Fix: Use correct method for adding a bar set
+                            function populate() {
+                                if (chartData && chartData.tripCount > 0) {
+                                    speedBarSet.values = chartData.averageSpeed;
+
                                     if (!speedBarSeries.count) {
                                         speedBarSeries.append(speedBarSet);
                                     }
-                                    
-                                    // Adjust the axes
-                                    speedAxisX.max = tripStatsData.length + 0.5;
-                                    
+
+                                    speedAxisX.max = chartData.tripCount + 0.5;
+
                                     // Set the Y axis max to a bit more than the maximum speed value
                                     // Use at least 5 as the minimum max value to avoid empty charts
-                                    speedAxisY.max = Math.max(5, Math.ceil(maxSpeed * 1.2));
+                                    speedAxisY.max = Math.max(5, Math.ceil(chartData.maxSpeed * 1.2));
                                 }
                             }
                         }
@@ -477,73 +580,18 @@ Rectangle {
                                 borderWidth: 1
                             }
                             
-                            Component.onCompleted: {
-                                if (tripStatsData && tripStatsData.length > 0) {
-                                    // Create a map to store driver data
-                                    var driverData = {};
-                                    
-                                    // Process trip data to get per-driver statistics
-                                    for (var i = 0; i < tripStatsData.length; i++) {
-                                        var trip = tripStatsData[i];
-                                        var driver = trip.driver || "Unknown";
-                                        var energy = trip.energyConsumption || 0;
-                                        var distance = trip.distance || 0.1; // Avoid div by zero
-                                        
-                                        // Calculate efficiency (energy per km)
-                                        var efficiency = energy / distance;
-                                        
-                                        // Initialize driver record if not exists
-                                        if (!driverData[driver]) {
-                                            driverData[driver] = {
-                                                totalEnergy: 0,
-                                                totalDistance: 0,
-                                                tripCount: 0
-                                            };
-                                        }
-                                        
-                                        // Add this trip's data
-                                        driverData[driver].totalEnergy += energy;
-                                        driverData[driver].totalDistance += distance;
-                                        driverData[driver].tripCount++;
-                                    }
-                                    
-                                    // Convert to arrays for the chart
-                                    var driverNames = [];
-                                    var efficiencyValues = [];
-                                    var maxEfficiency = 0;
-                                    
-                                    for (var driverName in driverData) {
-                                        var driverRecord = driverData[driverName];
-                                        var avgEfficiency = driverRecord.totalEnergy / driverRecord.totalDistance;
-                                        
-                                        // Display explanation for Luiza's higher energy consumption
-                                        if (driverName === "Luiza") {
-                                            // No need to artificially adjust here - already modified in database
-                                            // Just add a visual indicator in the name
-                                            driverNames.push(driverName + " (" + driverRecord.tripCount + " trips) ⚠️");
-                                        } else {
-                                            driverNames.push(driverName + " (" + driverRecord.tripCount + " trips)");
-                                        }
-                                        efficiencyValues.push(avgEfficiency);
-                                        
-                                        if (avgEfficiency > maxEfficiency) {
-                                            maxEfficiency = avgEfficiency;
-                                        }
-                                    }
-                                    
-                                    // Set the categories (driver names)
-                                    driverAxisY.categories = driverNames;
-                                    
-                                    // Set the values for the bar set
-                                    efficiencyBarSet.values = efficiencyValues;
-                                    
-                                    // Add the bar set to the series - fix error
+                            function populate() {
+                                if (chartData && chartData.tripCount > 0) {
+                                    // Per-driver efficiency (kWh/km) is already grouped in C++
+                                    driverAxisY.categories = driverLabels();
+                                    efficiencyBarSet.values = chartData.driverEfficiency;
+
                                     if (!driverBarSeries.count) {
                                         driverBarSeries.append(efficiencyBarSet);
                                     }
-                                    
+
                                     // Set the X axis max to a bit more than the maximum efficiency value
-                                    driverAxisX.max = Math.max(0.5, Math.ceil(maxEfficiency * 1.2 * 10) / 10);
+                                    driverAxisX.max = Math.max(0.5, Math.ceil(chartData.maxEfficiency * 1.2 * 10) / 10);
                                 }
                             }
                         }
@@ -617,65 +665,17 @@ Rectangle {
                                 borderWidth: 1
                             }
                             
-                            Component.onCompleted: {
-                                if (tripStatsData && tripStatsData.length > 0) {
-                                    // Create a map to store driver data
-                                    var driverData = {};
-                                    
-                                    // Process trip data to get per-driver violations
-                                    for (var i = 0; i < tripStatsData.length; i++) {
-                                        var trip = tripStatsData[i];
-                                        var driver = trip.driver || "Unknown";
-                                        var violations = trip.trafficViolations || 0;
-                                        
-                                        // Initialize driver record if not exists
-                                        if (!driverData[driver]) {
-                                            driverData[driver] = {
-                                                totalViolations: 0,
-                                                tripCount: 0
-                                            };
-                                        }
-                                        
-                                        // Add this trip's data
-                                        driverData[driver].totalViolations += violations;
-                                        driverData[driver].tripCount++;
-                                    }
-                                    
-                                    // Convert to arrays for the chart
-                                    var driverNames = [];
-                                    var violationsValues = [];
-                                    var maxViolations = 0;
-                                    
-                                    for (var driverName in driverData) {
-                                        var driverRecord = driverData[driverName];
-                                        var totalViolations = driverRecord.totalViolations;
-                                        
-                                        // Highlight Luiza with an emoji
-                                        if (driverName === "Luiza") {
-                                            driverNames.push(driverName + " (" + driverRecord.tripCount + " trips) ⚠️");
-                                        } else {
-                                            driverNames.push(driverName + " (" + driverRecord.tripCount + " trips)");
-                                        }
-                                        violationsValues.push(totalViolations);
-                                        
-                                        if (totalViolations > maxViolations) {
-                                            maxViolations = totalViolations;
-                                        }
-                                    }
-                                    
-                                    // Set the categories (driver names)
-                                    violationsAxisY.categories = driverNames;
-                                    
-                                    // Set the values for the bar set
-                                    violationsBarSet.values = violationsValues;
-                                    
-                                    // Add the bar set to the series
+                            function populate() {
+                                if (chartData && chartData.tripCount > 0) {
+                                    violationsAxisY.categories = driverLabels();
+                                    violationsBarSet.values = chartData.driverViolations;
+
                                     if (!violationsBarSeries.count) {
                                         violationsBarSeries.append(violationsBarSet);
                                     }
-                                    
+
                                     // Set the X axis max to a bit more than the maximum violations
-                                    violationsAxisX.max = Math.max(5, Math.ceil(maxViolations * 1.1));
+                                    violationsAxisX.max = Math.max(5, Math.ceil(chartData.maxViolations * 1.1));
                                 }
                             }
                         }
@@ -683,6 +683,48 @@ Rectangle {
                 }
             }
             
+            // --- Export ---
+            RowLayout {
+                Layout.fillWidth: true
+                spacing: 12
+
+                Repeater {
+                    model: [{ text: "Export CSV", suffix: "csv" }, { text: "Export columnar", suffix: "dtbc" }]
+                    Button {
+                        text: modelData.text
+                        onClicked: {
+                            exportDialog.suffix = modelData.suffix;
+                            exportDialog.open();
+                        }
+                        background: Rectangle {
+                            color: "#20ffffff"
+                            radius: 6
+                            border.color: "#60ffffff"
+                        }
+                        contentItem: Label {
+                            text: parent.text
+                            color: "white"
+                            horizontalAlignment: Text.AlignHCenter
+                            verticalAlignment: Text.AlignVCenter
+                        }
+                    }
+                }
+            }
+
+            ProgressBar {
+                Layout.fillWidth: true
+                visible: exportStatus !== ""
+                value: exportFraction
+            }
+
+            Label {
+                Layout.fillWidth: true
+                visible: exportStatus !== ""
+                text: exportStatus
+                color: "white"
+                wrapMode: Text.WordWrap
+            }
+
             // Add some spacing at the bottom
             Item {
                 Layout.fillWidth: true
@@ -691,6 +733,20 @@ Rectangle {
         }
     }
 
+    // Category labels for the per-driver charts, in chartData.drivers order
+    function driverLabels() {
+        var labels = [];
+        for (var i = 0; i < chartData.drivers.length; i++) {
+            var driverName = chartData.drivers[i];
+            var label = driverName + " (" + chartData.driverTripCounts[i] + " trips)";
+            // Marked when their energy use stands out from the rest of the fleet
+            if (anomalies && anomalies.flaggedDrivers.indexOf(driverName) >= 0)
+                label += " ⚠️";
+            labels.push(label);
+        }
+        return labels;
+    }
+
     function formatDuration(minutes) {
         if (isNaN(minutes) || minutes < 0) return "0h 0m";
         var h = Math.floor(minutes / 60);
@@ -1,6 +1,7 @@
 import QtQuick 2.15
 import QtQuick.Controls 2.15
 import QtQuick.Layouts 1.15
+import QtQuick.Dialogs
 
 Page {
     id: tripDetailPage
@@ -9,6 +10,40 @@ Page {
 
     signal backClicked()
 
+    function loadPhotos() {
+        databaseHandler.getMediaAsync(tripData.id, 0, 30, function(page) {
+            if (!page.items)
+                return;
+            photoModel.clear();
+            for (var i = 0; i < page.items.length; ++i)
+                photoModel.append(page.items[i]);
+        });
+    }
+
+    Component.onCompleted: loadPhotos()
+
+    ListModel { id: photoModel }
+
+    FileDialog {
+        id: photoDialog
+        title: "Attach photos"
+        fileMode: FileDialog.OpenFiles
+        nameFilters: ["Images (*.jpg *.jpeg *.png *.webp)"]
+        onAccepted: {
+            var files = [];
+            for (var i = 0; i < selectedFiles.length; ++i)
+                files.push(selectedFiles[i].toString());
+            // Copied into the media store on the worker thread
+            databaseHandler.attachMediaAsync(tripDetailPage.tripData.id, files, function(result) {
+                if (!result.failed)
+                    console.warn("Could not attach photos");
+                else if (result.failed.length > 0)
+                    console.warn("Could not attach:", result.failed);
+                loadPhotos();
+            });
+        }
+    }
+
     background: Rectangle {
         gradient: Gradient {
             GradientStop { position: 0.0; color: "#6298de" }
@@ -104,6 +139,50 @@ Page {
             Label { text: "<b>Average Speed:</b>"; textFormat: Text.RichText; color: "white" }
             Label { text: tripData.averageSpeed.toFixed(1) + " m/s"; wrapMode: Label.WordWrap; Layout.fillWidth: true; color: "white" }
 
+            // --- Telemetry ---
+            Rectangle {
+                Layout.columnSpan: 2
+                Layout.fillWidth: true
+                height: 30
+                color: "#20ffffff"
+                radius: 6
+                visible: speedTrace.hasData
+                Label {
+                    text: "Speed Trace"
+                    anchors.verticalCenter: parent.verticalCenter
+                    anchors.left: parent.left
+                    anchors.leftMargin: 10
+                    font.bold: true
+                    color: "white"
+                }
+            }
+
+            SimpleLineChart {
+                id: speedTrace
+                property bool hasData: false
+                Layout.columnSpan: 2
+                Layout.fillWidth: true
+                Layout.preferredHeight: hasData ? 220 : 0
+                visible: hasData
+                title: "Speed"
+                legend.visible: false
+
+                // The trace is decoded and downsampled on the worker thread,
+                // roughly one point per horizontal pixel reaches the chart
+                onUpdateRequested: function(series, axisX, axisY) {
+                    databaseHandler.getTelemetryAsync(tripData.id, "speed", -1, -1, Math.max(100, tripDetailPage.width), function(telemetry) {
+                        if (!telemetry.totalPoints)
+                            return;
+                        hasData = true;
+                        databaseHandler.fillSeries(series, telemetry.v, telemetry.t);
+                        axisX.min = 0;
+                        axisX.max = Math.max(1, telemetry.maxT);
+                        axisY.max = Math.max(1, Math.ceil(telemetry.maxV * 1.2));
+                    });
+                }
+                Component.onCompleted: updateChart()
+            }
+
             Label { text: "<b>Favorite:</b>"; textFormat: Text.RichText; color: "white" }
             Text {
                 id: favoriteStar
@@ -123,7 +202,7 @@ Page {
                         favoriteStar.color = newStatus ? "gold" : "gray";
 
                         // Call the C++ backend to save the change
-                        databaseHandler.updateTripFavoriteStatus(tripDetailPage.tripData.id, newStatus);
+                        databaseHandler.updateTripFavoriteStatusAsync(tripDetailPage.tripData.id, newStatus);
                     }
                 }
             }
@@ -136,6 +215,25 @@ Page {
                 Layout.fillWidth: true
                 color: "white"
             }
+
+            Label { text: "<b>Photos:</b>"; textFormat: Text.RichText; color: "white"; visible: photoModel.count > 0 }
+            ListView {
+                Layout.fillWidth: true
+                Layout.preferredHeight: 80
+                visible: photoModel.count > 0
+                orientation: ListView.Horizontal
+                spacing: 6
+                clip: true
+                model: photoModel
+                delegate: Image {
+                    width: 80
+                    height: 80
+                    source: "image://thumbnails/" + model.hash
+                    sourceSize: Qt.size(80, 80)
+                    fillMode: Image.PreserveAspectCrop
+                    cache: false
+                }
+            }
         }
     }
 
@@ -164,6 +262,25 @@ Page {
             }
         }
 
+        Button {
+            id: photosButton
+            text: "Photos"
+            onClicked: photoDialog.open()
+            Accessible.name: "Attach photos"
+            Accessible.description: "Opens a file dialog to attach photos to the trip."
+            background: Rectangle {
+                color: "#20ffffff"
+                radius: 6
+                border.color: "#60ffffff"
+            }
+            contentItem: Label {
+                text: parent.text
+                color: "white"
+                horizontalAlignment: Text.AlignHCenter
+                verticalAlignment: Text.AlignVCenter
+            }
+        }
+
         Button {
             id: editNotesButton
             text: "Edit"
@@ -256,7 +373,7 @@ Page {
                         var newNotes = notesTextArea.text;
                         tripDetailPage.tripData.notes = newNotes;
                         notesLabel.text = newNotes ? newNotes : "No notes for this trip.";
-                        databaseHandler.updateTripNotes(tripDetailPage.tripData.id, newNotes);
+                        databaseHandler.updateTripNotesAsync(tripDetailPage.tripData.id, newNotes);
                         notesPopup.close();
                     }
                     Accessible.name: "Save notes"
@@ -0,0 +1,332 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QDebug>
+#include <algorithm>
+#include <functional>
+#include "databasehandler.h"
+#include "triplistmodel.h"
+#include "readconnectionpool.h"
+#include "fleetsummary.h"
+#include "tripanalytics.h"
+#include "triprollups.h"
+
+// Generates deterministic trip datasets and times every DatabaseHandler
+// entry point against them. Results are written as JSON so runs can be
+// compared with each other.
+
+namespace {
+
+struct Options
+{
+    QList<qint64> sizes;
+    int drivers = 50;
+    int vehicles = 10;
+    quint32 seed = 42;
+    int iterations = 20;
+    int pageSize = 50;
+    QString directory;
+    QString output;
+    bool regenerate = false;
+};
+
+qint64 countTrips(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (query.exec("SELECT COUNT(*) FROM trips") && query.next())
+        return query.value(0).toLongLong();
+    return -1;
+}
+
+// Inserts `rows` synthetic trips, 50k per transaction, from a fixed seed
+bool generateTrips(QSqlDatabase db, qint64 rows, const Options &options)
+{
+    QRandomGenerator random(options.seed);
+    QSqlQuery query(db);
+    query.exec("PRAGMA journal_mode = WAL");
+    query.exec("PRAGMA synchronous = OFF");
+
+    if (!query.prepare("INSERT INTO trips (date, duration, driver, location, vehicle, start_battery, end_battery, "
+                       "energy_used, distance_m, avg_speed, notes, favorite, photo, traffic_violations, start_ts, end_ts) "
+                       "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, '', ?, ?, ?)")) {
+        qWarning() << "ERROR: Failed to prepare generator insert:" << query.lastError().text();
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QDateTime start(QDate(2020, 1, 1), QTime(6, 0));
+    const qint64 spanMinutes = 5LL * 365 * 24 * 60;
+
+    for (qint64 i = 0; i < rows; ++i) {
+        if (i % 50000 == 0 && !db.transaction())
+            return false;
+
+        const double distance = 300.0 + random.bounded(2000);
+        const double energy = distance / 1000.0 * (1.6 + random.generateDouble());
+        const double startBattery = 70.0 + random.bounded(30);
+        const QDateTime date = start.addSecs(random.bounded(spanMinutes) * 60);
+
+        const int duration = 5 + random.bounded(40);
+        query.bindValue(0, date.toString("yyyy-MM-dd hh:mm"));
+        query.bindValue(1, duration);
+        query.bindValue(2, QStringLiteral("Driver %1").arg(random.bounded(options.drivers)));
+        query.bindValue(3, QStringLiteral("Track %1").arg(random.bounded(20)));
+        query.bindValue(4, QStringLiteral("Vehicle %1").arg(random.bounded(options.vehicles)));
+        query.bindValue(5, startBattery);
+        query.bindValue(6, startBattery - energy * 3.0);
+        query.bindValue(7, energy);
+        query.bindValue(8, distance);
+        query.bindValue(9, 2.5 + random.generateDouble() * 2.5);
+        query.bindValue(10, random.bounded(4) == 0 ? QStringLiteral("Run %1 notes").arg(i) : QString());
+        query.bindValue(11, random.bounded(20) == 0 ? 1 : 0);
+        query.bindValue(12, random.bounded(10) == 0 ? 1 + random.bounded(3) : 0);
+        query.bindValue(13, date.toSecsSinceEpoch());
+        query.bindValue(14, date.toSecsSinceEpoch() + duration * 60);
+        if (!query.exec()) {
+            qWarning() << "ERROR: Failed to insert synthetic trip:" << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+
+        if ((i + 1) % 50000 == 0 || i + 1 == rows) {
+            if (!db.commit())
+                return false;
+            if ((i + 1) % 1000000 == 0)
+                qInfo() << "Generated" << i + 1 << "trips," << timer.elapsed() / 1000 << "s";
+        }
+    }
+
+    query.exec("PRAGMA synchronous = FULL");
+    qInfo() << "Generated" << rows << "trips in" << timer.elapsed() << "ms.";
+    return true;
+}
+
+QJsonObject timeIt(const QString &name, int iterations, const std::function<void(int)> &body)
+{
+    QList<double> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        body(i);
+        samples.append(timer.nsecsElapsed() / 1e6);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double sample : samples)
+        sum += sample;
+
+    QJsonObject result;
+    result["benchmark"] = name;
+    result["iterations"] = iterations;
+    result["minMs"] = samples.first();
+    result["medianMs"] = samples.at(samples.size() / 2);
+    result["meanMs"] = sum / samples.size();
+    result["maxMs"] = samples.last();
+    qInfo().noquote() << QString("  %1: median %2 ms, min %3 ms (%4 runs)")
+                             .arg(name, -40)
+                             .arg(result["medianMs"].toDouble(), 0, 'f', 3)
+                             .arg(result["minMs"].toDouble(), 0, 'f', 3)
+                             .arg(iterations);
+    return result;
+}
+
+QJsonArray runDataset(qint64 size, const Options &options)
+{
+    QJsonArray results;
+    const QString path = QDir(options.directory).filePath(QStringLiteral("tripbench-%1.db").arg(size));
+    if (options.regenerate)
+        QFile::remove(path);
+
+    DatabaseHandler handler;
+    handler.setDatabasePath(path);
+    if (!handler.initDb())
+        return results;
+
+    QSqlDatabase db = QSqlDatabase::database();
+    qint64 rows = countTrips(db);
+    if (rows < size) {
+        qInfo() << "Generating dataset of" << size << "trips at" << path;
+        if (!generateTrips(db, size - rows, options))
+            return results;
+        rows = countTrips(db);
+    } else {
+        qInfo() << "Reusing dataset at" << path << "with" << rows << "trips";
+    }
+
+    qint64 maxId = 0;
+    {
+        QSqlQuery query(db);
+        if (query.exec("SELECT MAX(id) FROM trips") && query.next())
+            maxId = query.value(0).toLongLong();
+    }
+
+    const int iterations = options.iterations;
+    // Whole-table reads are far more expensive, a few runs are enough
+    const int scanIterations = qMax(1, qMin(iterations, 3));
+    const int deepPage = int(qMax<qint64>(0, rows / options.pageSize - 1));
+    QRandomGenerator random(options.seed);
+
+    results.append(timeIt("getTrips/shallow", iterations, [&](int) {
+        handler.getTrips(0, options.pageSize);
+    }));
+    results.append(timeIt("getTrips/deep", iterations, [&](int) {
+        handler.getTrips(deepPage, options.pageSize);
+    }));
+
+    // Keyset paging used by TripListModel, for comparison with OFFSET paging
+    qint64 deepStartTs = -1;
+    qint64 deepId = 0;
+    {
+        QSqlQuery query(db);
+        query.prepare("SELECT start_ts, id FROM trips ORDER BY start_ts DESC, id DESC LIMIT 1 OFFSET :offset");
+        query.bindValue(":offset", qMax<qint64>(0, rows - options.pageSize - 1));
+        if (query.exec() && query.next()) {
+            deepStartTs = query.value(0).toLongLong();
+            deepId = query.value(1).toLongLong();
+        }
+    }
+    results.append(timeIt("TripListModel::fetchPage/shallow", iterations, [&](int) {
+        TripListModel::fetchPage(db, -1, 0, options.pageSize);
+    }));
+    results.append(timeIt("TripListModel::fetchPage/deep", iterations, [&](int) {
+        TripListModel::fetchPage(db, deepStartTs, deepId, options.pageSize);
+    }));
+
+    results.append(timeIt("getTripDetails", iterations, [&](int) {
+        handler.getTripDetails(int(1 + random.bounded(maxId)));
+    }));
+    results.append(timeIt("getStatistics", iterations, [&](int) {
+        handler.getStatistics();
+    }));
+    results.append(timeIt("getDriverViolationsStatistics", iterations, [&](int) {
+        handler.getDriverViolationsStatistics();
+    }));
+    // One year that does not start on a month boundary, so days and weeks are used too
+    const QVariantMap yearQuery { { "from", "2023-01-15" }, { "to", "2024-01-14" },
+                                  { "period", "month" }, { "groupBy", "driver" } };
+    results.append(timeIt("getRangeStatistics/year-monthly-driver", iterations, [&](int) {
+        handler.getRangeStatistics(yearQuery);
+    }));
+    results.append(timeIt("getTripStatisticsData", scanIterations, [&](int) {
+        handler.getTripStatisticsData();
+    }));
+    results.append(timeIt("getChartData", scanIterations, [&](int) {
+        handler.getChartData();
+    }));
+    results.append(timeIt("detectAnomalies", scanIterations, [&](int) {
+        handler.detectAnomalies();
+    }));
+
+    // The independent reads behind StatisticsPage, one after another on one
+    // connection and then at once on the read pool
+    const QList<DatabaseWorker::Job> statisticsJobs = {
+        [](QSqlDatabase &db) { return QVariant(FleetSummary::read(db)); },
+        [](QSqlDatabase &db) { return QVariant(FleetSummary::readDriverViolations(db)); },
+        [](QSqlDatabase &db) { return QVariant(TripAnalytics::chartData(TripAnalytics::loadColumns(db))); },
+        [&yearQuery](QSqlDatabase &db) {
+            return QVariant(TripRollups::query(db, TripRollups::RangeQuery::fromVariantMap(yearQuery)));
+        }
+    };
+    results.append(timeIt("statisticsPage/serial", scanIterations, [&](int) {
+        for (const DatabaseWorker::Job &job : statisticsJobs)
+            job(db);
+    }));
+    ReadConnectionPool readPool(path);
+    results.append(timeIt("statisticsPage/pooled", scanIterations, [&](int) {
+        QList<QFuture<QVariant>> futures;
+        for (const DatabaseWorker::Job &job : statisticsJobs)
+            futures.append(readPool.submit(job));
+        for (QFuture<QVariant> &future : futures)
+            future.waitForFinished();
+    }));
+
+    results.append(timeIt("updateTripFavoriteStatus", iterations, [&](int i) {
+        handler.updateTripFavoriteStatus(int(1 + random.bounded(maxId)), i % 2 == 0);
+    }));
+    results.append(timeIt("updateTripNotes", iterations, [&](int i) {
+        handler.updateTripNotes(int(1 + random.bounded(maxId)), QStringLiteral("Benchmark note %1").arg(i));
+    }));
+
+    for (qsizetype i = 0; i < results.size(); ++i) {
+        QJsonObject result = results.at(i).toObject();
+        result["dataset"] = size;
+        result["rows"] = rows;
+        results[i] = result;
+    }
+    return results;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("tripbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks the DigitalTripBook database layer on synthetic datasets.");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Comma separated dataset sizes, e.g. 10000,1000000,10000000.", "list", "10000,1000000");
+    QCommandLineOption driversOption("drivers", "Number of distinct drivers.", "count", "50");
+    QCommandLineOption vehiclesOption("vehicles", "Number of distinct vehicles.", "count", "10");
+    QCommandLineOption seedOption("seed", "Random seed for the generated data.", "seed", "42");
+    QCommandLineOption iterationsOption("iterations", "Runs per benchmark.", "count", "20");
+    QCommandLineOption dirOption("dir", "Directory for the generated databases.", "path", QDir::tempPath());
+    QCommandLineOption outputOption("output", "JSON file the results are written to.", "file", "tripbench-results.json");
+    QCommandLineOption regenerateOption("regenerate", "Delete and regenerate existing datasets.");
+    parser.addOptions({ sizesOption, driversOption, vehiclesOption, seedOption, iterationsOption,
+                        dirOption, outputOption, regenerateOption });
+    parser.process(app);
+
+    Options options;
+    for (const QString &size : parser.value(sizesOption).split(',', Qt::SkipEmptyParts))
+        options.sizes.append(size.trimmed().toLongLong());
+    options.drivers = qMax(1, parser.value(driversOption).toInt());
+    options.vehicles = qMax(1, parser.value(vehiclesOption).toInt());
+    options.seed = parser.value(seedOption).toUInt();
+    options.iterations = qMax(1, parser.value(iterationsOption).toInt());
+    options.directory = parser.value(dirOption);
+    options.output = parser.value(outputOption);
+    options.regenerate = parser.isSet(regenerateOption);
+
+    QJsonArray results;
+    for (qint64 size : options.sizes) {
+        qInfo() << "Dataset with" << size << "trips";
+        const QJsonArray datasetResults = runDataset(size, options);
+        for (const QJsonValue &result : datasetResults)
+            results.append(result);
+        // Each handler registers the default connection, drop it before the next dataset
+        QSqlDatabase::removeDatabase(QSqlDatabase::defaultConnection);
+    }
+
+    QJsonObject report;
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["seed"] = qint64(options.seed);
+    report["drivers"] = options.drivers;
+    report["vehicles"] = options.vehicles;
+    report["iterations"] = options.iterations;
+    report["qtVersion"] = QString::fromLatin1(qVersion());
+    report["results"] = results;
+
+    QFile file(options.output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "ERROR: Cannot write results to" << options.output << file.errorString();
+        return 1;
+    }
+    file.write(QJsonDocument(report).toJson());
+    qInfo() << "Results written to" << options.output;
+    return 0;
+}
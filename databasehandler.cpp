@@ -1,24 +1,142 @@
 #include "databasehandler.h"
+#include "fleetsummary.h"
+#include "tripanalytics.h"
+#include "tripimporter.h"
+#include "tripexporter.h"
+#include "tripchanges.h"
+#include "energyanomalies.h"
+#include "telemetrystore.h"
+#include "schemamigrations.h"
+#include "tripsearch.h"
+#include "tripwritequeue.h"
+#include "triprollups.h"
+#include "trip.h"
+#include "mediastore.h"
+#include "querymetrics.h"
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QStandardPaths>
 #include <QDir>
+#include <QFileInfo>
+#include <QUrl>
 #include <QDebug>
+#include <QJSEngine>
+#include <algorithm>
+
+// QML telemetry samples ({ t, speed, battery, latitude, longitude }) to the store's type
+static QList<TelemetrySample> telemetrySamples(const QVariantList &samples)
+{
+    QList<TelemetrySample> converted;
+    converted.reserve(samples.size());
+    for (const QVariant &value : samples) {
+        const QVariantMap map = value.toMap();
+        TelemetrySample sample;
+        sample.timestampMs = map.value("t").toLongLong();
+        sample.speed = map.value("speed").toDouble();
+        sample.battery = map.value("battery").toDouble();
+        sample.latitude = map.value("latitude").toDouble();
+        sample.longitude = map.value("longitude").toDouble();
+        converted.append(sample);
+    }
+    return converted;
+}
 
 DatabaseHandler::DatabaseHandler(QObject *parent) : QObject(parent)
 {
 }
 
-bool DatabaseHandler::initDb()
+DatabaseHandler::~DatabaseHandler()
 {
+    delete m_readPool;
+    m_readPool = nullptr;
+    // Pending edits go to the worker first; it writes them before it stops
+    delete m_writeQueue;
+    m_writeQueue = nullptr;
+    // Stop the worker thread before the GUI connection goes away
+    delete m_worker;
+    m_worker = nullptr;
+}
+
+void DatabaseHandler::setEngine(QJSEngine *engine)
+{
+    m_engine = engine;
+}
+
+void DatabaseHandler::setDatabasePath(const QString &path)
+{
+    m_databasePath = path;
+}
+
+QString DatabaseHandler::databasePath() const
+{
+    if (!m_databasePath.isEmpty())
+        return m_databasePath;
+
     // Use a standard location for the database file
     QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
     QDir dir(path);
     if (!dir.exists())
         dir.mkpath(".");
 
+    return path + "/trips.db";
+}
+
+QString DatabaseHandler::mediaPath() const
+{
+    return QFileInfo(databasePath()).absolutePath() + "/media";
+}
+
+bool DatabaseHandler::initDb()
+{
+    if (!openConnection())
+        return false;
+    if (!prepareSchema(m_db))
+        return false;
+
+    // The worker opens its own connection to the same file, so it can only
+    // start once the schema exists
+    startWorker();
+    startReaders();
+    setSummary(fetchStatistics(m_db));
+    setReady(true);
+    return true;
+}
+
+void DatabaseHandler::initDbAsync()
+{
+    const QString path = databasePath();
+
+    // Mapping a few KB is far cheaper than opening and migrating SQLite, so
+    // the first frame can already show last session's numbers
+    m_snapshot = StartupSnapshot::load(StartupSnapshot::pathFor(path));
+    if (m_snapshot.valid)
+        setSummary(m_snapshot.summary);
+
+    // Migration is the worker's first job; everything QML submits meanwhile
+    // queues behind it on the same thread
+    startWorker();
+    m_worker->submit([](QSqlDatabase &db) {
+        if (!prepareSchema(db))
+            return QVariant();
+        return QVariant(fetchStatistics(db));
+    }).then(this, [this](const QVariant &result) {
+        if (!result.isValid()) {
+            qWarning() << "ERROR: Database could not be opened or migrated.";
+            return;
+        }
+        // Migrated already, so opening the GUI connection is just a file open
+        if (!openConnection())
+            return;
+        startReaders();
+        setSummary(result.toMap());
+        setReady(true);
+    });
+}
+
+bool DatabaseHandler::openConnection()
+{
     m_db = QSqlDatabase::addDatabase("QSQLITE");
-    m_db.setDatabaseName(path + "/trips.db");
+    m_db.setDatabaseName(databasePath());
 
     if (!m_db.open()) {
         qWarning() << "Error: connection with database failed:" << m_db.lastError();
@@ -26,253 +144,660 @@ bool DatabaseHandler::initDb()
     }
 
     qInfo() << "Database connection is open at:" << m_db.databaseName();
+    return true;
+}
 
-    // Check if the table already exists to avoid trying to create it again
-    QStringList tables = m_db.tables();
-    if (!tables.contains("trips", Qt::CaseInsensitive)) {
-        qInfo() << "Trips table does not exist. Creating and populating.";
-        return populateDb();
-    } else {
-        qInfo() << "Trips table already exists. Checking for 'vehicle' column.";
-        QSqlQuery q(m_db);
-        q.prepare("PRAGMA table_info(trips)");
-        if (!q.exec()) {
-            qWarning() << "Failed to query table info:" << q.lastError().text();
-            return false;
-        }
+bool DatabaseHandler::prepareSchema(QSqlDatabase &db)
+{
+    // A file without a trips table is a first start and gets sample data
+    const bool freshDatabase = !db.tables().contains("trips", Qt::CaseInsensitive);
 
-        bool vehicleColumnExists = false;
-        while (q.next()) {
-            if (q.value("name").toString() == "vehicle") {
-                vehicleColumnExists = true;
-                break;
-            }
-        }
+    if (!SchemaMigrations::migrate(db))
+        return false;
 
-        if (!vehicleColumnExists) {
-            qInfo() << "'vehicle' column does not exist. Adding it.";
-            QSqlQuery alterQuery(m_db);
-            if (!alterQuery.exec("ALTER TABLE trips ADD COLUMN vehicle TEXT")) {
-                 qWarning() << "ERROR: Failed to add 'vehicle' column:" << alterQuery.lastError().text();
-                 return false;
-            }
-            qInfo() << "Added 'vehicle' column. Populating with default data.";
-            // Populate the new column with some default data for existing rows
-            QSqlQuery updateQuery(m_db);
-            if (!updateQuery.exec("UPDATE trips SET vehicle = 'JetRacer'")) {
-                qWarning() << "ERROR: Failed to populate 'vehicle' column:" << updateQuery.lastError().text();
-                return false;
-            }
-            qInfo() << "Populated 'vehicle' column for existing trips.";
-        }
-        
-        // Check for traffic_violations column
-        bool violationsColumnExists = false;
-        q.prepare("PRAGMA table_info(trips)");
-        if (!q.exec()) {
-            qWarning() << "Failed to query table info:" << q.lastError().text();
+    if (freshDatabase) {
+        qInfo() << "Trips table created. Populating with sample data.";
+        if (!populateDb(db))
             return false;
-        }
-        
-        while (q.next()) {
-            if (q.value("name").toString() == "traffic_violations") {
-                violationsColumnExists = true;
-                break;
-            }
-        }
-        
-        if (!violationsColumnExists) {
-            qInfo() << "'traffic_violations' column does not exist. Adding it.";
-            QSqlQuery alterViolationsQuery(m_db);
-            if (!alterViolationsQuery.exec("ALTER TABLE trips ADD COLUMN traffic_violations INTEGER DEFAULT 0")) {
-                 qWarning() << "ERROR: Failed to add 'traffic_violations' column:" << alterViolationsQuery.lastError().text();
-                 return false;
-            }
-            qInfo() << "Added 'traffic_violations' column with default value 0.";
-        }
     }
 
     qInfo() << "Database schema is up to date.";
     return true;
 }
 
-QVariantList DatabaseHandler::getTrips(int page, int pageSize)
+void DatabaseHandler::startWorker()
 {
-    QVariantList trips;
-    QSqlQuery query;
+    if (!m_worker)
+        m_worker = new DatabaseWorker(databasePath());
+    if (!m_writeQueue) {
+        m_writeQueue = new TripWriteQueue(m_worker);
+        connect(m_writeQueue, &TripWriteQueue::tripsChanged, this, [this](const QVariantList &updates, const QVariantMap &delta) {
+            emit tripsUpdated(updates);
+            applyStatisticsDelta(delta);
+        });
+    }
+}
 
-    // The OFFSET is how many records to skip (which page we are on)
-    // The LIMIT is the size of the page
-    query.prepare("SELECT id, date, driver, vehicle, notes, favorite FROM trips ORDER BY date DESC LIMIT :limit OFFSET :offset");
-    query.bindValue(":limit", pageSize);
-    query.bindValue(":offset", page * pageSize);
+void DatabaseHandler::notifyInserted(qint64 firstId, qint64 lastId, const QVariantMap &delta)
+{
+    emit tripsInserted(firstId, lastId);
+    applyStatisticsDelta(delta);
+}
 
-    if (!query.exec()) {
-        qWarning() << "ERROR: Failed to get trips:" << query.lastError().text();
-        return trips;
+void DatabaseHandler::applyStatisticsDelta(const QVariantMap &delta)
+{
+    if (delta.isEmpty())
+        return;
+
+    if (delta.value("reload").toBool()) {
+        // Too large to patch; the rollups answer a fresh read in constant time
+        submitRead([](QSqlDatabase &db) {
+            return QVariant(fetchStatistics(db));
+        }).then(this, [this](const QVariant &summary) {
+            if (summary.isValid())
+                setSummary(summary.toMap());
+        });
+    } else {
+        QVariantMap summary = m_summary;
+        TripChanges::applyToSummary(summary, delta);
+        setSummary(summary);
     }
+    emit statisticsChanged(delta);
+}
 
-    while (query.next()) {
-        QVariantMap trip;
-        trip["id"] = query.value("id");
-        trip["name"] = query.value("driver").toString();
-        trip["startDate"] = query.value("date").toString();
-        trip["vehicle"] = query.value("vehicle").toString();
-        trip["notes"] = query.value("notes").toString();
-        trip["favorite"] = query.value("favorite").toBool();
-        trips.append(trip);
-    }
+void DatabaseHandler::startReaders()
+{
+    // Read-only connections need the file migrated and in WAL mode first
+    if (!m_readPool)
+        m_readPool = new ReadConnectionPool(databasePath());
+}
 
-    return trips;
+bool DatabaseHandler::writeSnapshot(int pageSize)
+{
+    if (!m_ready)
+        return false; // never opened, keep whatever snapshot is there
+
+    // Edits still in the queue belong in the snapshot too
+    waitForWrites();
+    const QString path = StartupSnapshot::pathFor(databasePath());
+    QFuture<QVariant> future = m_worker->submit([path, pageSize](QSqlDatabase &db) {
+        const StartupSnapshot::Data data = StartupSnapshot::capture(db, pageSize);
+        return QVariant(data.valid && StartupSnapshot::save(path, data));
+    });
+    future.waitForFinished();
+    return future.result().toBool();
+}
+
+void DatabaseHandler::setReady(bool ready)
+{
+    if (m_ready == ready)
+        return;
+    m_ready = ready;
+    emit readyChanged();
+}
+
+void DatabaseHandler::setSummary(const QVariantMap &summary)
+{
+    if (m_summary == summary)
+        return;
+    m_summary = summary;
+    emit summaryChanged();
+}
+
+QVariantList DatabaseHandler::getTrips(int page, int pageSize)
+{
+    return fetchTrips(m_db, page, pageSize);
 }
 
 QVariantMap DatabaseHandler::getTripDetails(int tripId)
 {
-    QVariantMap tripDetails;
-    QSqlQuery query;
+    return fetchTripDetails(m_db, tripId);
+}
 
-    query.prepare("SELECT * FROM trips WHERE id = :id");
-    query.bindValue(":id", tripId);
+bool DatabaseHandler::updateTripFavoriteStatus(int tripId, bool isFavorite)
+{
+    if (!m_writeQueue)
+        return false;
+    // Blocking variant: goes through the queue too, so it cannot overtake queued edits
+    m_writeQueue->setFavorite(tripId, isFavorite);
+    return waitForWrites();
+}
 
-    if (!query.exec()) {
-        qWarning() << "ERROR: Failed to get trip details:" << query.lastError().text();
-        return tripDetails;
+bool DatabaseHandler::updateTripNotes(int tripId, const QString &notes)
+{
+    if (!m_writeQueue)
+        return false;
+    m_writeQueue->setNotes(tripId, notes);
+    return waitForWrites();
+}
+
+bool DatabaseHandler::flushPendingWrites()
+{
+    return waitForWrites();
+}
+
+bool DatabaseHandler::waitForWrites()
+{
+    if (!m_writeQueue)
+        return false;
+    QFuture<QVariant> future = m_writeQueue->flush();
+    if (!future.isValid())
+        return true; // nothing was ever written
+    future.waitForFinished();
+    return future.result().toBool();
+}
+
+QVariantMap DatabaseHandler::getStatistics()
+{
+    return fetchStatistics(m_db);
+}
+
+QVariantList DatabaseHandler::getTripStatisticsData()
+{
+    return fetchTripStatisticsData(m_db);
+}
+
+QVariantMap DatabaseHandler::getDriverViolationsStatistics()
+{
+    return fetchDriverViolationsStatistics(m_db);
+}
+
+QVariantMap DatabaseHandler::getChartData()
+{
+    return TripAnalytics::chartData(TripAnalytics::loadColumns(m_db));
+}
+
+void DatabaseHandler::fillSeries(QObject *series, const QList<double> &yValues, const QList<double> &xValues)
+{
+    TripAnalytics::fillSeries(series, yValues, xValues);
+}
+
+QVariantMap DatabaseHandler::detectAnomalies(const QVariantMap &options)
+{
+    return EnergyAnomalies::detect(TripAnalytics::loadColumns(m_db), EnergyAnomalies::Options::fromVariantMap(options));
+}
+
+QVariantMap DatabaseHandler::importTrips(const QString &path, int batchSize)
+{
+    const qint64 lastIdBefore = TripChanges::maxTripId(m_db);
+    TripImporter importer(m_db);
+    importer.setBatchSize(batchSize);
+    connect(&importer, &TripImporter::progress, this, &DatabaseHandler::importProgress);
+    const QVariantMap result = importer.importFile(path).toVariantMap();
+
+    // Rows of a half-finished import are committed too, so report them either way
+    const qint64 lastId = TripChanges::maxTripId(m_db);
+    if (lastId > lastIdBefore)
+        notifyInserted(lastIdBefore + 1, lastId, TripChanges::insertedDelta(m_db, lastIdBefore + 1, lastId));
+    return result;
+}
+
+QVariantMap DatabaseHandler::exportTrips(const QString &path, const QString &dataset, int rowGroupSize)
+{
+    TripExporter::Dataset which;
+    if (!TripExporter::datasetFromName(dataset, &which)) {
+        qWarning() << "ERROR: Unknown export dataset:" << dataset;
+        return TripExporter::Result().toVariantMap();
     }
+    TripExporter exporter(m_db);
+    exporter.setRowGroupSize(rowGroupSize);
+    connect(&exporter, &TripExporter::progress, this, &DatabaseHandler::exportProgress);
+    return exporter.exportFile(path, which).toVariantMap();
+}
+
+QVariantMap DatabaseHandler::getTelemetry(int tripId, const QString &channel, qint64 fromMs, qint64 toMs, int maxPoints)
+{
+    return fetchTelemetry(m_db, tripId, channel, fromMs, toMs, maxPoints);
+}
+
+bool DatabaseHandler::appendTelemetry(int tripId, const QVariantList &samples)
+{
+    return storeTelemetry(m_db, tripId, telemetrySamples(samples));
+}
+
+QVariantMap DatabaseHandler::importTelemetry(int tripId, const QString &path)
+{
+    const QString localPath = QUrl(path).isLocalFile() ? QUrl(path).toLocalFile() : path;
+    return storeTelemetryFile(m_db, tripId, localPath);
+}
+
+bool DatabaseHandler::verifySummaries()
+{
+    // Both run even when the first one fails, so each gets repaired
+    const bool fleet = FleetSummary::verify(m_db);
+    const bool rollups = TripRollups::verify(m_db);
+    return fleet && rollups;
+}
+
+QVariantMap DatabaseHandler::getRangeStatistics(const QVariantMap &query)
+{
+    return TripRollups::query(m_db, TripRollups::RangeQuery::fromVariantMap(query));
+}
+
+QVariantMap DatabaseHandler::searchTrips(const QVariantMap &query)
+{
+    return TripSearch::search(m_db, TripSearch::Query::fromVariantMap(query));
+}
+
+QVariantMap DatabaseHandler::attachMedia(int tripId, const QStringList &files)
+{
+    return MediaStore::attach(m_db, mediaPath(), tripId, files);
+}
+
+QVariantMap DatabaseHandler::getMedia(int tripId, qint64 beforeId, int limit)
+{
+    return MediaStore::list(m_db, tripId, beforeId, limit);
+}
+
+void DatabaseHandler::getTripsAsync(int page, int pageSize, const QJSValue &callback)
+{
+    dispatchRead([page, pageSize](QSqlDatabase &db) {
+        return QVariant(fetchTrips(db, page, pageSize));
+    }, callback);
+}
 
-    if (query.next()) {
-        // Extract date and time from the datetime string
-        QString dateTimeString = query.value("date").toString();
-        QDateTime dateTime = QDateTime::fromString(dateTimeString, "yyyy-MM-dd hh:mm");
-
-        tripDetails["id"] = query.value("id");
-        tripDetails["name"] = query.value("driver").toString();
-        tripDetails["startDate"] = dateTime.toString("yyyy-MM-dd");
-        tripDetails["endDate"] = dateTime.toString("yyyy-MM-dd"); // Assuming same day
-        tripDetails["startTime"] = dateTime.toString("hh:mm");
-        // Calculate end time based on duration
-        int durationMinutes = query.value("duration").toInt();
-        QDateTime endDateTime = dateTime.addSecs(durationMinutes * 60);
-        tripDetails["endTime"] = endDateTime.toString("hh:mm");
-        tripDetails["duration"] = durationMinutes;
-        tripDetails["startOdometer"] = query.value("start_battery").toDouble();
-        tripDetails["endOdometer"] = query.value("end_battery").toDouble();
-        tripDetails["energyUsed"] = query.value("energy_used").toDouble();
-        tripDetails["distance"] = query.value("distance_m").toDouble();
-        tripDetails["averageSpeed"] = query.value("avg_speed").toDouble();
-        tripDetails["vehicle"] = query.value("vehicle").toString();
-        tripDetails["location"] = query.value("location").toString();
-        tripDetails["notes"] = query.value("notes").toString();
-        tripDetails["favorite"] = query.value("favorite").toBool();
+void DatabaseHandler::getTripDetailsAsync(int tripId, const QJSValue &callback)
+{
+    dispatchRead([tripId](QSqlDatabase &db) {
+        return QVariant(fetchTripDetails(db, tripId));
+    }, callback);
+}
+
+void DatabaseHandler::updateTripFavoriteStatusAsync(int tripId, bool isFavorite, const QJSValue &callback)
+{
+    if (!m_writeQueue) {
+        qWarning() << "ERROR: Database is not initialized, dropping favorite edit.";
+        if (TripWriteQueue::Callback done = writeCallback(callback))
+            done(false);
+        return;
     }
+    m_writeQueue->setFavorite(tripId, isFavorite, writeCallback(callback));
+}
 
-    return tripDetails;
+void DatabaseHandler::updateTripNotesAsync(int tripId, const QString &notes, const QJSValue &callback)
+{
+    if (!m_writeQueue) {
+        qWarning() << "ERROR: Database is not initialized, dropping notes edit.";
+        if (TripWriteQueue::Callback done = writeCallback(callback))
+            done(false);
+        return;
+    }
+    m_writeQueue->setNotes(tripId, notes, writeCallback(callback));
 }
 
-bool DatabaseHandler::updateTripFavoriteStatus(int tripId, bool isFavorite)
+void DatabaseHandler::updateTripsFavoriteStatusAsync(const QVariantList &tripIds, bool isFavorite, const QJSValue &callback)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE trips SET favorite = :favorite WHERE id = :id");
-    query.bindValue(":favorite", isFavorite);
-    query.bindValue(":id", tripId);
+    if (!m_writeQueue) {
+        qWarning() << "ERROR: Database is not initialized, dropping favorite edits.";
+        if (TripWriteQueue::Callback done = writeCallback(callback))
+            done(false);
+        return;
+    }
+    // One batch and one transaction however many trips; the callback runs once it committed
+    QList<int> ids;
+    ids.reserve(tripIds.size());
+    for (const QVariant &id : tripIds)
+        ids.append(id.toInt());
+    m_writeQueue->setFavorites(ids, isFavorite, writeCallback(callback));
+}
 
-    if (!query.exec()) {
-        qWarning() << "ERROR: Failed to update favorite status:" << query.lastError().text();
-        return false;
+void DatabaseHandler::updateTripsNotesAsync(const QVariantList &tripIds, const QString &notes, const QJSValue &callback)
+{
+    if (!m_writeQueue) {
+        qWarning() << "ERROR: Database is not initialized, dropping notes edits.";
+        if (TripWriteQueue::Callback done = writeCallback(callback))
+            done(false);
+        return;
     }
+    QList<int> ids;
+    ids.reserve(tripIds.size());
+    for (const QVariant &id : tripIds)
+        ids.append(id.toInt());
+    m_writeQueue->setNotes(ids, notes, writeCallback(callback));
+}
 
-    qInfo() << "Trip" << tripId << "favorite status updated to" << isFavorite;
-    return true;
+TripWriteQueue::Callback DatabaseHandler::writeCallback(const QJSValue &callback)
+{
+    if (!callback.isCallable())
+        return nullptr;
+    return [this, callback](bool ok) {
+        QJSValue ret = callback.call({ QJSValue(ok) });
+        if (ret.isError())
+            qWarning() << "ERROR: Async callback failed:" << ret.toString();
+    };
 }
 
-bool DatabaseHandler::updateTripNotes(int tripId, const QString &notes)
+void DatabaseHandler::getStatisticsAsync(const QJSValue &callback)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE trips SET notes = :notes WHERE id = :id");
-    query.bindValue(":notes", notes);
-    query.bindValue(":id", tripId);
+    dispatchRead([](QSqlDatabase &db) {
+        return QVariant(fetchStatistics(db));
+    }, callback);
+}
 
-    if (!query.exec()) {
-        qWarning() << "ERROR: Failed to update notes:" << query.lastError().text();
-        return false;
+void DatabaseHandler::getTripStatisticsDataAsync(const QJSValue &callback)
+{
+    dispatchRead([](QSqlDatabase &db) {
+        return QVariant(fetchTripStatisticsData(db));
+    }, callback);
+}
+
+void DatabaseHandler::getDriverViolationsStatisticsAsync(const QJSValue &callback)
+{
+    dispatchRead([](QSqlDatabase &db) {
+        return QVariant(fetchDriverViolationsStatistics(db));
+    }, callback);
+}
+
+void DatabaseHandler::getChartDataAsync(const QJSValue &callback)
+{
+    dispatchRead([](QSqlDatabase &db) {
+        return QVariant(TripAnalytics::chartData(TripAnalytics::loadColumns(db)));
+    }, callback);
+}
+
+void DatabaseHandler::getStatisticsPageAsync(const QJSValue &callback)
+{
+    // Independent queries, each on its own reader connection
+    const QList<QFuture<QVariant>> parts = {
+        submitRead([](QSqlDatabase &db) {
+            return QVariant(fetchStatistics(db));
+        }),
+        submitRead([](QSqlDatabase &db) {
+            return QVariant(TripAnalytics::chartData(TripAnalytics::loadColumns(db)));
+        })
+    };
+    if (!parts.first().isValid()) {
+        callBack(callback, QVariantMap());
+        return;
     }
 
-    qInfo() << "Trip" << tripId << "notes updated.";
-    return true;
+    deliver(QtFuture::whenAll(parts.begin(), parts.end()).then([](const QList<QFuture<QVariant>> &done) {
+        auto resultOf = [&done](int i) {
+            return done.at(i).isValid() && done.at(i).resultCount() > 0 ? done.at(i).result() : QVariant();
+        };
+        QVariantMap page;
+        page["statistics"] = resultOf(0);
+        page["chartData"] = resultOf(1);
+        return QVariant(page);
+    }), callback);
 }
 
-QVariantMap DatabaseHandler::getStatistics()
+void DatabaseHandler::detectAnomaliesAsync(const QVariantMap &options, const QJSValue &callback)
 {
-    QVariantMap stats;
-    QSqlQuery query(m_db);
+    const EnergyAnomalies::Options parsed = EnergyAnomalies::Options::fromVariantMap(options);
+    // The kernels split across cores themselves; the reader only loads the columns
+    dispatchRead([parsed](QSqlDatabase &db) {
+        return QVariant(EnergyAnomalies::detect(TripAnalytics::loadColumns(db), parsed));
+    }, callback);
+}
+
+void DatabaseHandler::getRangeStatisticsAsync(const QVariantMap &query, const QJSValue &callback)
+{
+    const TripRollups::RangeQuery range = TripRollups::RangeQuery::fromVariantMap(query);
+    dispatchRead([range](QSqlDatabase &db) {
+        return QVariant(TripRollups::query(db, range));
+    }, callback);
+}
 
-    // Total number of trips
-    if (query.exec("SELECT COUNT(*) FROM trips")) {
-        if (query.next()) {
-            stats["totalTrips"] = query.value(0).toInt();
+void DatabaseHandler::importTripsAsync(const QString &path, int batchSize, const QJSValue &callback)
+{
+    dispatch([this, path, batchSize](QSqlDatabase &db) {
+        const qint64 lastIdBefore = TripChanges::maxTripId(db);
+        TripImporter importer(db);
+        importer.setBatchSize(batchSize);
+        // Progress is emitted on the worker thread and queued to the GUI thread
+        connect(&importer, &TripImporter::progress, this, &DatabaseHandler::importProgress, Qt::QueuedConnection);
+        const QVariantMap result = importer.importFile(path).toVariantMap();
+
+        // The delta is computed here, where the new rows are; queued ahead of the callback
+        const qint64 lastId = TripChanges::maxTripId(db);
+        if (lastId > lastIdBefore) {
+            const QVariantMap delta = TripChanges::insertedDelta(db, lastIdBefore + 1, lastId);
+            QMetaObject::invokeMethod(this, [this, lastIdBefore, lastId, delta]() {
+                notifyInserted(lastIdBefore + 1, lastId, delta);
+            }, Qt::QueuedConnection);
         }
-    } else {
-        qWarning() << "Failed to get total trips:" << query.lastError().text();
+        return QVariant(result);
+    }, callback);
+}
+
+void DatabaseHandler::exportTripsAsync(const QString &path, const QString &dataset, const QJSValue &callback)
+{
+    TripExporter::Dataset which;
+    if (!TripExporter::datasetFromName(dataset, &which)) {
+        qWarning() << "ERROR: Unknown export dataset:" << dataset;
+        QVariantMap result;
+        result["ok"] = false;
+        result["error"] = QStringLiteral("Unknown export dataset: %1").arg(dataset);
+        callBack(callback, result);
+        return;
     }
+    // Read only, so a long export runs on a reader and never holds up edits
+    const QString file = QUrl(path).isLocalFile() ? QUrl(path).toLocalFile() : path;
+    dispatchRead([this, file, which](QSqlDatabase &db) {
+        TripExporter exporter(db);
+        connect(&exporter, &TripExporter::progress, this, &DatabaseHandler::exportProgress, Qt::QueuedConnection);
+        return QVariant(exporter.exportFile(file, which).toVariantMap());
+    }, callback);
+}
+
+void DatabaseHandler::getTelemetryAsync(int tripId, const QString &channel, qint64 fromMs, qint64 toMs, int maxPoints, const QJSValue &callback)
+{
+    dispatchRead([tripId, channel, fromMs, toMs, maxPoints](QSqlDatabase &db) {
+        return QVariant(fetchTelemetry(db, tripId, channel, fromMs, toMs, maxPoints));
+    }, callback);
+}
+
+void DatabaseHandler::appendTelemetryAsync(int tripId, const QVariantList &samples, const QJSValue &callback)
+{
+    // Converted here, the worker only encodes and writes
+    const QList<TelemetrySample> converted = telemetrySamples(samples);
+    dispatch([tripId, converted](QSqlDatabase &db) {
+        return QVariant(storeTelemetry(db, tripId, converted));
+    }, callback);
+}
+
+void DatabaseHandler::importTelemetryAsync(int tripId, const QString &path, const QJSValue &callback)
+{
+    const QString localPath = QUrl(path).isLocalFile() ? QUrl(path).toLocalFile() : path;
+    dispatch([tripId, localPath](QSqlDatabase &db) {
+        return QVariant(storeTelemetryFile(db, tripId, localPath));
+    }, callback);
+}
 
-    // Total distance
-    if (query.exec("SELECT SUM(distance_m) FROM trips")) {
-        if (query.next()) {
-            stats["totalDistance"] = query.value(0).toDouble() / 1000.0; // Convert to km
+void DatabaseHandler::verifySummariesAsync(const QJSValue &callback)
+{
+    dispatch([](QSqlDatabase &db) {
+        const bool fleet = FleetSummary::verify(db);
+        const bool rollups = TripRollups::verify(db);
+        return QVariant(fleet && rollups);
+    }, callback);
+}
+
+void DatabaseHandler::searchTripsAsync(const QVariantMap &query, const QJSValue &callback)
+{
+    const quint64 generation = ++m_searchGeneration;
+    // A scan still running for an older keystroke stops now, not at its next statement
+    m_searchInterrupter.interrupt();
+    const TripSearch::Query search = TripSearch::Query::fromVariantMap(query);
+    dispatchRead([this, generation, search](QSqlDatabase &db) {
+        // A newer keystroke already queued its own search; skip or abandon this one
+        auto superseded = [this, generation]() { return m_searchGeneration.load() != generation; };
+        m_searchInterrupter.attach(db, generation);
+        if (superseded()) {
+            m_searchInterrupter.detach(generation);
+            return QVariant();
         }
-    } else {
-        qWarning() << "Failed to get total distance:" << query.lastError().text();
+        const QVariantMap result = TripSearch::search(db, search, superseded);
+        m_searchInterrupter.detach(generation);
+        if (superseded())
+            return QVariant();
+        return QVariant(result);
+    }, callback, [this, generation]() {
+        // Only the newest search calls back
+        return m_searchGeneration.load() != generation;
+    });
+}
+
+void DatabaseHandler::attachMediaAsync(int tripId, const QStringList &files, const QJSValue &callback)
+{
+    // Hashing and copying happen on the worker too, the GUI only waits for the callback
+    const QString root = mediaPath();
+    dispatch([root, tripId, files](QSqlDatabase &db) {
+        return QVariant(MediaStore::attach(db, root, tripId, files));
+    }, callback);
+}
+
+void DatabaseHandler::getMediaAsync(int tripId, qint64 beforeId, int limit, const QJSValue &callback)
+{
+    dispatchRead([tripId, beforeId, limit](QSqlDatabase &db) {
+        return QVariant(MediaStore::list(db, tripId, beforeId, limit));
+    }, callback);
+}
+
+void DatabaseHandler::dispatch(DatabaseWorker::Job job, const QJSValue &callback)
+{
+    if (!m_worker) {
+        qWarning() << "ERROR: Database is not initialized, dropping async request.";
+        callBack(callback, QVariantMap());
+        return;
     }
 
-    // Total duration
-    if (query.exec("SELECT SUM(duration) FROM trips")) {
-        if (query.next()) {
-            stats["totalDuration"] = query.value(0).toInt(); // in minutes
-        }
-    } else {
-        qWarning() << "Failed to get total duration:" << query.lastError().text();
+    // Queued edits go first, so every read sees the user's own writes
+    if (m_writeQueue)
+        m_writeQueue->flush();
+
+    deliver(m_worker->submit(std::move(job)), callback);
+}
+
+void DatabaseHandler::dispatchRead(DatabaseWorker::Job job, const QJSValue &callback, std::function<bool()> superseded)
+{
+    QFuture<QVariant> future = submitRead(std::move(job));
+    if (future.isValid())
+        deliver(std::move(future), callback, std::move(superseded));
+    else
+        callBack(callback, QVariantMap());
+}
+
+QFuture<QVariant> DatabaseHandler::submitRead(DatabaseWorker::Job job)
+{
+    if (!m_worker) {
+        qWarning() << "ERROR: Database is not initialized, dropping async request.";
+        return QFuture<QVariant>();
     }
 
-    // Total energy used
-    if (query.exec("SELECT SUM(energy_used) FROM trips")) {
-        if (query.next()) {
-            stats["totalEnergyUsed"] = query.value(0).toDouble();
-        }
-    } else {
-        qWarning() << "Failed to get total energy used:" << query.lastError().text();
+    // Readers start after the queued edits are committed, which keeps
+    // read-your-writes without serialising reads behind each other
+    QFuture<QVariant> writes = m_writeQueue ? m_writeQueue->flush() : QFuture<QVariant>();
+
+    // Until the migration is done only the worker touches the file, and
+    // its FIFO order already puts this read after the flush
+    if (!m_readPool)
+        return m_worker->submit(std::move(job));
+    return m_readPool->submit(std::move(job), writes);
+}
+
+void DatabaseHandler::deliver(QFuture<QVariant> future, const QJSValue &callback, std::function<bool()> superseded)
+{
+    setPendingRequests(m_pendingRequests + 1);
+    // Exactly one of the handlers runs, so busy always settles and the
+    // caller always hears back, with an empty map when the job failed
+    future.then(this, [this, callback, superseded](const QVariant &result) {
+        setPendingRequests(m_pendingRequests - 1);
+        if (superseded && superseded())
+            return; // a newer request answers instead
+        callBack(callback, result.isValid() ? result : QVariant(QVariantMap()));
+    }).onFailed(this, [this, callback]() {
+        qWarning() << "ERROR: Async request failed.";
+        setPendingRequests(m_pendingRequests - 1);
+        callBack(callback, QVariantMap());
+    }).onCanceled(this, [this, callback]() {
+        setPendingRequests(m_pendingRequests - 1);
+        callBack(callback, QVariantMap());
+    });
+}
+
+void DatabaseHandler::callBack(const QJSValue &callback, const QVariant &result)
+{
+    if (!callback.isCallable())
+        return;
+    if (!m_engine) {
+        qWarning() << "ERROR: No JS engine set, cannot deliver async result.";
+        return;
     }
+    QJSValue ret = callback.call({ m_engine->toScriptValue(result) });
+    if (ret.isError())
+        qWarning() << "ERROR: Async callback failed:" << ret.toString();
+}
 
-    // Number of favorite trips
-    if (query.exec("SELECT COUNT(*) FROM trips WHERE favorite = 1")) {
-        if (query.next()) {
-            stats["favoriteTrips"] = query.value(0).toInt();
-        }
-    } else {
-        qWarning() << "Failed to get favorite trips:" << query.lastError().text();
+void DatabaseHandler::setPendingRequests(int count)
+{
+    const bool wasBusy = isBusy();
+    m_pendingRequests = count;
+    if (wasBusy != isBusy())
+        emit busyChanged();
+}
+
+QVariantList DatabaseHandler::fetchTrips(QSqlDatabase &db, int page, int pageSize)
+{
+    QVariantList trips;
+    TracedQuery query(db, "fetchTrips");
+
+    // The OFFSET is how many records to skip (which page we are on)
+    // The LIMIT is the size of the page
+    query.prepare("SELECT id, start_ts, driver, vehicle, notes, favorite FROM trips ORDER BY start_ts DESC LIMIT :limit OFFSET :offset");
+    query.bindValue(":limit", pageSize);
+    query.bindValue(":offset", page * pageSize);
+
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to get trips:" << query.lastError().text();
+        return trips;
     }
 
-    // Trips per vehicle
-    QVariantMap tripsPerVehicle;
-    if (query.exec("SELECT vehicle, COUNT(*) FROM trips GROUP BY vehicle")) {
-        while (query.next()) {
-            tripsPerVehicle[query.value(0).toString()] = query.value(1).toInt();
-        }
-        stats["tripsPerVehicle"] = tripsPerVehicle;
-    } else {
-        qWarning() << "Failed to get trips per vehicle:" << query.lastError().text();
+    while (query.next()) {
+        QVariantMap trip;
+        trip["id"] = query.value("id");
+        trip["name"] = query.value("driver").toString();
+        trip["startDate"] = Trip::formatDateTime(query.value("start_ts").toLongLong());
+        trip["vehicle"] = query.value("vehicle").toString();
+        trip["notes"] = query.value("notes").toString();
+        trip["favorite"] = query.value("favorite").toBool();
+        trips.append(trip);
     }
 
-    qInfo() << "Calculated statistics:" << stats;
+    return trips;
+}
+
+QVariantMap DatabaseHandler::fetchTripDetails(QSqlDatabase &db, int tripId)
+{
+    TracedQuery query(db, "fetchTripDetails");
+
+    query.prepare("SELECT " + Trip::columns() + " FROM trips WHERE id = :id");
+    query.bindValue(":id", tripId);
 
-    return stats;
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to get trip details:" << query.lastError().text();
+        return QVariantMap();
+    }
+
+    if (!query.next())
+        return QVariantMap();
+    return Trip::fromQuery(query).toDetailsMap();
 }
 
-QVariantList DatabaseHandler::getTripStatisticsData()
+QVariantMap DatabaseHandler::fetchStatistics(QSqlDatabase &db)
+{
+    // Aggregates are kept current by triggers, see fleetsummary.cpp
+    return FleetSummary::read(db);
+}
+
+QVariantList DatabaseHandler::fetchTripStatisticsData(QSqlDatabase &db)
 {
     QVariantList tripData;
-    QSqlQuery query(m_db);
+    TracedQuery query(db, "fetchTripStatisticsData");
 
     // Fetch data needed for the new charts
-    if (query.exec("SELECT id, date, driver, distance_m, start_battery, end_battery, energy_used, avg_speed, traffic_violations FROM trips ORDER BY date ASC")) {
+    if (query.exec("SELECT id, driver, distance_m, start_battery, end_battery, energy_used, avg_speed, traffic_violations FROM trips ORDER BY start_ts ASC")) {
         while (query.next()) {
             QVariantMap trip;
             trip["id"] = query.value("id").toInt();
@@ -297,39 +822,83 @@ QVariantList DatabaseHandler::getTripStatisticsData()
         qWarning() << "Failed to get trip statistics data:" << query.lastError().text();
     }
 
-    qInfo() << "Fetched" << tripData.count() << "trips for detailed statistics.";
     return tripData;
 }
 
-bool DatabaseHandler::populateDb()
-{
-    QSqlQuery query;
-    if (!query.exec("CREATE TABLE trips ("
-                    "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-                    "date TEXT, "
-                    "duration INTEGER, "
-                    "driver TEXT, "
-                    "location TEXT, "
-                    "vehicle TEXT, " // Added vehicle column
-                    "start_battery REAL, "
-                    "end_battery REAL, "
-                    "energy_used REAL, "
-                    "distance_m REAL, "
-                    "avg_speed REAL, "
-                    "notes TEXT, "
-                    "favorite INTEGER, "
-                    "photo TEXT, "
-                    "traffic_violations INTEGER DEFAULT 0"
-                    ");")) {
-        qWarning() << "ERROR: " << query.lastError().text();
+bool DatabaseHandler::storeTelemetry(QSqlDatabase &db, int tripId, QList<TelemetrySample> samples)
+{
+    TracedQuery query(db, "storeTelemetry");
+    query.prepare("SELECT 1 FROM trips WHERE id = :trip");
+    query.bindValue(":trip", tripId);
+    if (!query.exec() || !query.next()) {
+        qWarning() << "ERROR: Cannot store telemetry for unknown trip" << tripId;
         return false;
     }
+    query.finish();
 
-    qInfo() << "Trips table created.";
+    // The store expects time order; logs are usually sorted already
+    std::stable_sort(samples.begin(), samples.end(), [](const TelemetrySample &a, const TelemetrySample &b) {
+        return a.timestampMs < b.timestampMs;
+    });
+    return TelemetryStore::append(db, tripId, samples);
+}
+
+QVariantMap DatabaseHandler::storeTelemetryFile(QSqlDatabase &db, int tripId, const QString &path)
+{
+    QVariantMap result;
+    QList<TelemetrySample> samples;
+    QString error;
+    if (!TelemetryStore::readCsv(path, &samples, &error)) {
+        qWarning() << "ERROR: Failed to read telemetry:" << error;
+        result["ok"] = false;
+        result["error"] = error;
+        return result;
+    }
+    const bool ok = storeTelemetry(db, tripId, samples);
+    result["ok"] = ok;
+    result["samples"] = ok ? qint64(samples.size()) : 0;
+    if (!ok)
+        result["error"] = QStringLiteral("Failed to store telemetry for trip %1").arg(tripId);
+    return result;
+}
+
+QVariantMap DatabaseHandler::fetchTelemetry(QSqlDatabase &db, int tripId, const QString &channel, qint64 fromMs, qint64 toMs, int maxPoints)
+{
+    QVariantMap telemetry;
+    TelemetryStore::Channel ch;
+    if (!TelemetryStore::channelFromName(channel, &ch)) {
+        qWarning() << "ERROR: Unknown telemetry channel:" << channel;
+        return telemetry;
+    }
+
+    const TelemetrySeries full = TelemetryStore::readRange(db, tripId, ch, fromMs, toMs);
+    const TelemetrySeries shown = TelemetryStore::downsample(full, maxPoints);
+
+    telemetry["totalPoints"] = int(full.t.size());
+    if (shown.t.isEmpty())
+        return telemetry;
+
+    // Charts get seconds since the first sample instead of epoch milliseconds
+    const double startMs = shown.t.first();
+    QList<double> seconds(shown.t.size());
+    for (qsizetype i = 0; i < shown.t.size(); ++i)
+        seconds[i] = (shown.t.at(i) - startMs) / 1000.0;
+
+    telemetry["startMs"] = startMs;
+    telemetry["t"] = QVariant::fromValue(seconds);
+    telemetry["v"] = QVariant::fromValue(shown.v);
+    telemetry["maxT"] = seconds.last();
+    telemetry["maxV"] = *std::max_element(shown.v.cbegin(), shown.v.cend());
+    return telemetry;
+}
+
+bool DatabaseHandler::populateDb(QSqlDatabase &db)
+{
+    TracedQuery query(db, "populateDb");
 
     // Use prepared statements to safely insert data
-    query.prepare("INSERT INTO trips (date, duration, driver, location, vehicle, start_battery, end_battery, energy_used, distance_m, avg_speed, notes, favorite, photo, traffic_violations) VALUES "
-                  "(:date, :duration, :driver, :location, :vehicle, :start_battery, :end_battery, :energy_used, :distance_m, :avg_speed, :notes, :favorite, :photo, :traffic_violations)");
+    query.prepare("INSERT INTO trips (date, start_ts, end_ts, duration, driver, location, vehicle, start_battery, end_battery, energy_used, distance_m, avg_speed, notes, favorite, photo, traffic_violations) VALUES "
+                  "(:date, :start_ts, :end_ts, :duration, :driver, :location, :vehicle, :start_battery, :end_battery, :energy_used, :distance_m, :avg_speed, :notes, :favorite, :photo, :traffic_violations)");
 
     // Sample Data
     QVariantMap trip1;
@@ -389,6 +958,9 @@ bool DatabaseHandler::populateDb()
         for (auto it = trip.constBegin(); it != trip.constEnd(); ++it) {
             query.bindValue(it.key(), it.value());
         }
+        const qint64 startTs = Trip::parseLegacyDate(trip[":date"].toString());
+        query.bindValue(":start_ts", startTs);
+        query.bindValue(":end_ts", startTs + trip[":duration"].toInt() * 60);
         if (!query.exec()) {
             qWarning() << "ERROR: " << query.lastError().text();
             return false;
@@ -399,22 +971,7 @@ bool DatabaseHandler::populateDb()
     return true;
 }
 
-QVariantMap DatabaseHandler::getDriverViolationsStatistics()
+QVariantMap DatabaseHandler::fetchDriverViolationsStatistics(QSqlDatabase &db)
 {
-    QVariantMap violationsStats;
-    QSqlQuery query(m_db);
-
-    // Get violations by driver
-    if (query.exec("SELECT driver, SUM(traffic_violations) as total FROM trips GROUP BY driver")) {
-        while (query.next()) {
-            QString driver = query.value("driver").toString();
-            int violations = query.value("total").toInt();
-            violationsStats[driver] = violations;
-        }
-    } else {
-        qWarning() << "Failed to get driver violations statistics:" << query.lastError().text();
-    }
-
-    qInfo() << "Driver violations statistics:" << violationsStats;
-    return violationsStats;
+    return FleetSummary::readDriverViolations(db);
 }
@@ -4,25 +4,187 @@
 #include <QObject>
 #include <QSqlDatabase>
 #include <QVariant>
+#include <QJSValue>
+#include <QPointer>
+#include <atomic>
+#include <functional>
+#include "databaseworker.h"
+#include "tripwritequeue.h"
+#include "startupsnapshot.h"
+#include "readconnectionpool.h"
+#include "telemetrystore.h"
+#include "tripsearch.h"
+
+class QJSEngine;
 
 class DatabaseHandler : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(bool busy READ isBusy NOTIFY busyChanged)
+    // False until the database is open and migrated; async calls made
+    // before that simply queue behind the migration
+    Q_PROPERTY(bool ready READ isReady NOTIFY readyChanged)
+    // FleetSummary::read() keys, from the startup snapshot until the live
+    // database has been read
+    Q_PROPERTY(QVariantMap summary READ summary NOTIFY summaryChanged)
 public:
     explicit DatabaseHandler(QObject *parent = nullptr);
+    ~DatabaseHandler() override;
+
+    // Engine used to convert async results into JS values for QML callbacks
+    void setEngine(QJSEngine *engine);
+    DatabaseWorker *worker() const { return m_worker; }
+    // Defaults to trips.db in the app data location; must be set before initDb()
+    void setDatabasePath(const QString &path);
+    QString databasePath() const;
+    // Photo blobs and thumbnails, next to the database file
+    QString mediaPath() const;
+    bool isBusy() const { return m_pendingRequests > 0; }
+    bool isReady() const { return m_ready; }
+    QVariantMap summary() const { return m_summary; }
+    const StartupSnapshot::Data &snapshot() const { return m_snapshot; }
 
+    // Blocking open and migration, for the command line
     Q_INVOKABLE bool initDb();
+    // GUI start: maps the startup snapshot, then opens and migrates the
+    // database on the worker thread. The sync Q_INVOKABLEs below need the
+    // GUI connection and must wait for `ready`.
+    void initDbAsync();
+    // Stores the summary and the first pageSize trips for the next launch
+    bool writeSnapshot(int pageSize);
     Q_INVOKABLE QVariantList getTrips(int page, int pageSize);
     Q_INVOKABLE QVariantMap getTripDetails(int tripId);
+    // Edits go through the write-behind queue, see tripwritequeue.h. The
+    // blocking variants return once the edit is committed.
     Q_INVOKABLE bool updateTripFavoriteStatus(int tripId, bool isFavorite);
     Q_INVOKABLE bool updateTripNotes(int tripId, const QString &notes);
+    // Writes every queued edit now and waits for the commit
+    Q_INVOKABLE bool flushPendingWrites();
     Q_INVOKABLE QVariantMap getStatistics();
     Q_INVOKABLE QVariantList getTripStatisticsData();
     Q_INVOKABLE QVariantMap getDriverViolationsStatistics();
+    // Chart series and per-driver aggregates for StatisticsPage, see tripanalytics.h
+    Q_INVOKABLE QVariantMap getChartData();
+    Q_INVOKABLE void fillSeries(QObject *series, const QList<double> &yValues, const QList<double> &xValues = {});
+    // Trips and drivers with unusual energy use over the whole history; see
+    // energyanomalies.h for the option and result keys
+    Q_INVOKABLE QVariantMap detectAnomalies(const QVariantMap &options = {});
+    // Bulk import of a CSV or JSON Lines trip log, see tripimporter.h
+    Q_INVOKABLE QVariantMap importTrips(const QString &path, int batchSize = 5000);
+    // Streaming export of "trips" or "daily" rollups to CSV, or to the
+    // columnar format when the path ends in .dtbc; see tripexporter.h
+    Q_INVOKABLE QVariantMap exportTrips(const QString &path, const QString &dataset = "trips", int rowGroupSize = 65536);
+    // Telemetry trace of one channel ("speed", "battery", "latitude", "longitude"),
+    // downsampled to at most maxPoints. Negative bounds mean the whole trip.
+    Q_INVOKABLE QVariantMap getTelemetry(int tripId, const QString &channel, qint64 fromMs = -1, qint64 toMs = -1, int maxPoints = 500);
+    // Stores samples ({ t (epoch ms), speed, battery, latitude, longitude })
+    // after the trip's existing telemetry, in one transaction
+    Q_INVOKABLE bool appendTelemetry(int tripId, const QVariantList &samples);
+    // Same for a CSV log, see TelemetryStore::readCsv(). Result keys: ok, samples, error.
+    Q_INVOKABLE QVariantMap importTelemetry(int tripId, const QString &path);
+    // Checks the fleet summary and the daily, weekly and monthly rollups
+    // against the trips table and repairs whatever drifted
+    Q_INVOKABLE bool verifySummaries();
+    // Metrics over a date range, grouped by period and driver or vehicle,
+    // answered from the rollup tables; see triprollups.h for the keys
+    Q_INVOKABLE QVariantMap getRangeStatistics(const QVariantMap &query);
+    // Full-text and faceted search, see tripsearch.h for the query and result keys
+    Q_INVOKABLE QVariantMap searchTrips(const QVariantMap &query);
+    // Trip photos, see mediastore.h. Files are paths or file: URLs; a
+    // tripId < 0 lists the photos of every trip.
+    Q_INVOKABLE QVariantMap attachMedia(int tripId, const QStringList &files);
+    Q_INVOKABLE QVariantMap getMedia(int tripId, qint64 beforeId = 0, int limit = 60);
+
+    // Async variants: reads run in parallel on the read connection pool,
+    // writes on the worker thread. The callback is invoked on the GUI
+    // thread with the same value the sync call returns. It is always
+    // invoked: failed reads answer an empty map, failed edits false.
+    Q_INVOKABLE void getTripsAsync(int page, int pageSize, const QJSValue &callback);
+    Q_INVOKABLE void getTripDetailsAsync(int tripId, const QJSValue &callback);
+    Q_INVOKABLE void updateTripFavoriteStatusAsync(int tripId, bool isFavorite, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void updateTripNotesAsync(int tripId, const QString &notes, const QJSValue &callback = QJSValue());
+    // Bulk tagging: one batch, one transaction, one callback
+    Q_INVOKABLE void updateTripsFavoriteStatusAsync(const QVariantList &tripIds, bool isFavorite, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void updateTripsNotesAsync(const QVariantList &tripIds, const QString &notes, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void getStatisticsAsync(const QJSValue &callback);
+    Q_INVOKABLE void getTripStatisticsDataAsync(const QJSValue &callback);
+    Q_INVOKABLE void getDriverViolationsStatisticsAsync(const QJSValue &callback);
+    Q_INVOKABLE void getChartDataAsync(const QJSValue &callback);
+    // Everything StatisticsPage shows, queried in parallel and delivered as
+    // one map with the keys statistics and chartData
+    Q_INVOKABLE void getStatisticsPageAsync(const QJSValue &callback);
+    Q_INVOKABLE void detectAnomaliesAsync(const QVariantMap &options, const QJSValue &callback);
+    Q_INVOKABLE void getRangeStatisticsAsync(const QVariantMap &query, const QJSValue &callback);
+    Q_INVOKABLE void importTripsAsync(const QString &path, int batchSize, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void exportTripsAsync(const QString &path, const QString &dataset, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void appendTelemetryAsync(int tripId, const QVariantList &samples, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void importTelemetryAsync(int tripId, const QString &path, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void getTelemetryAsync(int tripId, const QString &channel, qint64 fromMs, qint64 toMs, int maxPoints, const QJSValue &callback);
+    Q_INVOKABLE void verifySummariesAsync(const QJSValue &callback = QJSValue());
+    // Search-as-you-type: each call supersedes the previous one, whose
+    // callback is then never invoked
+    Q_INVOKABLE void searchTripsAsync(const QVariantMap &query, const QJSValue &callback);
+    Q_INVOKABLE void attachMediaAsync(int tripId, const QStringList &files, const QJSValue &callback = QJSValue());
+    Q_INVOKABLE void getMediaAsync(int tripId, qint64 beforeId, int limit, const QJSValue &callback);
+
+signals:
+    void busyChanged();
+    void readyChanged();
+    void summaryChanged();
+    void importProgress(qint64 rowsImported, qint64 bytesRead, qint64 bytesTotal, double rowsPerSecond);
+    void exportProgress(qint64 rowsExported, qint64 rowsTotal, double rowsPerSecond);
+
+    // Change notifications, emitted once the change has committed; see
+    // tripchanges.h for the keys. Views patch what they show instead of
+    // querying again.
+    void tripsInserted(qint64 firstId, qint64 lastId);
+    void tripsUpdated(const QVariantList &updates);
+    void statisticsChanged(const QVariantMap &delta);
 
 private:
+    static QVariantList fetchTrips(QSqlDatabase &db, int page, int pageSize);
+    static QVariantMap fetchTripDetails(QSqlDatabase &db, int tripId);
+    static QVariantMap fetchStatistics(QSqlDatabase &db);
+    static QVariantList fetchTripStatisticsData(QSqlDatabase &db);
+    static QVariantMap fetchDriverViolationsStatistics(QSqlDatabase &db);
+    static bool storeTelemetry(QSqlDatabase &db, int tripId, QList<TelemetrySample> samples);
+    static QVariantMap storeTelemetryFile(QSqlDatabase &db, int tripId, const QString &path);
+    static QVariantMap fetchTelemetry(QSqlDatabase &db, int tripId, const QString &channel, qint64 fromMs, qint64 toMs, int maxPoints);
+
+    static bool prepareSchema(QSqlDatabase &db);
+    static bool populateDb(QSqlDatabase &db);
+
+    bool openConnection();
+    void startWorker();
+    void startReaders();
+    void setReady(bool ready);
+    void setSummary(const QVariantMap &summary);
+    void notifyInserted(qint64 firstId, qint64 lastId, const QVariantMap &delta);
+    void applyStatisticsDelta(const QVariantMap &delta);
+    // Writes and ordered jobs go to the worker, independent reads to the pool
+    void dispatch(DatabaseWorker::Job job, const QJSValue &callback);
+    // `superseded` is checked on the GUI thread; when it returns true the
+    // result is dropped without calling back
+    void dispatchRead(DatabaseWorker::Job job, const QJSValue &callback, std::function<bool()> superseded = {});
+    QFuture<QVariant> submitRead(DatabaseWorker::Job job);
+    void deliver(QFuture<QVariant> future, const QJSValue &callback, std::function<bool()> superseded = {});
+    void callBack(const QJSValue &callback, const QVariant &result);
+    TripWriteQueue::Callback writeCallback(const QJSValue &callback);
+    bool waitForWrites();
+    void setPendingRequests(int count);
+
     QSqlDatabase m_db;
-    bool populateDb();
+    QString m_databasePath;
+    DatabaseWorker *m_worker = nullptr;
+    TripWriteQueue *m_writeQueue = nullptr;
+    ReadConnectionPool *m_readPool = nullptr;
+    QPointer<QJSEngine> m_engine;
+    int m_pendingRequests = 0;
+    bool m_ready = false;
+    QVariantMap m_summary;
+    StartupSnapshot::Data m_snapshot;
+    std::atomic<quint64> m_searchGeneration { 0 }; // read by the worker to drop stale searches
+    TripSearch::Interrupter m_searchInterrupter;   // aborts the statement of a superseded search
 };
 
 #endif
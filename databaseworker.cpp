@@ -0,0 +1,73 @@
+#include "databaseworker.h"
+#include "statementcache.h"
+#include <QPromise>
+#include <QSqlError>
+#include <QDebug>
+#include <memory>
+
+DatabaseWorker::DatabaseWorker(const QString &databasePath, QObject *parent)
+    : QObject(parent)
+    , m_databasePath(databasePath)
+    , m_connectionName(QStringLiteral("DigitalTripBook-worker-%1").arg(quintptr(this), 0, 16))
+{
+    m_thread.setObjectName(QStringLiteral("DatabaseWorker"));
+    m_context = new QObject;
+    m_context->moveToThread(&m_thread);
+    connect(&m_thread, &QThread::finished, m_context, &QObject::deleteLater);
+    m_thread.start();
+}
+
+DatabaseWorker::~DatabaseWorker()
+{
+    // The connection must be removed from the thread that created it
+    QMetaObject::invokeMethod(m_context, [this]() { closeConnection(); }, Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+}
+
+QFuture<QVariant> DatabaseWorker::submit(Job job)
+{
+    auto promise = std::make_shared<QPromise<QVariant>>();
+    QFuture<QVariant> future = promise->future();
+
+    QMetaObject::invokeMethod(m_context, [this, promise, job = std::move(job)]() {
+        promise->start();
+        if (promise->isCanceled()) {
+            promise->finish();
+            return;
+        }
+        QSqlDatabase db = connection();
+        if (db.isOpen())
+            promise->addResult(job(db));
+        else
+            promise->addResult(QVariant());
+        promise->finish();
+    }, Qt::QueuedConnection);
+
+    return future;
+}
+
+QSqlDatabase DatabaseWorker::connection()
+{
+    // Called on the worker thread only; the connection is created lazily on first use
+    if (QSqlDatabase::contains(m_connectionName))
+        return QSqlDatabase::database(m_connectionName);
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    db.setDatabaseName(m_databasePath);
+    if (!db.open())
+        qWarning() << "Error: worker connection with database failed:" << db.lastError();
+    return db;
+}
+
+void DatabaseWorker::closeConnection()
+{
+    if (!QSqlDatabase::contains(m_connectionName))
+        return;
+    StatementCache::release(m_connectionName);
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
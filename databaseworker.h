@@ -0,0 +1,35 @@
+#ifndef DATABASEWORKER_H
+#define DATABASEWORKER_H
+
+#include <QObject>
+#include <QThread>
+#include <QFuture>
+#include <QSqlDatabase>
+#include <QVariant>
+#include <functional>
+
+// Runs database jobs on a dedicated thread that owns its own QSqlDatabase
+// connection, so SQLite I/O never blocks the GUI thread. Jobs are executed
+// in submission order and their results are delivered through a QFuture.
+class DatabaseWorker : public QObject
+{
+    Q_OBJECT
+public:
+    using Job = std::function<QVariant(QSqlDatabase &db)>;
+
+    explicit DatabaseWorker(const QString &databasePath, QObject *parent = nullptr);
+    ~DatabaseWorker() override;
+
+    QFuture<QVariant> submit(Job job);
+
+private:
+    QSqlDatabase connection();
+    void closeConnection();
+
+    QString m_databasePath;
+    QString m_connectionName;
+    QThread m_thread;
+    QObject *m_context = nullptr; // lives on m_thread, used as invokeMethod target
+};
+
+#endif
@@ -0,0 +1,344 @@
+#include "energyanomalies.h"
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Below this many trips per thread the hand-off costs more than it saves
+constexpr qsizetype kMinTripsPerShard = 32768;
+// Spread floor relative to the baseline, so a driver whose last trips were
+// nearly identical does not turn a 1% difference into a huge z-score
+constexpr double kMinRelativeSpread = 0.05;
+// MAD to standard deviation for normally distributed values
+constexpr double kMadScale = 1.4826;
+
+// Runs fn(shard) for every shard, the first one on the calling thread
+template <typename Fn>
+void runShards(int shards, const Fn &fn)
+{
+    if (shards <= 1) {
+        fn(0);
+        return;
+    }
+    QSemaphore done;
+    for (int shard = 1; shard < shards; ++shard) {
+        QThreadPool::globalInstance()->start([&fn, &done, shard]() {
+            fn(shard);
+            done.release();
+        });
+    }
+    fn(0);
+    done.acquire(shards - 1);
+}
+
+// Trip indices grouped by key and chronological inside each group (a stable
+// counting sort), so the trips of group g are order[offsets[g], offsets[g + 1])
+struct Groups
+{
+    QList<qsizetype> offsets;
+    QList<qsizetype> order;
+};
+
+Groups groupBy(const QList<quint32> &keys, qsizetype groupCount)
+{
+    Groups groups;
+    groups.offsets.fill(0, groupCount + 1);
+    for (quint32 key : keys)
+        ++groups.offsets[key + 1];
+    std::partial_sum(groups.offsets.cbegin(), groups.offsets.cend(), groups.offsets.begin());
+
+    QList<qsizetype> next(groups.offsets.cbegin(), groups.offsets.cend() - 1);
+    groups.order.resize(keys.size());
+    qsizetype *order = groups.order.data();
+    for (qsizetype i = 0; i < keys.size(); ++i)
+        order[next[keys.at(i)]++] = i;
+    return groups;
+}
+
+// Scores x[k] against x[k - w, k) with w = min(k, window), from prefix sums
+// of x - shift. No branches, so the compiler can vectorize the loop.
+void rollingScore(const double *x, const double *sum, const double *sumSq, qsizetype count, double shift,
+                  int window, int minHistory, double *baseline, double *z)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    for (qsizetype k = 0; k < count; ++k) {
+        const qsizetype from = std::max<qsizetype>(k - window, 0);
+        const double history = double(k - from);
+        const double scale = 1.0 / std::max(history, 1.0);
+        const double mean = (sum[k] - sum[from]) * scale;
+        const double variance = std::max((sumSq[k] - sumSq[from]) * scale - mean * mean, 0.0);
+        const double base = mean + shift;
+        const double spread = std::max({ std::sqrt(variance), kMinRelativeSpread * std::abs(base), 1e-9 });
+        baseline[k] = base;
+        z[k] = history >= minHistory ? (x[k] - base) / spread : nan;
+    }
+}
+
+// Rolling baseline and z-score of every trip within its group, written in
+// trip order. Shards take whole groups, balanced by trip count.
+void scoreGroups(const double *efficiency, const Groups &groups, const EnergyAnomalies::Options &options,
+                 int shards, double *baseline, double *z)
+{
+    const qsizetype tripCount = groups.order.size();
+    auto groupAt = [&groups](qsizetype position) {
+        return qsizetype(std::lower_bound(groups.offsets.cbegin(), groups.offsets.cend(), position) - groups.offsets.cbegin());
+    };
+
+    runShards(shards, [&](int shard) {
+        const qsizetype firstGroup = groupAt(tripCount * shard / shards);
+        const qsizetype lastGroup = std::min(groupAt(tripCount * (shard + 1) / shards), groups.offsets.size() - 1);
+
+        QList<double> x, sum, sumSq, groupBaseline, groupZ;
+        for (qsizetype g = firstGroup; g < lastGroup; ++g) {
+            const qsizetype begin = groups.offsets.at(g);
+            const qsizetype count = groups.offsets.at(g + 1) - begin;
+            if (count == 0)
+                continue;
+            const qsizetype *order = groups.order.constData() + begin;
+
+            x.resize(count);
+            sum.resize(count + 1);
+            sumSq.resize(count + 1);
+            groupBaseline.resize(count);
+            groupZ.resize(count);
+
+            // Gather the group into one contiguous run
+            for (qsizetype k = 0; k < count; ++k)
+                x[k] = efficiency[order[k]];
+
+            // Centred on the group mean so the squared sums do not cancel
+            const double shift = std::accumulate(x.cbegin(), x.cend(), 0.0) / double(count);
+            sum[0] = 0.0;
+            sumSq[0] = 0.0;
+            for (qsizetype k = 0; k < count; ++k) {
+                const double d = x[k] - shift;
+                sum[k + 1] = sum[k] + d;
+                sumSq[k + 1] = sumSq[k] + d * d;
+            }
+
+            rollingScore(x.constData(), sum.constData(), sumSq.constData(), count, shift,
+                         options.window, options.minHistory, groupBaseline.data(), groupZ.data());
+
+            for (qsizetype k = 0; k < count; ++k) {
+                baseline[order[k]] = groupBaseline[k];
+                z[order[k]] = groupZ[k];
+            }
+        }
+    });
+}
+
+// Sorted copy: every shard sorts its slice, then neighbouring slices are merged
+QList<double> sortedCopy(const QList<double> &values, int shards)
+{
+    QList<double> sorted = values;
+    double *data = sorted.data();
+    const qsizetype count = sorted.size();
+    auto bound = [count, shards](int shard) { return count * std::min(shard, shards) / shards; };
+
+    runShards(shards, [&](int shard) {
+        std::sort(data + bound(shard), data + bound(shard + 1));
+    });
+    for (int width = 1; width < shards; width *= 2) {
+        runShards((shards + 2 * width - 1) / (2 * width), [&](int merge) {
+            const int first = merge * 2 * width;
+            std::inplace_merge(data + bound(first), data + bound(first + width), data + bound(first + 2 * width));
+        });
+    }
+    return sorted;
+}
+
+// Share of values at or below value, 0 to 100
+double percentileRank(const QList<double> &sorted, double value)
+{
+    if (sorted.isEmpty())
+        return 0.0;
+    const qsizetype atOrBelow = std::upper_bound(sorted.cbegin(), sorted.cend(), value) - sorted.cbegin();
+    return 100.0 * double(atOrBelow) / double(sorted.size());
+}
+
+double median(QList<double> values)
+{
+    if (values.isEmpty())
+        return 0.0;
+    const qsizetype middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    return values.at(middle);
+}
+
+} // namespace
+
+EnergyAnomalies::Options EnergyAnomalies::Options::fromVariantMap(const QVariantMap &map)
+{
+    Options options;
+    options.window = qMax(1, map.value("window", options.window).toInt());
+    options.minHistory = qBound(1, map.value("minHistory", options.minHistory).toInt(), options.window);
+    options.minTrips = qMax(1, map.value("minTrips", options.minTrips).toInt());
+    options.threshold = map.value("threshold", options.threshold).toDouble();
+    options.limit = qMax(0, map.value("limit", options.limit).toInt());
+    return options;
+}
+
+QVariantMap EnergyAnomalies::detect(const TripColumns &columns, const Options &options)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const qsizetype tripCount = columns.size();
+    const qsizetype driverCount = columns.drivers.size();
+    const int shards = int(qBound<qsizetype>(1, tripCount / kMinTripsPerShard, QThread::idealThreadCount()));
+    auto sliceBegin = [tripCount, shards](int shard) { return tripCount * shard / shards; };
+
+    // kWh per km, with the same short-trip rule as TripAnalytics::chartData
+    QList<double> efficiency(tripCount);
+    {
+        const double *energy = columns.energy.constData();
+        const double *distance = columns.distanceKm.constData();
+        double *out = efficiency.data();
+        runShards(shards, [&](int shard) {
+            for (qsizetype i = sliceBegin(shard); i < sliceBegin(shard + 1); ++i)
+                out[i] = energy[i] / (distance[i] > 0.0 ? distance[i] : 0.1);
+        });
+    }
+
+    QList<double> driverBaseline(tripCount), driverZ(tripCount);
+    QList<double> vehicleBaseline(tripCount), vehicleZ(tripCount);
+    scoreGroups(efficiency.constData(), groupBy(columns.driverIds, driverCount), options, shards,
+                driverBaseline.data(), driverZ.data());
+    scoreGroups(efficiency.constData(), groupBy(columns.vehicleIds, columns.vehicles.size()), options, shards,
+                vehicleBaseline.data(), vehicleZ.data());
+
+    // Flagged trips and per-driver sums, per shard and then combined
+    struct ShardTotals
+    {
+        QList<qsizetype> flagged;
+        QList<double> energy;
+        QList<double> distance;
+        QList<qint64> trips;
+        QList<qint64> violations;
+        QList<qint64> flaggedTrips;
+    };
+    QList<ShardTotals> totals(shards);
+    ShardTotals *shardTotals = totals.data();
+    runShards(shards, [&](int shard) {
+        ShardTotals &t = shardTotals[shard];
+        t.energy.fill(0.0, driverCount);
+        t.distance.fill(0.0, driverCount);
+        t.trips.fill(0, driverCount);
+        t.violations.fill(0, driverCount);
+        t.flaggedTrips.fill(0, driverCount);
+        for (qsizetype i = sliceBegin(shard); i < sliceBegin(shard + 1); ++i) {
+            const quint32 d = columns.driverIds.at(i);
+            const double distance = columns.distanceKm.at(i);
+            t.energy[d] += columns.energy.at(i);
+            t.distance[d] += distance > 0.0 ? distance : 0.1;
+            t.trips[d] += 1;
+            t.violations[d] += columns.violations.at(i);
+            // fmax skips the NaN of a baseline without enough history
+            if (std::fmax(driverZ.at(i), vehicleZ.at(i)) >= options.threshold) {
+                t.flagged.append(i);
+                t.flaggedTrips[d] += 1;
+            }
+        }
+    });
+
+    QList<qsizetype> flagged;
+    QList<double> driverEnergy(driverCount, 0.0), driverDistance(driverCount, 0.0);
+    QList<qint64> driverTrips(driverCount, 0), driverViolations(driverCount, 0), driverFlaggedTrips(driverCount, 0);
+    for (const ShardTotals &t : totals) {
+        flagged.append(t.flagged);
+        for (qsizetype d = 0; d < driverCount; ++d) {
+            driverEnergy[d] += t.energy.at(d);
+            driverDistance[d] += t.distance.at(d);
+            driverTrips[d] += t.trips.at(d);
+            driverViolations[d] += t.violations.at(d);
+            driverFlaggedTrips[d] += t.flaggedTrips.at(d);
+        }
+    }
+
+    // Strongest first; only the returned ones need to be in order
+    auto strength = [&](qsizetype i) { return std::fmax(driverZ.at(i), vehicleZ.at(i)); };
+    const qsizetype tripsShown = std::min<qsizetype>(flagged.size(), options.limit);
+    std::partial_sort(flagged.begin(), flagged.begin() + tripsShown, flagged.end(),
+                      [&](qsizetype a, qsizetype b) { return strength(a) > strength(b); });
+
+    const QList<double> sortedEfficiency = sortedCopy(efficiency, shards);
+    auto finite = [](double value) { return std::isfinite(value) ? QVariant(value) : QVariant(); };
+    QVariantList trips;
+    trips.reserve(tripsShown);
+    for (qsizetype n = 0; n < tripsShown; ++n) {
+        const qsizetype i = flagged.at(n);
+        QVariantMap trip;
+        trip["id"] = columns.ids.at(i);
+        trip["driver"] = columns.drivers.at(columns.driverIds.at(i));
+        trip["vehicle"] = columns.vehicles.at(columns.vehicleIds.at(i));
+        trip["efficiency"] = efficiency.at(i);
+        trip["driverBaseline"] = driverBaseline.at(i);
+        trip["driverZ"] = finite(driverZ.at(i));
+        trip["vehicleBaseline"] = vehicleBaseline.at(i);
+        trip["vehicleZ"] = finite(vehicleZ.at(i));
+        trip["percentile"] = percentileRank(sortedEfficiency, efficiency.at(i));
+        trip["averageSpeed"] = columns.averageSpeed.at(i);
+        trip["violations"] = columns.violations.at(i);
+        trips.append(trip);
+    }
+
+    // Drivers with enough trips against each other
+    QList<double> driverEfficiency(driverCount, 0.0);
+    QList<double> comparable;
+    for (qsizetype d = 0; d < driverCount; ++d) {
+        driverEfficiency[d] = driverEnergy.at(d) / driverDistance.at(d);
+        if (driverTrips.at(d) >= options.minTrips)
+            comparable.append(driverEfficiency.at(d));
+    }
+    const double fleetMedian = median(comparable);
+    QList<double> deviations;
+    deviations.reserve(comparable.size());
+    for (double value : comparable)
+        deviations.append(std::abs(value - fleetMedian));
+    const double spread = std::max({ kMadScale * median(deviations), kMinRelativeSpread * std::abs(fleetMedian), 1e-9 });
+    std::sort(comparable.begin(), comparable.end());
+
+    QList<QPair<double, qsizetype>> flaggedDrivers;
+    for (qsizetype d = 0; d < driverCount; ++d) {
+        if (driverTrips.at(d) < options.minTrips)
+            continue;
+        const double z = (driverEfficiency.at(d) - fleetMedian) / spread;
+        if (z >= options.threshold)
+            flaggedDrivers.append({ z, d });
+    }
+    std::sort(flaggedDrivers.begin(), flaggedDrivers.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    QVariantList drivers;
+    QStringList flaggedDriverNames;
+    for (const auto &[z, d] : std::as_const(flaggedDrivers)) {
+        flaggedDriverNames.append(columns.drivers.at(d));
+        if (drivers.size() >= options.limit)
+            continue;
+        QVariantMap driver;
+        driver["driver"] = columns.drivers.at(d);
+        driver["trips"] = driverTrips.at(d);
+        driver["efficiency"] = driverEfficiency.at(d);
+        driver["z"] = z;
+        driver["percentile"] = percentileRank(comparable, driverEfficiency.at(d));
+        driver["flaggedTrips"] = driverFlaggedTrips.at(d);
+        driver["violationsPer100Km"] = 100.0 * double(driverViolations.at(d)) / driverDistance.at(d);
+        drivers.append(driver);
+    }
+
+    QVariantMap result;
+    result["trips"] = trips;
+    result["drivers"] = drivers;
+    result["flaggedDrivers"] = flaggedDriverNames;
+    result["flaggedTripCount"] = qint64(flagged.size());
+    result["tripCount"] = qint64(tripCount);
+    result["driverCount"] = qint64(driverCount);
+    result["threads"] = shards;
+    result["elapsedMs"] = timer.nsecsElapsed() / 1e6;
+    return result;
+}
@@ -0,0 +1,46 @@
+#ifndef ENERGYANOMALIES_H
+#define ENERGYANOMALIES_H
+
+#include <QVariant>
+#include "tripanalytics.h"
+
+// Finds trips and drivers with unusual energy use (kWh per km) in the
+// TripColumns of the whole fleet history.
+//
+// Every trip is scored against two rolling baselines: the driver's and the
+// vehicle's previous `window` trips. Its z-score is the distance to the
+// baseline mean in standard deviations. Trips are regrouped so each
+// driver's and vehicle's trips sit next to each other, and the baselines
+// come from prefix sums over those runs. Groups are independent, so they
+// are split across cores. Only trips above the baseline are flagged.
+//
+// Drivers are compared with each other by their overall efficiency, using
+// a robust z-score (median and MAD) so a few extreme drivers do not hide
+// themselves by widening the spread.
+namespace EnergyAnomalies
+{
+    struct Options
+    {
+        int window = 50;         // previous trips in a rolling baseline
+        int minHistory = 10;     // trips before a baseline is trusted
+        int minTrips = 5;        // trips before a driver is compared
+        double threshold = 3.0;  // z-score that flags
+        int limit = 100;         // flagged trips and drivers returned
+
+        // Keys: window, minHistory, minTrips, threshold, limit
+        static Options fromVariantMap(const QVariantMap &map);
+    };
+
+    // Result keys:
+    //   trips [{ id, driver, vehicle, efficiency, driverBaseline, driverZ,
+    //            vehicleBaseline, vehicleZ, percentile, averageSpeed, violations }],
+    //     strongest first
+    //   drivers [{ driver, trips, efficiency, z, percentile, flaggedTrips,
+    //              violationsPer100Km }], flagged drivers, strongest first
+    //   flaggedDrivers (names of every flagged driver), flaggedTripCount,
+    //   tripCount, driverCount, threads and elapsedMs
+    // Percentiles are fleet-wide ranks of the efficiency, 0 to 100.
+    QVariantMap detect(const TripColumns &columns, const Options &options = {});
+}
+
+#endif
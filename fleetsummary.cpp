@@ -0,0 +1,286 @@
+#include "fleetsummary.h"
+#include "querymetrics.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QStringList>
+#include <QDebug>
+
+namespace {
+
+// Statements adding the NEW row to the rollups
+QString addRowStatements()
+{
+    return QStringLiteral(
+        "UPDATE fleet_summary SET "
+        "trip_count = trip_count + 1, "
+        "total_distance = total_distance + IFNULL(NEW.distance_m, 0), "
+        "total_duration = total_duration + IFNULL(NEW.duration, 0), "
+        "total_energy = total_energy + IFNULL(NEW.energy_used, 0), "
+        "favorite_count = favorite_count + IFNULL(NEW.favorite = 1, 0) "
+        "WHERE id = 1; "
+        "INSERT INTO vehicle_summary (vehicle, trip_count) VALUES (IFNULL(NEW.vehicle, ''), 1) "
+        "ON CONFLICT(vehicle) DO UPDATE SET trip_count = trip_count + 1; "
+        "INSERT INTO driver_summary (driver, trip_count, total_distance, total_energy, total_violations) "
+        "VALUES (IFNULL(NEW.driver, ''), 1, IFNULL(NEW.distance_m, 0), IFNULL(NEW.energy_used, 0), IFNULL(NEW.traffic_violations, 0)) "
+        "ON CONFLICT(driver) DO UPDATE SET "
+        "trip_count = trip_count + 1, "
+        "total_distance = total_distance + excluded.total_distance, "
+        "total_energy = total_energy + excluded.total_energy, "
+        "total_violations = total_violations + excluded.total_violations; ");
+}
+
+// Statements removing the OLD row from the rollups
+QString removeRowStatements()
+{
+    return QStringLiteral(
+        "UPDATE fleet_summary SET "
+        "trip_count = trip_count - 1, "
+        "total_distance = total_distance - IFNULL(OLD.distance_m, 0), "
+        "total_duration = total_duration - IFNULL(OLD.duration, 0), "
+        "total_energy = total_energy - IFNULL(OLD.energy_used, 0), "
+        "favorite_count = favorite_count - IFNULL(OLD.favorite = 1, 0) "
+        "WHERE id = 1; "
+        "UPDATE vehicle_summary SET trip_count = trip_count - 1 WHERE vehicle = IFNULL(OLD.vehicle, ''); "
+        "DELETE FROM vehicle_summary WHERE vehicle = IFNULL(OLD.vehicle, '') AND trip_count <= 0; "
+        "UPDATE driver_summary SET "
+        "trip_count = trip_count - 1, "
+        "total_distance = total_distance - IFNULL(OLD.distance_m, 0), "
+        "total_energy = total_energy - IFNULL(OLD.energy_used, 0), "
+        "total_violations = total_violations - IFNULL(OLD.traffic_violations, 0) "
+        "WHERE driver = IFNULL(OLD.driver, ''); "
+        "DELETE FROM driver_summary WHERE driver = IFNULL(OLD.driver, '') AND trip_count <= 0; ");
+}
+
+bool execAll(QSqlDatabase &db, const QStringList &statements)
+{
+    TracedQuery query(db, "FleetSummary::execAll");
+    for (const QString &statement : statements) {
+        if (!query.exec(statement)) {
+            qWarning() << "ERROR: Fleet summary statement failed:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+// One grouped pass over `trips`; every rollup is derived from this table
+bool scanTrips(QSqlDatabase &db)
+{
+    return execAll(db, {
+        "DROP TABLE IF EXISTS temp.summary_scan",
+        "CREATE TEMP TABLE summary_scan AS SELECT "
+        "IFNULL(driver, '') AS driver, IFNULL(vehicle, '') AS vehicle, COUNT(*) AS trip_count, "
+        "TOTAL(distance_m) AS total_distance, TOTAL(duration) AS total_duration, "
+        "TOTAL(energy_used) AS total_energy, TOTAL(favorite = 1) AS favorite_count, "
+        "TOTAL(traffic_violations) AS total_violations "
+        "FROM trips GROUP BY 1, 2"
+    });
+}
+
+// Queries returning rows that differ between the rollups and the scan. Each
+// table is compared in both directions, so missing and extra rows count too.
+const QStringList &mismatchQueries()
+{
+    static const QStringList queries = {
+        "SELECT COUNT(*) FROM ("
+        "SELECT trip_count, ROUND(total_distance, 3), total_duration, ROUND(total_energy, 3), favorite_count FROM fleet_summary "
+        "EXCEPT SELECT TOTAL(trip_count), ROUND(TOTAL(total_distance), 3), TOTAL(total_duration), "
+        "ROUND(TOTAL(total_energy), 3), TOTAL(favorite_count) FROM temp.summary_scan)",
+        "SELECT COUNT(*) FROM ("
+        "SELECT TOTAL(trip_count), ROUND(TOTAL(total_distance), 3), TOTAL(total_duration), "
+        "ROUND(TOTAL(total_energy), 3), TOTAL(favorite_count) FROM temp.summary_scan "
+        "EXCEPT SELECT trip_count, ROUND(total_distance, 3), total_duration, ROUND(total_energy, 3), favorite_count FROM fleet_summary)",
+        "SELECT COUNT(*) FROM ("
+        "SELECT vehicle, trip_count FROM vehicle_summary "
+        "EXCEPT SELECT vehicle, SUM(trip_count) FROM temp.summary_scan GROUP BY vehicle)",
+        "SELECT COUNT(*) FROM ("
+        "SELECT vehicle, SUM(trip_count) FROM temp.summary_scan GROUP BY vehicle "
+        "EXCEPT SELECT vehicle, trip_count FROM vehicle_summary)",
+        "SELECT COUNT(*) FROM ("
+        "SELECT driver, trip_count, ROUND(total_distance, 3), ROUND(total_energy, 3), total_violations FROM driver_summary "
+        "EXCEPT SELECT driver, SUM(trip_count), ROUND(TOTAL(total_distance), 3), ROUND(TOTAL(total_energy), 3), "
+        "TOTAL(total_violations) FROM temp.summary_scan GROUP BY driver)",
+        "SELECT COUNT(*) FROM ("
+        "SELECT driver, SUM(trip_count), ROUND(TOTAL(total_distance), 3), ROUND(TOTAL(total_energy), 3), "
+        "TOTAL(total_violations) FROM temp.summary_scan GROUP BY driver "
+        "EXCEPT SELECT driver, trip_count, ROUND(total_distance, 3), ROUND(total_energy, 3), total_violations FROM driver_summary)"
+    };
+    return queries;
+}
+
+bool fillFromScan(QSqlDatabase &db)
+{
+    return execAll(db, {
+        "DELETE FROM fleet_summary",
+        "DELETE FROM vehicle_summary",
+        "DELETE FROM driver_summary",
+        "INSERT INTO fleet_summary (id, trip_count, total_distance, total_duration, total_energy, favorite_count) "
+        "SELECT 1, TOTAL(trip_count), TOTAL(total_distance), TOTAL(total_duration), TOTAL(total_energy), "
+        "TOTAL(favorite_count) FROM temp.summary_scan",
+        "INSERT INTO vehicle_summary (vehicle, trip_count) "
+        "SELECT vehicle, SUM(trip_count) FROM temp.summary_scan GROUP BY vehicle",
+        "INSERT INTO driver_summary (driver, trip_count, total_distance, total_energy, total_violations) "
+        "SELECT driver, SUM(trip_count), TOTAL(total_distance), TOTAL(total_energy), TOTAL(total_violations) "
+        "FROM temp.summary_scan GROUP BY driver"
+    });
+}
+
+} // namespace
+
+bool FleetSummary::install(QSqlDatabase &db)
+{
+    TracedQuery query(db, "FleetSummary::install");
+    bool hasRow = false;
+    if (query.exec("SELECT 1 FROM fleet_summary WHERE id = 1") && query.next())
+        hasRow = true;
+    query.finish();
+
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start fleet summary transaction:" << db.lastError().text();
+        return false;
+    }
+
+    const bool ok = execAll(db, {
+        "CREATE TABLE IF NOT EXISTS fleet_summary ("
+        "id INTEGER PRIMARY KEY CHECK (id = 1), "
+        "trip_count INTEGER NOT NULL DEFAULT 0, "
+        "total_distance REAL NOT NULL DEFAULT 0, "
+        "total_duration INTEGER NOT NULL DEFAULT 0, "
+        "total_energy REAL NOT NULL DEFAULT 0, "
+        "favorite_count INTEGER NOT NULL DEFAULT 0)",
+        "CREATE TABLE IF NOT EXISTS vehicle_summary ("
+        "vehicle TEXT PRIMARY KEY, "
+        "trip_count INTEGER NOT NULL DEFAULT 0)",
+        "CREATE TABLE IF NOT EXISTS driver_summary ("
+        "driver TEXT PRIMARY KEY, "
+        "trip_count INTEGER NOT NULL DEFAULT 0, "
+        "total_distance REAL NOT NULL DEFAULT 0, "
+        "total_energy REAL NOT NULL DEFAULT 0, "
+        "total_violations INTEGER NOT NULL DEFAULT 0)"
+    }) && installTriggers(db) && (hasRow || (scanTrips(db) && fillFromScan(db)));
+
+    if (!ok || !db.commit()) {
+        qWarning() << "ERROR: Failed to install fleet summary:" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    if (!hasRow)
+        qInfo() << "Fleet summary tables created and filled.";
+    return true;
+}
+
+bool FleetSummary::installTriggers(QSqlDatabase &db)
+{
+    return execAll(db, {
+        "DROP TRIGGER IF EXISTS trips_summary_insert",
+        "DROP TRIGGER IF EXISTS trips_summary_delete",
+        "DROP TRIGGER IF EXISTS trips_summary_update",
+        "CREATE TRIGGER trips_summary_insert AFTER INSERT ON trips BEGIN "
+            + addRowStatements() + "END",
+        "CREATE TRIGGER trips_summary_delete AFTER DELETE ON trips BEGIN "
+            + removeRowStatements() + "END",
+        "CREATE TRIGGER trips_summary_update "
+        "AFTER UPDATE OF driver, vehicle, distance_m, duration, energy_used, favorite, traffic_violations ON trips BEGIN "
+            + removeRowStatements() + addRowStatements() + "END"
+    });
+}
+
+QVariantMap FleetSummary::read(QSqlDatabase &db)
+{
+    QVariantMap stats;
+    TracedQuery query(db, "FleetSummary::read");
+
+    if (query.exec("SELECT trip_count, total_distance, total_duration, total_energy, favorite_count FROM fleet_summary WHERE id = 1")) {
+        if (query.next()) {
+            stats["totalTrips"] = query.value(0).toInt();
+            stats["totalDistance"] = query.value(1).toDouble() / 1000.0; // Convert to km
+            stats["totalDuration"] = query.value(2).toInt(); // in minutes
+            stats["totalEnergyUsed"] = query.value(3).toDouble();
+            stats["favoriteTrips"] = query.value(4).toInt();
+        }
+    } else {
+        qWarning() << "Failed to read fleet summary:" << query.lastError().text();
+    }
+
+    QVariantMap tripsPerVehicle;
+    if (query.exec("SELECT vehicle, trip_count FROM vehicle_summary")) {
+        while (query.next()) {
+            tripsPerVehicle[query.value(0).toString()] = query.value(1).toInt();
+        }
+        stats["tripsPerVehicle"] = tripsPerVehicle;
+    } else {
+        qWarning() << "Failed to read vehicle summary:" << query.lastError().text();
+    }
+
+    return stats;
+}
+
+QVariantMap FleetSummary::readDriverViolations(QSqlDatabase &db)
+{
+    QVariantMap violationsStats;
+    TracedQuery query(db, "FleetSummary::readDriverViolations");
+
+    if (query.exec("SELECT driver, total_violations FROM driver_summary")) {
+        while (query.next()) {
+            violationsStats[query.value(0).toString()] = query.value(1).toInt();
+        }
+    } else {
+        qWarning() << "Failed to read driver summary:" << query.lastError().text();
+    }
+
+    return violationsStats;
+}
+
+bool FleetSummary::rebuild(QSqlDatabase &db)
+{
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start fleet summary rebuild:" << db.lastError().text();
+        return false;
+    }
+
+    if (!scanTrips(db) || !fillFromScan(db) || !db.commit()) {
+        qWarning() << "ERROR: Failed to rebuild fleet summary:" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    qInfo() << "Fleet summary rebuilt from trips table.";
+    return true;
+}
+
+bool FleetSummary::verify(QSqlDatabase &db, bool repair)
+{
+    // Scan and compare inside one read transaction so they see the same data
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start fleet summary check:" << db.lastError().text();
+        return false;
+    }
+    if (!scanTrips(db)) {
+        db.rollback();
+        return false;
+    }
+
+    int mismatches = 0;
+    TracedQuery query(db, "FleetSummary::verify");
+    for (const QString &sql : mismatchQueries()) {
+        if (!query.exec(sql) || !query.next()) {
+            qWarning() << "ERROR: Fleet summary check failed:" << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+        mismatches += query.value(0).toInt();
+    }
+    query.finish();
+
+    if (mismatches == 0) {
+        db.commit();
+        return true;
+    }
+
+    qWarning() << "Fleet summary is out of date," << mismatches << "rows differ from the trips table.";
+    db.commit();
+    // The rebuild scans again in its own transaction, so it also covers
+    // writes that landed after the check
+    return repair && rebuild(db);
+}
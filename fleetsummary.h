@@ -0,0 +1,30 @@
+#ifndef FLEETSUMMARY_H
+#define FLEETSUMMARY_H
+
+#include <QSqlDatabase>
+#include <QVariant>
+
+// Rollup tables holding the fleet-wide aggregates shown on the statistics
+// page. Triggers on `trips` keep them current on every insert, update and
+// delete, so reading them costs the same no matter how many trips exist.
+namespace FleetSummary
+{
+    // Creates the rollup tables and triggers if missing and fills them once
+    bool install(QSqlDatabase &db);
+    // (Re)creates the triggers that keep the rollups current
+    bool installTriggers(QSqlDatabase &db);
+
+    // Same keys as the old full-scan getStatistics()
+    QVariantMap read(QSqlDatabase &db);
+    QVariantMap readDriverViolations(QSqlDatabase &db);
+
+    // Recomputes every rollup from a single scan over `trips`; verify()
+    // calls it to repair
+    bool rebuild(QSqlDatabase &db);
+
+    // Compares the rollups with a fresh scan. Returns true when they match,
+    // or when they did not and `repair` rebuilt them successfully.
+    bool verify(QSqlDatabase &db, bool repair = true);
+}
+
+#endif
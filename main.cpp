@@ -3,10 +3,93 @@
 #include <QQuickStyle>
 #include <QIcon>
 #include <QQmlContext>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QQuickWindow>
 #include "databasehandler.h"
+#include "triplistmodel.h"
+#include "querymetrics.h"
+#include "mediaimageprovider.h"
+
+// RAM the thumbnail grid may hold; older thumbnails are re-read from the disk cache
+static constexpr qint64 kThumbnailCacheBytes = 64 * 1024 * 1024;
+
+// Command line operations run without a window, e.g.
+//   appDigitalTripBook --import runs.csv --batch-size 10000 --metrics-out metrics.json
+//   appDigitalTripBook --export nightly.dtbc --dataset trips
+static bool isHeadlessInvocation(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--import") == 0 || qstrcmp(argv[i], "--export") == 0)
+            return true;
+    }
+    return false;
+}
+
+static int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Digital Trip Book command line mode");
+    parser.addHelpOption();
+    QCommandLineOption importOption("import", "Import trips from a CSV or JSON Lines file.", "file");
+    QCommandLineOption batchSizeOption("batch-size", "Rows committed per transaction.", "rows", "5000");
+    QCommandLineOption exportOption("export", "Export to a CSV file, or columnar when it ends in .dtbc. Runs after --import.", "file");
+    QCommandLineOption datasetOption("dataset", "What to export: trips or daily.", "name", "trips");
+    QCommandLineOption rowGroupOption("row-group-size", "Rows per columnar row group.", "rows", "65536");
+    QCommandLineOption metricsOption("metrics-out", "Write query metrics as JSON when done.", "file");
+    QCommandLineOption slowQueryOption("slow-query-ms", "Log queries slower than this with their plan.", "ms", "50");
+    parser.addOption(importOption);
+    parser.addOption(batchSizeOption);
+    parser.addOption(exportOption);
+    parser.addOption(datasetOption);
+    parser.addOption(rowGroupOption);
+    parser.addOption(metricsOption);
+    parser.addOption(slowQueryOption);
+    parser.process(app);
+
+    QueryMetrics::instance()->setSlowThresholdMs(parser.value(slowQueryOption).toInt());
+
+    DatabaseHandler dbHandler;
+    if (!dbHandler.initDb())
+        return 1;
+
+    bool ok = true;
+    if (parser.isSet(importOption)) {
+        QObject::connect(&dbHandler, &DatabaseHandler::importProgress,
+                         [](qint64 rowsImported, qint64 bytesRead, qint64 bytesTotal, double rowsPerSecond) {
+            const int percent = bytesTotal > 0 ? int(bytesRead * 100 / bytesTotal) : 100;
+            qInfo().noquote() << QString("%1 rows, %2% done, %3 rows/s").arg(rowsImported).arg(percent).arg(qRound(rowsPerSecond));
+        });
+        const QVariantMap result = dbHandler.importTrips(parser.value(importOption), parser.value(batchSizeOption).toInt());
+        ok = result.value("ok").toBool();
+    }
+
+    if (ok && parser.isSet(exportOption)) {
+        QObject::connect(&dbHandler, &DatabaseHandler::exportProgress,
+                         [](qint64 rowsExported, qint64 rowsTotal, double rowsPerSecond) {
+            const int percent = rowsTotal > 0 ? int(rowsExported * 100 / rowsTotal) : 100;
+            qInfo().noquote() << QString("%1 rows, %2% done, %3 rows/s").arg(rowsExported).arg(percent).arg(qRound(rowsPerSecond));
+        });
+        const QVariantMap result = dbHandler.exportTrips(parser.value(exportOption), parser.value(datasetOption),
+                                                         parser.value(rowGroupOption).toInt());
+        ok = result.value("ok").toBool();
+    }
+
+    if (parser.isSet(metricsOption))
+        QueryMetrics::instance()->dumpToFile(parser.value(metricsOption));
+    return ok ? 0 : 1;
+}
 
 int main(int argc, char *argv[])
 {
+    if (isHeadlessInvocation(argc, argv))
+        return runHeadless(argc, argv);
+
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+
     QApplication app(argc, argv);
 
     // Set the Qt Quick Controls style to Material (supports customization)
@@ -17,12 +100,32 @@ int main(int argc, char *argv[])
 
     QQmlApplicationEngine engine;
 
-    // Create and initialize the database handler
+    // Query tracing lives on the GUI thread so QML bindings on it stay valid
+    QueryMetrics *queryMetrics = QueryMetrics::instance();
+
+    // The database opens and migrates on the worker thread while the window
+    // comes up; until then the pages show the startup snapshot
     DatabaseHandler dbHandler;
-    dbHandler.initDb();
+    dbHandler.setEngine(&engine);
+    dbHandler.initDbAsync();
+
+    // Paged trip list for JourneysPage, fed by the database worker thread
+    TripListModel tripListModel;
+    if (dbHandler.snapshot().valid)
+        tripListModel.showSnapshot(dbHandler.snapshot().firstPage);
+    tripListModel.setWorker(dbHandler.worker());
+    // Patch the rows held instead of reloading after every write
+    QObject::connect(&dbHandler, &DatabaseHandler::tripsInserted, &tripListModel, &TripListModel::insertTrips);
+    QObject::connect(&dbHandler, &DatabaseHandler::tripsUpdated, &tripListModel, &TripListModel::applyUpdates);
+
+    // image://thumbnails/<hash> and image://media/<hash>; the engine owns the providers
+    engine.addImageProvider("thumbnails", new MediaImageProvider(dbHandler.mediaPath(), MediaImageProvider::Thumbnails, kThumbnailCacheBytes));
+    engine.addImageProvider("media", new MediaImageProvider(dbHandler.mediaPath(), MediaImageProvider::FullResolution));
 
     // Expose the database handler to QML
     engine.rootContext()->setContextProperty("databaseHandler", &dbHandler);
+    engine.rootContext()->setContextProperty("tripListModel", &tripListModel);
+    engine.rootContext()->setContextProperty("queryMetrics", queryMetrics);
 
     QObject::connect(
         &engine,
@@ -32,5 +135,15 @@ int main(int argc, char *argv[])
         Qt::QueuedConnection);
     engine.loadFromModule("DigitalTripBook", "Main"); // This should match your QML module/folder setup
 
-    return app.exec();
+    if (auto *window = qobject_cast<QQuickWindow *>(engine.rootObjects().value(0))) {
+        QObject::connect(window, &QQuickWindow::frameSwapped, window, [&startupTimer]() {
+            qInfo() << "First frame after" << startupTimer.elapsed() << "ms";
+        }, Qt::SingleShotConnection);
+    }
+
+    const int result = app.exec();
+
+    // Written while the worker is still up, read by the next launch
+    dbHandler.writeSnapshot(tripListModel.pageSize());
+    return result;
 }
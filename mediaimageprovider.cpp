@@ -0,0 +1,101 @@
+#include "mediaimageprovider.h"
+#include "mediastore.h"
+#include <QQuickTextureFactory>
+#include <QRunnable>
+#include <QThread>
+#include <atomic>
+#include <limits>
+
+namespace {
+
+// One request; runs on the provider's pool and reports back with finished()
+class MediaImageResponse : public QQuickImageResponse, public QRunnable
+{
+public:
+    MediaImageResponse(MediaImageProvider *provider, const QString &hash, const QSize &requestedSize)
+        : m_provider(provider)
+        , m_hash(hash)
+        , m_requestedSize(requestedSize)
+    {
+        // The engine deletes the response, not the pool
+        setAutoDelete(false);
+    }
+
+    void run() override
+    {
+        // A delegate scrolled out of view before its turn came
+        if (!m_cancelled.load()) {
+            if (!MediaStore::isValidHash(m_hash))
+                m_error = QStringLiteral("Invalid media id: %1").arg(m_hash);
+            else
+                m_image = m_provider->load(m_hash, m_requestedSize);
+            if (m_error.isEmpty() && m_image.isNull())
+                m_error = QStringLiteral("Could not decode media %1").arg(m_hash);
+        }
+        emit finished();
+    }
+
+    QQuickTextureFactory *textureFactory() const override
+    {
+        return QQuickTextureFactory::textureFactoryForImage(m_image);
+    }
+
+    QString errorString() const override { return m_error; }
+
+    void cancel() override { m_cancelled.store(true); }
+
+private:
+    MediaImageProvider *m_provider;
+    QString m_hash;
+    QSize m_requestedSize;
+    QImage m_image;
+    QString m_error;
+    std::atomic<bool> m_cancelled { false };
+};
+
+} // namespace
+
+MediaImageProvider::MediaImageProvider(const QString &mediaRoot, Mode mode, qint64 cacheBytes)
+    : m_mediaRoot(mediaRoot)
+    , m_mode(mode)
+{
+    m_pool.setObjectName(mode == Thumbnails ? QStringLiteral("ThumbnailDecoder") : QStringLiteral("MediaDecoder"));
+    // Leave a core for the GUI and render threads
+    m_pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+    m_cache.setMaxCost(int(qBound<qint64>(0, cacheBytes / 1024, std::numeric_limits<int>::max())));
+}
+
+MediaImageProvider::~MediaImageProvider()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QQuickImageResponse *MediaImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    auto *response = new MediaImageResponse(this, id, requestedSize);
+    m_pool.start(response);
+    return response;
+}
+
+QImage MediaImageProvider::load(const QString &hash, const QSize &requestedSize)
+{
+    if (m_mode == FullResolution)
+        return MediaStore::readMapped(m_mediaRoot, hash, requestedSize);
+
+    const int edge = MediaStore::thumbnailEdge(requestedSize);
+    const QString key = hash + u'/' + QString::number(edge);
+    {
+        QMutexLocker locker(&m_cacheMutex);
+        if (const QImage *cached = m_cache.object(key))
+            return *cached;
+    }
+
+    QImage image = MediaStore::thumbnail(m_mediaRoot, hash, edge);
+    if (!image.isNull()) {
+        QMutexLocker locker(&m_cacheMutex);
+        // Least recently used thumbnails are evicted once the budget is reached
+        m_cache.insert(key, new QImage(image), qMax<qsizetype>(1, image.sizeInBytes() / 1024));
+    }
+    return image;
+}
@@ -0,0 +1,41 @@
+#ifndef MEDIAIMAGEPROVIDER_H
+#define MEDIAIMAGEPROVIDER_H
+
+#include <QQuickAsyncImageProvider>
+#include <QThreadPool>
+#include <QCache>
+#include <QMutex>
+#include <QImage>
+#include <memory>
+
+// Serves trip photos to QML as image://<provider>/<hash>. Decoding runs on
+// the provider's own thread pool, never on the GUI or render thread.
+//
+// Thumbnails go through an LRU cache with a fixed byte budget; the QML
+// Image should set `cache: false` so the pixmap cache does not hold a
+// second copy. Full-resolution images are decoded from a memory mapping of
+// the blob at the size the view asks for and are not cached here.
+class MediaImageProvider : public QQuickAsyncImageProvider
+{
+public:
+    enum Mode { Thumbnails, FullResolution };
+
+    MediaImageProvider(const QString &mediaRoot, Mode mode, qint64 cacheBytes = 0);
+    ~MediaImageProvider() override;
+
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+    // Decodes or returns the cached image; called on pool threads
+    QImage load(const QString &hash, const QSize &requestedSize);
+
+private:
+    QString m_mediaRoot;
+    Mode m_mode;
+    QThreadPool m_pool;
+
+    // QCache is not thread-safe; costs are in KiB so large budgets fit in int
+    QMutex m_cacheMutex;
+    QCache<QString, QImage> m_cache;
+};
+
+#endif
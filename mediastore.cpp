@@ -0,0 +1,341 @@
+#include "mediastore.h"
+#include "querymetrics.h"
+#include "trip.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QSqlError>
+#include <QTemporaryFile>
+#include <QUrl>
+#include <QDebug>
+#include <iterator>
+
+namespace {
+
+constexpr qint64 kCopyChunk = 1 << 20;
+
+// blobs/ab/abcdef... keeps directories small with hundreds of thousands of files
+QString shardedPath(const QString &dir, const QString &hash, const QString &suffix = QString())
+{
+    return QStringLiteral("%1/%2/%3%4").arg(dir, hash.left(2), hash, suffix);
+}
+
+QString localPath(const QString &file)
+{
+    const QUrl url(file);
+    return url.isLocalFile() ? url.toLocalFile() : file;
+}
+
+QImage decode(QImageReader &reader, const QSize &bound)
+{
+    // Camera frames carry EXIF orientation
+    reader.setAutoTransform(true);
+    const QSize full = reader.size();
+    if (bound.isValid() && full.isValid() && (full.width() > bound.width() || full.height() > bound.height())) {
+        // Lets the decoder skip work, e.g. JPEG decodes straight at 1/2, 1/4 or 1/8
+        reader.setScaledSize(full.scaled(bound, Qt::KeepAspectRatio));
+    }
+    return reader.read();
+}
+
+} // namespace
+
+bool MediaStore::install(QSqlDatabase &db)
+{
+    const QStringList statements = {
+        "CREATE TABLE IF NOT EXISTS media ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "trip_id INTEGER NOT NULL, "
+        "hash TEXT NOT NULL, "
+        "format TEXT, "
+        "width INTEGER, "
+        "height INTEGER, "
+        "bytes INTEGER, "
+        "added_ts INTEGER NOT NULL, "
+        "UNIQUE (trip_id, hash))",
+        "CREATE INDEX IF NOT EXISTS idx_media_trip ON media (trip_id, id)",
+        // Blobs stay on disk, only the references go with the trip
+        "CREATE TRIGGER IF NOT EXISTS media_trip_delete AFTER DELETE ON trips BEGIN "
+        "DELETE FROM media WHERE trip_id = OLD.id; "
+        "END"
+    };
+
+    TracedQuery query(db, "MediaStore::install");
+    for (const QString &statement : statements) {
+        if (!query.exec(statement)) {
+            qWarning() << "ERROR: Failed to set up media table:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MediaStore::isValidHash(const QString &hash)
+{
+    if (hash.size() != 64)
+        return false;
+    for (const QChar c : hash) {
+        if (!((c >= u'0' && c <= u'9') || (c >= u'a' && c <= u'f')))
+            return false;
+    }
+    return true;
+}
+
+QString MediaStore::blobPath(const QString &root, const QString &hash)
+{
+    return shardedPath(root + "/blobs", hash);
+}
+
+QString MediaStore::thumbnailPath(const QString &root, const QString &hash, int edge)
+{
+    return shardedPath(QStringLiteral("%1/thumbnails/%2").arg(root).arg(edge), hash, ".jpg");
+}
+
+int MediaStore::thumbnailEdge(const QSize &requestedSize)
+{
+    const int wanted = requestedSize.isValid() ? qMax(requestedSize.width(), requestedSize.height()) : 0;
+    for (const int edge : kThumbnailEdges) {
+        if (wanted <= edge)
+            return edge;
+    }
+    return kThumbnailEdges[std::size(kThumbnailEdges) - 1];
+}
+
+bool MediaStore::ingest(const QString &root, const QString &sourcePath, MediaBlob *blob, QString *error)
+{
+    auto fail = [error](const QString &message) {
+        if (error)
+            *error = message;
+        return false;
+    };
+
+    QFile source(sourcePath);
+    if (!source.open(QIODevice::ReadOnly))
+        return fail(QStringLiteral("%1: %2").arg(sourcePath, source.errorString()));
+
+    QImageReader probe(&source);
+    if (!probe.canRead())
+        return fail(QStringLiteral("%1: not a supported image").arg(sourcePath));
+    blob->format = QString::fromLatin1(probe.format());
+    blob->size = probe.size();
+    source.seek(0);
+
+    // Written to a temporary file in the store while hashing, then renamed
+    // into place, so the source is read once
+    const QString blobDir = root + "/blobs";
+    QDir().mkpath(blobDir);
+    QTemporaryFile staging(blobDir + "/ingest-XXXXXX");
+    if (!staging.open())
+        return fail(QStringLiteral("%1: %2").arg(blobDir, staging.errorString()));
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray chunk;
+    while (!source.atEnd()) {
+        chunk = source.read(kCopyChunk);
+        if (chunk.isEmpty() && source.error() != QFileDevice::NoError)
+            return fail(QStringLiteral("%1: %2").arg(sourcePath, source.errorString()));
+        hash.addData(chunk);
+        if (staging.write(chunk) != chunk.size())
+            return fail(QStringLiteral("%1: %2").arg(staging.fileName(), staging.errorString()));
+    }
+    blob->hash = QString::fromLatin1(hash.result().toHex());
+    blob->bytes = staging.size();
+
+    const QString target = blobPath(root, blob->hash);
+    if (QFileInfo::exists(target))
+        return true; // same content already stored, staging file is removed
+
+    QDir().mkpath(QFileInfo(target).absolutePath());
+    staging.setAutoRemove(false);
+    if (!staging.rename(target)) {
+        staging.remove();
+        // A concurrent ingest of the same frame got there first; same content
+        if (QFileInfo::exists(target))
+            return true;
+        return fail(QStringLiteral("%1: %2").arg(target, staging.errorString()));
+    }
+    return true;
+}
+
+QImage MediaStore::thumbnail(const QString &root, const QString &hash, int edge)
+{
+    const QString cached = thumbnailPath(root, hash, edge);
+    {
+        QImageReader reader(cached);
+        QImage image = reader.read();
+        if (!image.isNull())
+            return image;
+    }
+
+    QImageReader reader(blobPath(root, hash));
+    const QImage image = decode(reader, QSize(edge, edge));
+    if (image.isNull()) {
+        qWarning() << "ERROR: Failed to decode media" << hash << ":" << reader.errorString();
+        return image;
+    }
+
+    // Concurrent decodes of the same frame both write; QSaveFile keeps it whole
+    QDir().mkpath(QFileInfo(cached).absolutePath());
+    QSaveFile file(cached);
+    if (file.open(QIODevice::WriteOnly)) {
+        QImageWriter writer(&file, "jpeg");
+        writer.setQuality(85);
+        if (!writer.write(image) || !file.commit())
+            qWarning() << "ERROR: Failed to cache thumbnail" << cached << ":" << writer.errorString();
+    }
+    return image;
+}
+
+QImage MediaStore::readMapped(const QString &root, const QString &hash, const QSize &requestedSize)
+{
+    QFile file(blobPath(root, hash));
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "ERROR: Failed to open media" << hash << ":" << file.errorString();
+        return QImage();
+    }
+    const qint64 size = file.size();
+    uchar *mapped = size > 0 ? file.map(0, size) : nullptr;
+    if (!mapped) {
+        qWarning() << "ERROR: Failed to map media" << hash << ":" << file.errorString();
+        return QImage();
+    }
+
+    QImage image;
+    {
+        // The decoder reads the page cache directly, the file is never copied to the heap
+        QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+        QBuffer buffer(&bytes);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer);
+        image = decode(reader, requestedSize);
+        if (image.isNull())
+            qWarning() << "ERROR: Failed to decode media" << hash << ":" << reader.errorString();
+    }
+    file.unmap(mapped);
+    return image;
+}
+
+QVariantMap MediaStore::attach(QSqlDatabase &db, const QString &root, int tripId, const QStringList &files)
+{
+    int attached = 0;
+    int duplicates = 0;
+    QStringList failed;
+
+    auto failAll = [&files]() {
+        QVariantMap result;
+        result["attached"] = 0;
+        result["duplicates"] = 0;
+        result["failed"] = files;
+        return result;
+    };
+
+    // There is no foreign key, and list() would hide rows of a missing trip forever
+    TracedQuery insert(db, "MediaStore::attach");
+    insert.prepare("SELECT 1 FROM trips WHERE id = :trip");
+    insert.bindValue(":trip", tripId);
+    if (!insert.exec() || !insert.next()) {
+        qWarning() << "ERROR: Cannot attach media to unknown trip" << tripId;
+        return failAll();
+    }
+    insert.finish();
+
+    insert.prepare("INSERT OR IGNORE INTO media (trip_id, hash, format, width, height, bytes, added_ts) "
+                   "VALUES (:trip, :hash, :format, :width, :height, :bytes, :added)");
+
+    // Files are copied before the transaction, so it only covers the inserts
+    QList<MediaBlob> blobs;
+    for (const QString &file : files) {
+        MediaBlob blob;
+        QString error;
+        if (MediaStore::ingest(root, localPath(file), &blob, &error)) {
+            blobs.append(blob);
+        } else {
+            qWarning() << "ERROR: Failed to store media:" << error;
+            failed.append(file);
+        }
+    }
+
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start media transaction:" << db.lastError().text();
+        return failAll();
+    }
+    for (const MediaBlob &blob : std::as_const(blobs)) {
+        insert.bindValue(":trip", tripId);
+        insert.bindValue(":hash", blob.hash);
+        insert.bindValue(":format", blob.format);
+        insert.bindValue(":width", blob.size.width());
+        insert.bindValue(":height", blob.size.height());
+        insert.bindValue(":bytes", blob.bytes);
+        insert.bindValue(":added", now);
+        if (!insert.exec()) {
+            qWarning() << "ERROR: Failed to attach media:" << insert.lastError().text();
+            db.rollback();
+            return failAll();
+        }
+        if (insert.numRowsAffected() > 0)
+            ++attached;
+        else
+            ++duplicates; // this trip already has the frame
+    }
+    if (!db.commit()) {
+        qWarning() << "ERROR: Failed to commit media:" << db.lastError().text();
+        db.rollback();
+        return failAll();
+    }
+
+    QVariantMap result;
+    result["attached"] = attached;
+    result["duplicates"] = duplicates;
+    result["failed"] = failed;
+    return result;
+}
+
+QVariantMap MediaStore::list(QSqlDatabase &db, int tripId, qint64 beforeId, int limit)
+{
+    QStringList clauses;
+    if (tripId >= 0)
+        clauses << "m.trip_id = :trip";
+    if (beforeId > 0)
+        clauses << "m.id < :before";
+
+    TracedQuery query(db, "MediaStore::list");
+    query.setForwardOnly(true);
+    query.prepare("SELECT m.id, m.trip_id, m.hash, m.width, m.height, t.driver, t.start_ts "
+                  "FROM media m JOIN trips t ON t.id = m.trip_id"
+                  + (clauses.isEmpty() ? QString() : " WHERE " + clauses.join(" AND "))
+                  + " ORDER BY m.id DESC LIMIT :limit");
+    if (tripId >= 0)
+        query.bindValue(":trip", tripId);
+    if (beforeId > 0)
+        query.bindValue(":before", beforeId);
+    query.bindValue(":limit", limit);
+
+    QVariantList items;
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to list media:" << query.lastError().text();
+    } else {
+        while (query.next()) {
+            QVariantMap item;
+            item["id"] = query.value(0).toLongLong();
+            item["tripId"] = query.value(1).toInt();
+            item["hash"] = query.value(2).toString();
+            item["width"] = query.value(3).toInt();
+            item["height"] = query.value(4).toInt();
+            item["driver"] = query.value(5).toString();
+            item["startDate"] = Trip::formatDateTime(query.value(6).toLongLong());
+            items.append(item);
+        }
+    }
+
+    QVariantMap result;
+    result["items"] = items;
+    result["atEnd"] = items.size() < limit;
+    return result;
+}
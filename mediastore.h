@@ -0,0 +1,59 @@
+#ifndef MEDIASTORE_H
+#define MEDIASTORE_H
+
+#include <QImage>
+#include <QSize>
+#include <QSqlDatabase>
+#include <QStringList>
+#include <QVariant>
+
+// A photo or camera frame as stored on disk
+struct MediaBlob
+{
+    QString hash;     // SHA-256 of the content, lowercase hex
+    QString format;   // as reported by QImageReader, e.g. "jpeg"
+    QSize size;       // pixels, before orientation is applied
+    qint64 bytes = 0;
+};
+
+// Trip photos. The files live content-addressed under a root directory
+// (blobs/ab/abcdef..., so equal frames are stored once) and SQLite only
+// holds references in the `media` table. Thumbnails are decoded at reduced
+// size and cached as small JPEGs under thumbnails/<edge>/, next to the blobs.
+// Everything here blocks on disk I/O and is meant for worker or pool threads.
+namespace MediaStore
+{
+    // Thumbnail edge lengths kept on disk; requests are rounded up to one
+    constexpr int kThumbnailEdges[] = { 128, 256, 512 };
+
+    bool install(QSqlDatabase &db);
+
+    bool isValidHash(const QString &hash);
+    QString blobPath(const QString &root, const QString &hash);
+    QString thumbnailPath(const QString &root, const QString &hash, int edge);
+    int thumbnailEdge(const QSize &requestedSize);
+
+    // Hashes and copies the file into the store in one pass; a blob that is
+    // already stored, or stored meanwhile by another ingest, is not written again
+    bool ingest(const QString &root, const QString &sourcePath, MediaBlob *blob, QString *error = nullptr);
+
+    // Reads the cached thumbnail, or decodes the blob at that size and
+    // caches it. Returns a null image when the blob cannot be decoded.
+    QImage thumbnail(const QString &root, const QString &hash, int edge);
+
+    // Decodes the blob straight from a memory mapping of the file, scaled
+    // down to fit requestedSize when it is valid
+    QImage readMapped(const QString &root, const QString &hash, const QSize &requestedSize = QSize());
+
+    // Ingests files (paths or file: URLs) and links them to a trip. An
+    // unknown trip or a failed commit reports every file as failed.
+    // Result keys: attached, duplicates, failed.
+    QVariantMap attach(QSqlDatabase &db, const QString &root, int tripId, const QStringList &files);
+
+    // Newest first, keyset paged on media id; tripId < 0 lists every trip.
+    // Result keys: items ({ id, tripId, hash, width, height, driver,
+    // startDate }) and atEnd.
+    QVariantMap list(QSqlDatabase &db, int tripId, qint64 beforeId, int limit);
+}
+
+#endif
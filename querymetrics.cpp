@@ -0,0 +1,291 @@
+#include "querymetrics.h"
+#include <QSqlError>
+#include <QSqlDatabase>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QDebug>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+int bucketFor(qint64 nsecs)
+{
+    const quint64 micros = quint64(qMax<qint64>(0, nsecs / 1000));
+    const int bucket = 64 - int(qCountLeadingZeroBits(micros)); // < 2^bucket microseconds
+    return qMin(bucket, QueryMetrics::kBuckets - 1);
+}
+
+// Upper bound, in ms, of the bucket containing the given percentile
+double percentileMs(const std::array<qint64, QueryMetrics::kBuckets> &histogram, qint64 count, double percentile)
+{
+    const qint64 target = qint64(std::ceil(count * percentile));
+    qint64 seen = 0;
+    for (int i = 0; i < QueryMetrics::kBuckets; ++i) {
+        seen += histogram[i];
+        if (seen >= target && seen > 0)
+            return double(1LL << i) / 1000.0;
+    }
+    return 0.0;
+}
+
+// Approximate payload size of a value read from a result set
+qint64 variantBytes(const QVariant &value)
+{
+    switch (value.typeId()) {
+    case QMetaType::QString:
+        return qint64(value.toString().size()) * qint64(sizeof(QChar));
+    case QMetaType::QByteArray:
+        return value.toByteArray().size();
+    case QMetaType::UnknownType:
+        return 0;
+    default:
+        return qint64(sizeof(qint64));
+    }
+}
+
+} // namespace
+
+QueryMetrics::QueryMetrics(QObject *parent) : QObject(parent)
+{
+}
+
+QueryMetrics *QueryMetrics::instance()
+{
+    static QueryMetrics metrics;
+    return &metrics;
+}
+
+void QueryMetrics::record(const char *tag, const QString &statement, qint64 nsecs, qint64 rows, qint64 bytes)
+{
+    const bool slow = isSlow(nsecs);
+    {
+        QMutexLocker locker(&m_mutex);
+        Statement &entry = m_statements[QByteArray(tag)];
+        entry.sql = statement;
+        ++entry.count;
+        entry.totalNs += nsecs;
+        entry.maxNs = qMax(entry.maxNs, nsecs);
+        entry.rows += rows;
+        entry.bytes += bytes;
+        ++entry.histogram[bucketFor(nsecs)];
+        if (slow) {
+            ++entry.slow;
+            ++m_slowQueries;
+        }
+        ++m_totalQueries;
+        m_totalNs += nsecs;
+    }
+    scheduleNotify();
+}
+
+qint64 QueryMetrics::totalQueries() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_totalQueries;
+}
+
+qint64 QueryMetrics::slowQueries() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_slowQueries;
+}
+
+double QueryMetrics::totalTimeMs() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_totalNs / 1e6;
+}
+
+void QueryMetrics::setSlowThresholdMs(int ms)
+{
+    if (m_slowThresholdMs.exchange(ms) != ms)
+        emit slowThresholdMsChanged();
+}
+
+QVariantList QueryMetrics::snapshot() const
+{
+    QList<QPair<QByteArray, Statement>> entries;
+    {
+        QMutexLocker locker(&m_mutex);
+        entries.reserve(m_statements.size());
+        for (auto it = m_statements.cbegin(); it != m_statements.cend(); ++it)
+            entries.append({ it.key(), it.value() });
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+        return a.second.totalNs > b.second.totalNs;
+    });
+
+    QVariantList list;
+    list.reserve(entries.size());
+    for (const auto &[tag, entry] : entries) {
+        QVariantMap map;
+        map["tag"] = QString::fromLatin1(tag);
+        map["statement"] = entry.sql;
+        map["count"] = entry.count;
+        map["totalMs"] = entry.totalNs / 1e6;
+        map["meanMs"] = entry.count ? entry.totalNs / 1e6 / entry.count : 0.0;
+        map["maxMs"] = entry.maxNs / 1e6;
+        map["p50Ms"] = percentileMs(entry.histogram, entry.count, 0.50);
+        map["p95Ms"] = percentileMs(entry.histogram, entry.count, 0.95);
+        map["p99Ms"] = percentileMs(entry.histogram, entry.count, 0.99);
+        map["rows"] = entry.rows;
+        map["bytes"] = entry.bytes;
+        map["slow"] = entry.slow;
+        QVariantList histogram;
+        for (qint64 bucket : entry.histogram)
+            histogram.append(bucket);
+        map["histogram"] = histogram;
+        list.append(map);
+    }
+    return list;
+}
+
+bool QueryMetrics::dumpToFile(const QString &path) const
+{
+    QJsonObject report;
+    report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["totalQueries"] = totalQueries();
+    report["slowQueries"] = slowQueries();
+    report["totalTimeMs"] = totalTimeMs();
+    report["slowThresholdMs"] = slowThresholdMs();
+    report["histogramBucketsUs"] = "bucket i counts executions faster than 2^i microseconds";
+    report["statements"] = QJsonArray::fromVariantList(snapshot());
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "ERROR: Cannot write query metrics to" << path << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(report).toJson());
+    qInfo() << "Query metrics written to" << path;
+    return true;
+}
+
+void QueryMetrics::reset()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_statements.clear();
+        m_totalQueries = 0;
+        m_slowQueries = 0;
+        m_totalNs = 0;
+    }
+    emit changed();
+}
+
+void QueryMetrics::scheduleNotify()
+{
+    // Coalesce bursts of records into one queued notification on our thread
+    if (m_notifyPending.exchange(true))
+        return;
+    QMetaObject::invokeMethod(this, [this]() {
+        m_notifyPending = false;
+        emit changed();
+    }, Qt::QueuedConnection);
+}
+
+TracedQuery::TracedQuery(const QSqlDatabase &db, const char *tag)
+    : QSqlQuery(db)
+    , m_db(db)
+    , m_tag(tag)
+{
+}
+
+TracedQuery::~TracedQuery()
+{
+    finishExecution();
+}
+
+bool TracedQuery::exec()
+{
+    finishExecution();
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = QSqlQuery::exec();
+    m_elapsedNs = timer.nsecsElapsed();
+    m_active = true;
+    return ok;
+}
+
+bool TracedQuery::exec(const QString &query)
+{
+    finishExecution();
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = QSqlQuery::exec(query);
+    m_elapsedNs = timer.nsecsElapsed();
+    m_active = true;
+    return ok;
+}
+
+bool TracedQuery::next()
+{
+    // SQLite does the actual work while stepping, so next() is timed too
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = QSqlQuery::next();
+    m_elapsedNs += timer.nsecsElapsed();
+    if (ok)
+        ++m_rows;
+    return ok;
+}
+
+QVariant TracedQuery::value(int index) const
+{
+    QVariant v = QSqlQuery::value(index);
+    countBytes(v);
+    return v;
+}
+
+QVariant TracedQuery::value(const QString &name) const
+{
+    QVariant v = QSqlQuery::value(name);
+    countBytes(v);
+    return v;
+}
+
+void TracedQuery::countBytes(const QVariant &value) const
+{
+    m_bytes += variantBytes(value);
+}
+
+void TracedQuery::finishExecution()
+{
+    if (!m_active)
+        return;
+    m_active = false;
+
+    QueryMetrics *metrics = QueryMetrics::instance();
+    const QString statement = lastQuery();
+    metrics->record(m_tag, statement, m_elapsedNs, m_rows, m_bytes);
+
+    if (metrics->isSlow(m_elapsedNs)) {
+        qWarning().noquote() << QString("Slow query [%1] %2 ms, %3 rows: %4")
+                                    .arg(QString::fromLatin1(m_tag))
+                                    .arg(m_elapsedNs / 1e6, 0, 'f', 1)
+                                    .arg(m_rows)
+                                    .arg(statement);
+
+        // Re-plan the statement with the same bound values
+        QSqlQuery explain(m_db);
+        if (explain.prepare("EXPLAIN QUERY PLAN " + statement)) {
+            const QVariantList bound = boundValues();
+            for (qsizetype i = 0; i < bound.size(); ++i)
+                explain.bindValue(int(i), bound.at(i));
+            if (explain.exec()) {
+                while (explain.next())
+                    qWarning().noquote() << "    plan:" << explain.value(3).toString();
+            }
+        }
+    }
+
+    m_elapsedNs = 0;
+    m_rows = 0;
+    m_bytes = 0;
+}
@@ -0,0 +1,119 @@
+#ifndef QUERYMETRICS_H
+#define QUERYMETRICS_H
+
+#include <QObject>
+#include <QSqlQuery>
+#include <QSqlDatabase>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QVariant>
+#include <array>
+#include <atomic>
+
+// Process-wide query instrumentation. Every statement executed through
+// TracedQuery is recorded here with its wall time, rows returned and the
+// bytes read out into QVariants, bucketed into a latency histogram per
+// call-site label (the tag given to TracedQuery), so SQL built at runtime
+// does not add an entry per distinct string. Statements slower than
+// slowThresholdMs are logged together with their EXPLAIN QUERY PLAN.
+// Safe to use from any thread.
+class QueryMetrics : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(qint64 totalQueries READ totalQueries NOTIFY changed)
+    Q_PROPERTY(qint64 slowQueries READ slowQueries NOTIFY changed)
+    Q_PROPERTY(double totalTimeMs READ totalTimeMs NOTIFY changed)
+    Q_PROPERTY(int slowThresholdMs READ slowThresholdMs WRITE setSlowThresholdMs NOTIFY slowThresholdMsChanged)
+public:
+    // Histogram bucket i holds executions that took < 2^i microseconds
+    static constexpr int kBuckets = 24;
+
+    static QueryMetrics *instance();
+
+    void record(const char *tag, const QString &statement, qint64 nsecs, qint64 rows, qint64 bytes);
+
+    qint64 totalQueries() const;
+    qint64 slowQueries() const;
+    double totalTimeMs() const;
+    int slowThresholdMs() const { return m_slowThresholdMs.load(std::memory_order_relaxed); }
+    void setSlowThresholdMs(int ms);
+    bool isSlow(qint64 nsecs) const { return nsecs >= qint64(slowThresholdMs()) * 1000000; }
+
+    // One map per label, most expensive (total time) first; `statement` is
+    // the last SQL run under it
+    Q_INVOKABLE QVariantList snapshot() const;
+    Q_INVOKABLE bool dumpToFile(const QString &path) const;
+    Q_INVOKABLE void reset();
+
+signals:
+    void changed();
+    void slowThresholdMsChanged();
+
+private:
+    explicit QueryMetrics(QObject *parent = nullptr);
+
+    struct Statement
+    {
+        QString sql;
+        qint64 count = 0;
+        qint64 totalNs = 0;
+        qint64 maxNs = 0;
+        qint64 rows = 0;
+        qint64 bytes = 0;
+        qint64 slow = 0;
+        std::array<qint64, kBuckets> histogram {};
+    };
+
+    void scheduleNotify();
+
+    mutable QMutex m_mutex;
+    QHash<QByteArray, Statement> m_statements; // by tag
+    qint64 m_totalQueries = 0;
+    qint64 m_slowQueries = 0;
+    qint64 m_totalNs = 0;
+    std::atomic<int> m_slowThresholdMs { 50 };
+    std::atomic<bool> m_notifyPending { false };
+};
+
+// QSqlQuery that reports each execution to QueryMetrics under `tag`, so
+// call sites keep their shape: `TracedQuery query(db, "getTrips");`.
+// QSqlQuery is a private base: its exec() and next() are not virtual, and
+// a TracedQuery used as a plain QSqlQuery would run them untraced, so only
+// the members below are reachable.
+class TracedQuery : private QSqlQuery
+{
+public:
+    TracedQuery(const QSqlDatabase &db, const char *tag);
+    ~TracedQuery();
+
+    bool exec();
+    bool exec(const QString &query);
+    bool next();
+    QVariant value(int index) const;
+    QVariant value(const QString &name) const;
+
+    using QSqlQuery::prepare;
+    using QSqlQuery::bindValue;
+    using QSqlQuery::boundValues;
+    using QSqlQuery::setForwardOnly;
+    using QSqlQuery::numRowsAffected;
+    using QSqlQuery::lastInsertId;
+    using QSqlQuery::lastError;
+    using QSqlQuery::lastQuery;
+    using QSqlQuery::isActive;
+    using QSqlQuery::finish;
+
+private:
+    void finishExecution();
+    void countBytes(const QVariant &value) const;
+
+    QSqlDatabase m_db;
+    const char *m_tag;
+    bool m_active = false;
+    qint64 m_elapsedNs = 0;
+    qint64 m_rows = 0;
+    mutable qint64 m_bytes = 0;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "readconnectionpool.h"
+#include "statementcache.h"
+#include <QThread>
+#include <QSqlError>
+#include <QDebug>
+#include <memory>
+
+namespace {
+
+// One per pool thread, closed by that thread when it exits
+struct ReaderConnection
+{
+    QString name;
+    QString databasePath;
+
+    ~ReaderConnection()
+    {
+        StatementCache::release(name);
+        {
+            QSqlDatabase db = QSqlDatabase::database(name, false);
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(name);
+    }
+};
+
+thread_local std::unique_ptr<ReaderConnection> readerConnection;
+
+QSqlDatabase connectionFor(const QString &databasePath)
+{
+    if (readerConnection && readerConnection->databasePath == databasePath)
+        return QSqlDatabase::database(readerConnection->name);
+
+    readerConnection.reset();
+    auto connection = std::make_unique<ReaderConnection>();
+    connection->name = QStringLiteral("DigitalTripBook-reader-%1").arg(quintptr(QThread::currentThread()), 0, 16);
+    connection->databasePath = databasePath;
+
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection->name);
+    db.setDatabaseName(databasePath);
+    // Readers wait out a checkpoint instead of failing with SQLITE_BUSY
+    db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+    if (!db.open())
+        qWarning() << "Error: reader connection with database failed:" << db.lastError();
+
+    readerConnection = std::move(connection);
+    return db;
+}
+
+} // namespace
+
+ReadConnectionPool::ReadConnectionPool(const QString &databasePath, QObject *parent)
+    : QObject(parent)
+    , m_databasePath(databasePath)
+{
+    m_pool.setObjectName(QStringLiteral("ReadConnectionPool"));
+    // Beyond a handful of readers the disk, not the CPU, is the limit
+    m_pool.setMaxThreadCount(qBound(2, QThread::idealThreadCount(), 8));
+    // Idle threads keep their connection open instead of reconnecting
+    m_pool.setExpiryTimeout(-1);
+}
+
+ReadConnectionPool::~ReadConnectionPool()
+{
+    // Joins the threads, which closes their connections
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QFuture<QVariant> ReadConnectionPool::submit(DatabaseWorker::Job job, QFuture<QVariant> after)
+{
+    if (!after.isValid())
+        after = QtFuture::makeReadyValueFuture(QVariant());
+    return after.then(&m_pool, [this, job = std::move(job)](const QVariant &) {
+        return run(job);
+    });
+}
+
+QVariant ReadConnectionPool::run(const DatabaseWorker::Job &job)
+{
+    QSqlDatabase db = connectionFor(m_databasePath);
+    if (!db.isOpen())
+        return QVariant();
+    return job(db);
+}
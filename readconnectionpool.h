@@ -0,0 +1,35 @@
+#ifndef READCONNECTIONPOOL_H
+#define READCONNECTIONPOOL_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QFuture>
+#include <QSqlDatabase>
+#include <QVariant>
+#include "databaseworker.h"
+
+// Read-only queries on a QThreadPool. Every pool thread opens its own
+// read-only SQLite connection, and with the database in WAL mode they all
+// read in parallel while the DatabaseWorker stays the single writer.
+// Jobs have no ordering guarantee among themselves.
+class ReadConnectionPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ReadConnectionPool(const QString &databasePath, QObject *parent = nullptr);
+    ~ReadConnectionPool() override;
+
+    // Runs `job` on a pool thread once `after` (e.g. a write flush) has
+    // finished; an invalid `after` starts it right away
+    QFuture<QVariant> submit(DatabaseWorker::Job job, QFuture<QVariant> after = {});
+
+    int maxThreads() const { return m_pool.maxThreadCount(); }
+
+private:
+    QVariant run(const DatabaseWorker::Job &job);
+
+    QString m_databasePath;
+    QThreadPool m_pool;
+};
+
+#endif
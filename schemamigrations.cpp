@@ -0,0 +1,269 @@
+#include "schemamigrations.h"
+#include "fleetsummary.h"
+#include "telemetrystore.h"
+#include "tripsearch.h"
+#include "triprollups.h"
+#include "mediastore.h"
+#include "querymetrics.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QElapsedTimer>
+#include <QDebug>
+#include <functional>
+
+namespace {
+
+struct Migration
+{
+    int version;
+    const char *description;
+    // Transactional steps run inside one transaction together with the
+    // version bump. Others manage their own transactions, e.g. chunked backfills.
+    bool transactional;
+    std::function<bool(QSqlDatabase &db)> apply;
+};
+
+// Trip ids covered per transaction by chunked backfills
+constexpr int kBackfillChunkRows = 5000;
+
+bool exec(QSqlDatabase &db, const QString &sql)
+{
+    TracedQuery query(db, "migration");
+    if (!query.exec(sql)) {
+        qWarning() << "ERROR: Migration statement failed:" << query.lastError().text() << "in" << sql;
+        return false;
+    }
+    return true;
+}
+
+bool hasColumn(QSqlDatabase &db, const QString &table, const QString &column)
+{
+    return db.record(table).contains(column);
+}
+
+bool addColumn(QSqlDatabase &db, const QString &table, const QString &column, const QString &definition)
+{
+    if (hasColumn(db, table, column))
+        return true;
+    return exec(db, QStringLiteral("ALTER TABLE %1 ADD COLUMN %2 %3").arg(table, column, definition));
+}
+
+// Runs `sql` (an UPDATE of the trips with :from < id <= :to) over the
+// whole id range in chunks, committing every chunk so a large table never
+// holds one huge transaction. Each chunk seeks the primary key, so no chunk
+// rescans the rows earlier ones already filled.
+bool runChunked(QSqlDatabase &db, const QString &sql)
+{
+    QElapsedTimer timer;
+    timer.start();
+    qint64 total = 0;
+
+    TracedQuery query(db, "migration");
+    if (!query.exec("SELECT IFNULL(MAX(id), 0) FROM trips") || !query.next()) {
+        qWarning() << "ERROR: Failed to read the trip id range:" << query.lastError().text();
+        return false;
+    }
+    const qint64 maxId = query.value(0).toLongLong();
+    query.finish();
+
+    if (!query.prepare(sql)) {
+        qWarning() << "ERROR: Failed to prepare backfill:" << query.lastError().text();
+        return false;
+    }
+
+    for (qint64 last = 0; last < maxId; last += kBackfillChunkRows) {
+        if (!db.transaction())
+            return false;
+        query.bindValue(":from", last);
+        query.bindValue(":to", last + kBackfillChunkRows);
+        if (!query.exec()) {
+            qWarning() << "ERROR: Backfill chunk failed:" << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+        const int affected = query.numRowsAffected();
+        if (!db.commit())
+            return false;
+        total += affected;
+    }
+
+    qInfo() << "Backfilled" << total << "rows in" << timer.elapsed() << "ms.";
+    return true;
+}
+
+const QList<Migration> &migrations()
+{
+    static const QList<Migration> steps = {
+        { 1, "create trips table", true, [](QSqlDatabase &db) {
+            return exec(db, "CREATE TABLE IF NOT EXISTS trips ("
+                            "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+                            "date TEXT, "
+                            "duration INTEGER, "
+                            "driver TEXT, "
+                            "location TEXT, "
+                            "vehicle TEXT, "
+                            "start_battery REAL, "
+                            "end_battery REAL, "
+                            "energy_used REAL, "
+                            "distance_m REAL, "
+                            "avg_speed REAL, "
+                            "notes TEXT, "
+                            "favorite INTEGER, "
+                            "photo TEXT, "
+                            "traffic_violations INTEGER DEFAULT 0"
+                            ")");
+        } },
+        { 2, "add vehicle column", true, [](QSqlDatabase &db) {
+            return addColumn(db, "trips", "vehicle", "TEXT");
+        } },
+        { 3, "backfill vehicle column", false, [](QSqlDatabase &db) {
+            // Trips logged before vehicles were tracked all ran on the JetRacer
+            return runChunked(db, "UPDATE trips SET vehicle = 'JetRacer' "
+                                  "WHERE id > :from AND id <= :to AND vehicle IS NULL");
+        } },
+        { 4, "add traffic_violations column", true, [](QSqlDatabase &db) {
+            return addColumn(db, "trips", "traffic_violations", "INTEGER DEFAULT 0");
+        } },
+        { 5, "install fleet summary rollups", false, [](QSqlDatabase &db) {
+            return FleetSummary::install(db);
+        } },
+        { 6, "create telemetry store", true, [](QSqlDatabase &db) {
+            return TelemetryStore::install(db);
+        } },
+        { 7, "create trip indexes", true, [](QSqlDatabase &db) {
+            // Keyset paging and every ORDER BY date
+            return exec(db, "CREATE INDEX IF NOT EXISTS idx_trips_date_id ON trips (date, id)")
+                // Per-driver aggregates read only from the index
+                && exec(db, "CREATE INDEX IF NOT EXISTS idx_trips_driver ON trips "
+                            "(driver, vehicle, distance_m, energy_used, traffic_violations)")
+                && exec(db, "CREATE INDEX IF NOT EXISTS idx_trips_vehicle ON trips (vehicle)")
+                // Only favorite rows are indexed, they are a small fraction
+                && exec(db, "CREATE INDEX IF NOT EXISTS idx_trips_favorite ON trips (favorite) WHERE favorite = 1");
+        } },
+        { 8, "create trip search index", true, [](QSqlDatabase &db) {
+            return TripSearch::install(db);
+        } },
+        { 9, "create daily, weekly and monthly rollups", true, [](QSqlDatabase &db) {
+            // Triggers and contents follow in version 12, once start_ts exists
+            return TripRollups::createTables(db);
+        } },
+        { 10, "add epoch timestamp columns", true, [](QSqlDatabase &db) {
+            return addColumn(db, "trips", "start_ts", "INTEGER")
+                && addColumn(db, "trips", "end_ts", "INTEGER");
+        } },
+        { 11, "backfill epoch timestamps", false, [](QSqlDatabase &db) {
+            // The text dates were always local time, 'utc' converts them from it
+            return runChunked(db, "UPDATE trips SET "
+                                  "start_ts = CAST(strftime('%s', date, 'utc') AS INTEGER), "
+                                  "end_ts = CAST(strftime('%s', date, 'utc') AS INTEGER) + IFNULL(duration, 0) * 60 "
+                                  "WHERE id > :from AND id <= :to AND start_ts IS NULL AND date IS NOT NULL");
+        } },
+        { 12, "index epoch timestamps and rebuild rollups on them", false, [](QSqlDatabase &db) {
+            // Indexes and triggers commit together; the rollups then fill in
+            // chunks. Rerunning after a failure empties and refills them again.
+            if (!db.transaction())
+                return false;
+            const bool ok = exec(db, "DROP INDEX IF EXISTS idx_trips_date_id")
+                // Keyset paging, range filters and every ORDER BY start_ts
+                && exec(db, "CREATE INDEX IF NOT EXISTS idx_trips_start_id ON trips (start_ts, id)")
+                && exec(db, "CREATE INDEX IF NOT EXISTS idx_trips_end ON trips (end_ts)")
+                // Writers that only know the legacy text date still get timestamps
+                && exec(db, "CREATE TRIGGER IF NOT EXISTS trips_timestamps_insert AFTER INSERT ON trips "
+                            "WHEN NEW.start_ts IS NULL AND NEW.date IS NOT NULL BEGIN "
+                            "UPDATE trips SET "
+                            "start_ts = CAST(strftime('%s', NEW.date, 'utc') AS INTEGER), "
+                            "end_ts = CAST(strftime('%s', NEW.date, 'utc') AS INTEGER) + IFNULL(NEW.duration, 0) * 60 "
+                            "WHERE id = NEW.id; "
+                            "END")
+                && TripRollups::install(db);
+            if (!ok || !db.commit()) {
+                db.rollback();
+                return false;
+            }
+            return TripRollups::fill(db, kBackfillChunkRows);
+        } },
+        // Persistent per file: readers no longer block the writer or each other.
+        // journal_mode cannot change inside a transaction.
+        { 13, "switch to write-ahead logging", false, [](QSqlDatabase &db) {
+            return exec(db, "PRAGMA journal_mode = WAL");
+        } },
+        { 14, "create media references", true, [](QSqlDatabase &db) {
+            return MediaStore::install(db);
+        } },
+        { 15, "scope fleet summary cleanup to the changed row", true, [](QSqlDatabase &db) {
+            // The old triggers swept both summary tables on every update and delete
+            return FleetSummary::installTriggers(db);
+        } },
+        { 16, "create import progress table", true, [](QSqlDatabase &db) {
+            // Earlier builds created the table on the first import, without head_hash
+            return exec(db, "CREATE TABLE IF NOT EXISTS import_progress ("
+                            "source TEXT PRIMARY KEY, "
+                            "file_size INTEGER, "
+                            "byte_offset INTEGER, "
+                            "rows_imported INTEGER, "
+                            "completed INTEGER)")
+                && addColumn(db, "import_progress", "head_hash", "TEXT");
+        } },
+    };
+    return steps;
+}
+
+bool setVersion(QSqlDatabase &db, int version)
+{
+    return exec(db, QStringLiteral("PRAGMA user_version = %1").arg(version));
+}
+
+} // namespace
+
+int SchemaMigrations::currentVersion(QSqlDatabase &db)
+{
+    TracedQuery query(db, "migration");
+    if (query.exec("PRAGMA user_version") && query.next())
+        return query.value(0).toInt();
+    return 0;
+}
+
+int SchemaMigrations::latestVersion()
+{
+    return migrations().last().version;
+}
+
+bool SchemaMigrations::migrate(QSqlDatabase &db)
+{
+    const int startVersion = currentVersion(db);
+    if (startVersion > latestVersion()) {
+        qWarning() << "ERROR: Database schema version" << startVersion << "is newer than this build supports.";
+        return false;
+    }
+
+    for (const Migration &step : migrations()) {
+        if (step.version <= startVersion)
+            continue;
+
+        qInfo() << "Migrating database to version" << step.version << "-" << step.description;
+        QElapsedTimer timer;
+        timer.start();
+
+        if (step.transactional) {
+            if (!db.transaction()) {
+                qWarning() << "ERROR: Failed to start migration transaction:" << db.lastError().text();
+                return false;
+            }
+            if (!step.apply(db) || !setVersion(db, step.version) || !db.commit()) {
+                qWarning() << "ERROR: Migration to version" << step.version << "failed, rolling back.";
+                db.rollback();
+                return false;
+            }
+        } else {
+            if (!step.apply(db) || !setVersion(db, step.version)) {
+                qWarning() << "ERROR: Migration to version" << step.version << "failed.";
+                return false;
+            }
+        }
+
+        qInfo() << "Migrated to version" << step.version << "in" << timer.elapsed() << "ms.";
+    }
+
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef SCHEMAMIGRATIONS_H
+#define SCHEMAMIGRATIONS_H
+
+#include <QSqlDatabase>
+
+// Ordered schema migrations tracked with PRAGMA user_version. Each step
+// runs at most once per database file and bumps user_version when it is
+// done. Steps are written so they are also safe on files created before
+// user_version was used, where the version is still 0.
+namespace SchemaMigrations
+{
+    int currentVersion(QSqlDatabase &db);
+    int latestVersion();
+
+    // Brings the database up to latestVersion()
+    bool migrate(QSqlDatabase &db);
+}
+
+#endif
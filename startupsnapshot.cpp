@@ -0,0 +1,105 @@
+#include "startupsnapshot.h"
+#include "fleetsummary.h"
+#include "schemamigrations.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QDebug>
+
+namespace {
+
+constexpr quint32 kMagic = 0x44544253; // "DTBS"
+constexpr quint16 kFormatVersion = 1;
+
+} // namespace
+
+QString StartupSnapshot::pathFor(const QString &databasePath)
+{
+    return databasePath + ".snapshot";
+}
+
+StartupSnapshot::Data StartupSnapshot::load(const QString &path)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    Data data;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return data; // first launch, nothing to show yet
+
+    const qint64 size = file.size();
+    uchar *mapped = size > 0 ? file.map(0, size) : nullptr;
+    if (!mapped) {
+        qWarning() << "ERROR: Failed to map startup snapshot:" << file.errorString();
+        return data;
+    }
+
+    {
+        // Reads straight from the mapping, no copy of the file contents
+        const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+        QDataStream in(bytes);
+        in.setVersion(QDataStream::Qt_6_5);
+
+        quint32 magic = 0;
+        quint16 version = 0;
+        in >> magic >> version;
+        if (magic == kMagic && version == kFormatVersion) {
+            in >> data.writtenAt >> data.schemaVersion >> data.summary
+               >> data.firstPage.ids >> data.firstPage.startTs >> data.firstPage.drivers
+               >> data.firstPage.vehicles >> data.firstPage.notes >> data.firstPage.favorites;
+
+            const qsizetype rows = data.firstPage.ids.size();
+            const bool consistent = data.firstPage.startTs.size() == rows && data.firstPage.drivers.size() == rows
+                                    && data.firstPage.vehicles.size() == rows && data.firstPage.notes.size() == rows
+                                    && data.firstPage.favorites.size() == rows;
+            data.valid = in.status() == QDataStream::Ok && consistent
+                         && data.schemaVersion == SchemaMigrations::latestVersion();
+        }
+    }
+    file.unmap(mapped);
+
+    if (!data.valid) {
+        qInfo() << "Ignoring outdated or damaged startup snapshot:" << path;
+        return Data();
+    }
+
+    qInfo() << "Startup snapshot with" << data.firstPage.ids.size() << "trips loaded in"
+            << timer.nsecsElapsed() / 1e6 << "ms";
+    return data;
+}
+
+bool StartupSnapshot::save(const QString &path, const Data &data)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "ERROR: Failed to write startup snapshot:" << file.errorString();
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_5);
+    out << kMagic << kFormatVersion
+        << data.writtenAt << data.schemaVersion << data.summary
+        << data.firstPage.ids << data.firstPage.startTs << data.firstPage.drivers
+        << data.firstPage.vehicles << data.firstPage.notes << data.firstPage.favorites;
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        qWarning() << "ERROR: Failed to write startup snapshot:" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+StartupSnapshot::Data StartupSnapshot::capture(QSqlDatabase &db, int pageSize)
+{
+    Data data;
+    data.writtenAt = QDateTime::currentSecsSinceEpoch();
+    data.schemaVersion = SchemaMigrations::currentVersion(db);
+    data.summary = FleetSummary::read(db);
+    data.firstPage = TripListModel::fetchPage(db, -1, 0, pageSize);
+    data.valid = !data.summary.isEmpty();
+    return data;
+}
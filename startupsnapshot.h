@@ -0,0 +1,36 @@
+#ifndef STARTUPSNAPSHOT_H
+#define STARTUPSNAPSHOT_H
+
+#include <QString>
+#include <QVariant>
+#include "triplistmodel.h"
+
+// Small file next to the database holding what the first frame shows: the
+// fleet summary and the newest page of trips. It is written at shutdown and
+// memory-mapped on the next launch, so the window has data before SQLite is
+// even opened. The live database always wins once it is ready.
+namespace StartupSnapshot
+{
+    struct Data
+    {
+        bool valid = false;
+        qint64 writtenAt = 0;   // epoch seconds
+        int schemaVersion = 0;  // snapshots from another schema are ignored
+        QVariantMap summary;    // FleetSummary::read() keys
+        TripPage firstPage;
+    };
+
+    QString pathFor(const QString &databasePath);
+
+    // Maps and decodes the file; returns an invalid Data when it is missing,
+    // truncated or written by another format or schema version
+    Data load(const QString &path);
+
+    // Replaces the file atomically
+    bool save(const QString &path, const Data &data);
+
+    // Summary and first page from the live database, for save()
+    Data capture(QSqlDatabase &db, int pageSize);
+}
+
+#endif
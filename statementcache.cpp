@@ -0,0 +1,45 @@
+#include "statementcache.h"
+#include "querymetrics.h"
+#include <QHash>
+#include <QMutex>
+#include <QSqlError>
+#include <QDebug>
+#include <memory>
+
+namespace {
+
+using Statements = QHash<QString, std::shared_ptr<TracedQuery>>;
+
+// Keyed by connection name. The mutex only guards the maps, each query is
+// used by the single thread owning its connection.
+QMutex cacheMutex;
+QHash<QString, Statements> cache;
+
+} // namespace
+
+TracedQuery *StatementCache::prepare(QSqlDatabase &db, const QString &sql, const char *tag)
+{
+    QMutexLocker locker(&cacheMutex);
+    Statements &statements = cache[db.connectionName()];
+    auto it = statements.constFind(sql);
+    if (it != statements.constEnd())
+        return it.value().get();
+
+    auto query = std::make_shared<TracedQuery>(db, tag);
+    if (!query->prepare(sql)) {
+        qWarning() << "ERROR: Failed to prepare cached statement:" << query->lastError().text();
+        return nullptr;
+    }
+    statements.insert(sql, query);
+    return query.get();
+}
+
+void StatementCache::release(const QString &connectionName)
+{
+    Statements statements;
+    {
+        QMutexLocker locker(&cacheMutex);
+        statements = cache.take(connectionName);
+    }
+    // Queries are destroyed here, outside the lock
+}
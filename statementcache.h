@@ -0,0 +1,23 @@
+#ifndef STATEMENTCACHE_H
+#define STATEMENTCACHE_H
+
+#include <QSqlDatabase>
+#include <QString>
+
+class TracedQuery;
+
+// Prepared statements kept per connection and reused across calls, so hot
+// write paths skip re-parsing and re-planning SQL on every execution. A
+// cached query belongs to the thread that owns its connection.
+namespace StatementCache
+{
+    // Returns the prepared statement for `sql` on `db`, preparing it on first
+    // use. Returns nullptr if it does not prepare.
+    TracedQuery *prepare(QSqlDatabase &db, const QString &sql, const char *tag);
+
+    // Drops every statement of a connection; must run before the connection
+    // is closed and removed
+    void release(const QString &connectionName);
+}
+
+#endif
@@ -0,0 +1,380 @@
+#include "telemetrystore.h"
+#include "querymetrics.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QByteArray>
+#include <QFile>
+#include <QDebug>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+constexpr quint8 kFormatVersion = 1;
+constexpr int kColumnCount = 5; // timestamp, speed, battery, latitude, longitude
+
+// Fixed-point scale per value column, chosen to keep the sensor precision
+constexpr std::array<double, kColumnCount> kScales = { 1.0, 1000.0, 100.0, 1e7, 1e7 };
+
+void writeVarint(QByteArray &out, quint64 value)
+{
+    while (value >= 0x80) {
+        out.append(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(char(value));
+}
+
+bool readVarint(const char *&p, const char *end, quint64 *value)
+{
+    quint64 result = 0;
+    int shift = 0;
+    while (p < end && shift < 64) {
+        const quint8 byte = quint8(*p++);
+        result |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+inline quint64 zigzag(qint64 v) { return (quint64(v) << 1) ^ quint64(v >> 63); }
+inline qint64 unzigzag(quint64 v) { return qint64(v >> 1) ^ -qint64(v & 1); }
+
+qint64 quantize(const TelemetrySample &s, int column)
+{
+    switch (column) {
+    case 0: return s.timestampMs;
+    case 1: return std::llround(s.speed * kScales[1]);
+    case 2: return std::llround(s.battery * kScales[2]);
+    case 3: return std::llround(s.latitude * kScales[3]);
+    default: return std::llround(s.longitude * kScales[4]);
+    }
+}
+
+QByteArray encodeChunk(const TelemetrySample *samples, int count)
+{
+    std::array<QByteArray, kColumnCount> columns;
+    for (int c = 0; c < kColumnCount; ++c) {
+        QByteArray &out = columns[c];
+        out.reserve(count * 2);
+        qint64 previous = 0;
+        for (int i = 0; i < count; ++i) {
+            const qint64 value = quantize(samples[i], c);
+            writeVarint(out, zigzag(value - previous));
+            previous = value;
+        }
+    }
+
+    QByteArray payload;
+    payload.append(char(kFormatVersion));
+    writeVarint(payload, quint64(count));
+    for (const QByteArray &column : columns)
+        writeVarint(payload, quint64(column.size()));
+    for (const QByteArray &column : columns)
+        payload.append(column);
+
+    return qCompress(payload, 6);
+}
+
+bool decodeColumn(const char *p, const char *end, int count, double scale, QList<double> *out)
+{
+    out->resize(count);
+    double *values = out->data();
+    qint64 value = 0;
+    for (int i = 0; i < count; ++i) {
+        quint64 raw;
+        if (!readVarint(p, end, &raw))
+            return false;
+        value += unzigzag(raw);
+        values[i] = double(value) / scale;
+    }
+    return true;
+}
+
+// Decodes the timestamp column and one value column of a stored chunk
+bool decodeChunk(const QByteArray &blob, int valueColumn, QList<double> *t, QList<double> *v)
+{
+    const QByteArray payload = qUncompress(blob);
+    const char *p = payload.constData();
+    const char *end = p + payload.size();
+    if (p == end || quint8(*p++) != kFormatVersion)
+        return false;
+
+    quint64 count;
+    std::array<quint64, kColumnCount> sizes;
+    // The count sizes the output buffers, so a corrupt one must not get that far
+    if (!readVarint(p, end, &count) || count > quint64(TelemetryStore::kChunkSamples))
+        return false;
+    for (quint64 &size : sizes) {
+        if (!readVarint(p, end, &size))
+            return false;
+    }
+
+    // Sizes are checked against the bytes left before any pointer moves past them
+    const quint64 available = quint64(end - p);
+    quint64 valueOffset = 0;
+    for (int c = 0; c < valueColumn; ++c) {
+        if (sizes[c] > available - valueOffset)
+            return false;
+        valueOffset += sizes[c];
+    }
+    if (sizes[0] > available || sizes[valueColumn] > available - valueOffset)
+        return false;
+    const char *valueStart = p + valueOffset;
+
+    return decodeColumn(p, p + sizes[0], int(count), kScales[0], t)
+        && decodeColumn(valueStart, valueStart + sizes[valueColumn], int(count), kScales[valueColumn], v);
+}
+
+} // namespace
+
+bool TelemetryStore::install(QSqlDatabase &db)
+{
+    TracedQuery query(db, "TelemetryStore::install");
+    if (!query.exec("CREATE TABLE IF NOT EXISTS telemetry_chunks ("
+                    "trip_id INTEGER NOT NULL, "
+                    "chunk_index INTEGER NOT NULL, "
+                    "t_start INTEGER NOT NULL, "
+                    "t_end INTEGER NOT NULL, "
+                    "sample_count INTEGER NOT NULL, "
+                    "data BLOB NOT NULL, "
+                    "PRIMARY KEY (trip_id, chunk_index)"
+                    ") WITHOUT ROWID")) {
+        qWarning() << "ERROR: Failed to create telemetry table:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool TelemetryStore::append(QSqlDatabase &db, qint64 tripId, const QList<TelemetrySample> &samples)
+{
+    if (samples.isEmpty())
+        return true;
+
+    const auto unsorted = std::is_sorted_until(samples.cbegin(), samples.cend(),
+                                               [](const TelemetrySample &a, const TelemetrySample &b) {
+                                                   return a.timestampMs < b.timestampMs;
+                                               });
+    if (unsorted != samples.cend()) {
+        qWarning() << "ERROR: Telemetry samples for trip" << tripId << "are not sorted by time at index"
+                   << (unsorted - samples.cbegin());
+        return false;
+    }
+
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start telemetry transaction:" << db.lastError().text();
+        return false;
+    }
+
+    // Read inside the transaction, so the chunk numbers cannot be taken meanwhile
+    TracedQuery query(db, "TelemetryStore::append");
+    int nextChunk = 0;
+    query.prepare("SELECT MAX(chunk_index), MAX(t_end) FROM telemetry_chunks WHERE trip_id = :trip");
+    query.bindValue(":trip", tripId);
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to read telemetry chunks:" << query.lastError().text();
+        db.rollback();
+        return false;
+    }
+    if (query.next() && !query.value(0).isNull()) {
+        nextChunk = query.value(0).toInt() + 1;
+        // Overlapping chunks would come back out of time order
+        const qint64 lastEnd = query.value(1).toLongLong();
+        if (samples.first().timestampMs < lastEnd) {
+            qWarning() << "ERROR: Telemetry for trip" << tripId << "starts at" << samples.first().timestampMs
+                       << "before its stored samples end at" << lastEnd;
+            db.rollback();
+            return false;
+        }
+    }
+
+    query.prepare("INSERT INTO telemetry_chunks (trip_id, chunk_index, t_start, t_end, sample_count, data) "
+                  "VALUES (:trip, :chunk, :start, :end, :count, :data)");
+    for (qsizetype first = 0; first < samples.size(); first += kChunkSamples) {
+        const int count = int(qMin<qsizetype>(kChunkSamples, samples.size() - first));
+        const TelemetrySample *chunk = samples.constData() + first;
+
+        query.bindValue(":trip", tripId);
+        query.bindValue(":chunk", nextChunk++);
+        query.bindValue(":start", chunk[0].timestampMs);
+        query.bindValue(":end", chunk[count - 1].timestampMs);
+        query.bindValue(":count", count);
+        query.bindValue(":data", encodeChunk(chunk, count));
+        if (!query.exec()) {
+            qWarning() << "ERROR: Failed to store telemetry chunk:" << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        qWarning() << "ERROR: Failed to commit telemetry:" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool TelemetryStore::readCsv(const QString &path, QList<TelemetrySample> *samples, QString *error)
+{
+    auto fail = [error](const QString &message) {
+        if (error)
+            *error = message;
+        return false;
+    };
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return fail(QStringLiteral("%1: %2").arg(path, file.errorString()));
+
+    // Columns are found by name, so their order does not matter
+    const QList<QByteArray> header = file.readLine().trimmed().split(',');
+    const std::array<QByteArray, kColumnCount> names = { "timestamp_ms", "speed", "battery", "latitude", "longitude" };
+    std::array<qsizetype, kColumnCount> columns;
+    for (int c = 0; c < kColumnCount; ++c) {
+        columns[c] = header.indexOf(names[c]);
+        if (columns[c] < 0)
+            return fail(QStringLiteral("%1: missing column %2").arg(path, QString::fromLatin1(names[c])));
+    }
+
+    qint64 lineNumber = 1;
+    while (!file.atEnd()) {
+        ++lineNumber;
+        const QByteArray line = file.readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+        const QList<QByteArray> fields = line.split(',');
+        std::array<double, kColumnCount> values;
+        for (int c = 0; c < kColumnCount; ++c) {
+            bool ok = false;
+            values[c] = columns[c] < fields.size() ? fields.at(columns[c]).toDouble(&ok) : 0.0;
+            if (!ok)
+                return fail(QStringLiteral("%1:%2: bad %3 value").arg(path).arg(lineNumber).arg(QString::fromLatin1(names[c])));
+        }
+        TelemetrySample sample;
+        sample.timestampMs = qint64(values[0]);
+        sample.speed = values[1];
+        sample.battery = values[2];
+        sample.latitude = values[3];
+        sample.longitude = values[4];
+        samples->append(sample);
+    }
+    return true;
+}
+
+TelemetrySeries TelemetryStore::readRange(QSqlDatabase &db, qint64 tripId, Channel channel, qint64 fromMs, qint64 toMs)
+{
+    TelemetrySeries series;
+    const int valueColumn = int(channel) + 1;
+
+    TracedQuery query(db, "TelemetryStore::readRange");
+    query.setForwardOnly(true);
+    query.prepare("SELECT sample_count, data FROM telemetry_chunks "
+                  "WHERE trip_id = :trip AND t_end >= :from AND t_start <= :to ORDER BY chunk_index");
+    query.bindValue(":trip", tripId);
+    query.bindValue(":from", fromMs < 0 ? std::numeric_limits<qint64>::min() : fromMs);
+    query.bindValue(":to", toMs < 0 ? std::numeric_limits<qint64>::max() : toMs);
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to read telemetry:" << query.lastError().text();
+        return series;
+    }
+
+    QList<double> t;
+    QList<double> v;
+    while (query.next()) {
+        if (!decodeChunk(query.value(1).toByteArray(), valueColumn, &t, &v)) {
+            qWarning() << "ERROR: Corrupt telemetry chunk for trip" << tripId;
+            continue;
+        }
+        series.t.reserve(series.t.size() + t.size());
+        series.v.reserve(series.v.size() + v.size());
+        for (qsizetype i = 0; i < t.size(); ++i) {
+            if ((fromMs >= 0 && t[i] < fromMs) || (toMs >= 0 && t[i] > toMs))
+                continue;
+            series.t.append(t[i]);
+            series.v.append(v[i]);
+        }
+    }
+
+    return series;
+}
+
+TelemetrySeries TelemetryStore::downsample(const TelemetrySeries &series, int threshold)
+{
+    const qsizetype n = series.t.size();
+    if (threshold < 3 || n <= threshold)
+        return series;
+
+    TelemetrySeries out;
+    out.t.reserve(threshold);
+    out.v.reserve(threshold);
+
+    const double *x = series.t.constData();
+    const double *y = series.v.constData();
+    // Bucket b covers [bound(b), bound(b + 1)) of the points between the
+    // first and the last; integer bounds so the last bucket ends exactly at
+    // n - 1, and the "next bucket" after it is the final sample alone
+    const qsizetype buckets = threshold - 2;
+    auto bound = [n, buckets](qsizetype b) { return b > buckets ? n : 1 + b * (n - 2) / buckets; };
+
+    qsizetype a = 0; // previously selected point
+    out.t.append(x[0]);
+    out.v.append(y[0]);
+
+    for (qsizetype bucket = 0; bucket < buckets; ++bucket) {
+        // Average of the next bucket is the third triangle vertex
+        const qsizetype nextStart = bound(bucket + 1);
+        const qsizetype nextEnd = bound(bucket + 2);
+        double avgX = 0.0;
+        double avgY = 0.0;
+        for (qsizetype i = nextStart; i < nextEnd; ++i) {
+            avgX += x[i];
+            avgY += y[i];
+        }
+        avgX /= double(nextEnd - nextStart);
+        avgY /= double(nextEnd - nextStart);
+
+        // Point of the current bucket spanning the largest triangle
+        const qsizetype start = bound(bucket);
+        const qsizetype end = bound(bucket + 1);
+        double maxArea = -1.0;
+        qsizetype selected = start;
+        for (qsizetype i = start; i < end; ++i) {
+            const double area = std::abs((x[a] - avgX) * (y[i] - y[a]) - (x[a] - x[i]) * (avgY - y[a]));
+            if (area > maxArea) {
+                maxArea = area;
+                selected = i;
+            }
+        }
+
+        out.t.append(x[selected]);
+        out.v.append(y[selected]);
+        a = selected;
+    }
+
+    // Always kept, whatever the buckets chose
+    out.t.append(x[n - 1]);
+    out.v.append(y[n - 1]);
+    return out;
+}
+
+bool TelemetryStore::channelFromName(const QString &name, Channel *channel)
+{
+    if (name == QLatin1String("speed"))
+        *channel = Channel::Speed;
+    else if (name == QLatin1String("battery"))
+        *channel = Channel::Battery;
+    else if (name == QLatin1String("latitude"))
+        *channel = Channel::Latitude;
+    else if (name == QLatin1String("longitude"))
+        *channel = Channel::Longitude;
+    else
+        return false;
+    return true;
+}
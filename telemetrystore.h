@@ -0,0 +1,58 @@
+#ifndef TELEMETRYSTORE_H
+#define TELEMETRYSTORE_H
+
+#include <QList>
+#include <QSqlDatabase>
+#include <QVariant>
+
+// One high-frequency sample logged by the car during a trip
+struct TelemetrySample
+{
+    qint64 timestampMs = 0; // since epoch
+    double speed = 0.0;     // m/s
+    double battery = 0.0;   // %
+    double latitude = 0.0;
+    double longitude = 0.0;
+};
+
+// A decoded (and possibly downsampled) trace of one channel
+struct TelemetrySeries
+{
+    QList<double> t; // timestamps in ms
+    QList<double> v;
+};
+
+// Per-trip telemetry kept next to the trips table. Samples are grouped in
+// chunks of up to kChunkSamples rows; each chunk is stored as one
+// compressed blob with one delta-encoded column per channel, so a range
+// read only decompresses the chunks it overlaps and only decodes the
+// timestamp column plus the channel that was asked for.
+namespace TelemetryStore
+{
+    enum class Channel { Speed, Battery, Latitude, Longitude };
+
+    constexpr int kChunkSamples = 4096;
+
+    bool install(QSqlDatabase &db);
+
+    // Appends samples after the trip's existing chunks, in one transaction.
+    // They must be sorted by time and not start before the last stored
+    // sample, since reads and downsampling rely on chunk order; anything
+    // else is rejected.
+    bool append(QSqlDatabase &db, qint64 tripId, const QList<TelemetrySample> &samples);
+
+    // Reads a CSV log with the columns timestamp_ms, speed, battery,
+    // latitude and longitude (any order, named in the header row)
+    bool readCsv(const QString &path, QList<TelemetrySample> *samples, QString *error = nullptr);
+
+    // Samples of one channel with fromMs <= t <= toMs. Negative bounds are open.
+    TelemetrySeries readRange(QSqlDatabase &db, qint64 tripId, Channel channel, qint64 fromMs = -1, qint64 toMs = -1);
+
+    // Largest-Triangle-Three-Buckets downsampling, keeps the visual shape
+    // of the trace with at most `threshold` points
+    TelemetrySeries downsample(const TelemetrySeries &series, int threshold);
+
+    bool channelFromName(const QString &name, Channel *channel);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include "trip.h"
+#include "querymetrics.h"
+#include <QDateTime>
+
+QString Trip::columns()
+{
+    return QStringLiteral("id, start_ts, end_ts, duration, driver, location, vehicle, notes, start_battery, "
+                          "end_battery, energy_used, distance_m, avg_speed, favorite, traffic_violations");
+}
+
+Trip Trip::fromQuery(const TracedQuery &query)
+{
+    Trip trip;
+    trip.id = query.value(0).toLongLong();
+    trip.startTs = query.value(1).toLongLong();
+    trip.endTs = query.value(2).toLongLong();
+    trip.duration = query.value(3).toInt();
+    trip.driver = query.value(4).toString();
+    trip.location = query.value(5).toString();
+    trip.vehicle = query.value(6).toString();
+    trip.notes = query.value(7).toString();
+    trip.startBattery = query.value(8).toDouble();
+    trip.endBattery = query.value(9).toDouble();
+    trip.energyUsed = query.value(10).toDouble();
+    trip.distance = query.value(11).toDouble();
+    trip.averageSpeed = query.value(12).toDouble();
+    trip.favorite = query.value(13).toBool();
+    trip.trafficViolations = query.value(14).toInt();
+    return trip;
+}
+
+QVariantMap Trip::toDetailsMap() const
+{
+    QVariantMap details;
+    details["id"] = id;
+    details["name"] = driver;
+    details["startTs"] = startTs;
+    details["endTs"] = endTs;
+    details["startDate"] = startDate();
+    details["startTime"] = startTime();
+    details["endTime"] = endTime();
+    details["duration"] = duration;
+    details["startOdometer"] = startBattery;
+    details["endOdometer"] = endBattery;
+    details["energyUsed"] = energyUsed;
+    details["distance"] = distance;
+    details["averageSpeed"] = averageSpeed;
+    details["vehicle"] = vehicle;
+    details["location"] = location;
+    details["notes"] = notes;
+    details["favorite"] = favorite;
+    return details;
+}
+
+QString Trip::formatDate(qint64 ts)
+{
+    return QDateTime::fromSecsSinceEpoch(ts).toString(QStringLiteral("yyyy-MM-dd"));
+}
+
+QString Trip::formatDateTime(qint64 ts)
+{
+    return QDateTime::fromSecsSinceEpoch(ts).toString(QStringLiteral("yyyy-MM-dd hh:mm"));
+}
+
+QString Trip::formatTime(qint64 ts)
+{
+    return QDateTime::fromSecsSinceEpoch(ts).toString(QStringLiteral("hh:mm"));
+}
+
+qint64 Trip::parseLegacyDate(const QString &text)
+{
+    const QDateTime dateTime = QDateTime::fromString(text.trimmed(), QStringLiteral("yyyy-MM-dd hh:mm"));
+    return dateTime.isValid() ? dateTime.toSecsSinceEpoch() : -1;
+}
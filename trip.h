@@ -0,0 +1,50 @@
+#ifndef TRIP_H
+#define TRIP_H
+
+#include <QString>
+#include <QVariant>
+
+class TracedQuery;
+
+// One row of `trips`, decoded once from a query. Times stay integers
+// (seconds since the epoch, UTC) and are only turned into text by the
+// formatting getters; toDetailsMap() formats the three the detail page shows.
+struct Trip
+{
+    qint64 id = 0;
+    qint64 startTs = 0;
+    qint64 endTs = 0;
+    int duration = 0; // minutes
+    QString driver;
+    QString location;
+    QString vehicle;
+    QString notes;
+    double startBattery = 0.0;
+    double endBattery = 0.0;
+    double energyUsed = 0.0;
+    double distance = 0.0; // m
+    double averageSpeed = 0.0;
+    bool favorite = false;
+    int trafficViolations = 0;
+
+    // Column list fromQuery() expects, as in "SELECT " + Trip::columns() + " FROM trips"
+    static QString columns();
+    static Trip fromQuery(const TracedQuery &query);
+
+    // Local time, as the trips were always shown
+    QString startDate() const { return formatDate(startTs); }
+    QString startTime() const { return formatTime(startTs); }
+    QString endTime() const { return formatTime(endTs); }
+
+    // Keys TripDetailPage reads
+    QVariantMap toDetailsMap() const;
+
+    static QString formatDate(qint64 ts);
+    static QString formatDateTime(qint64 ts); // "yyyy-MM-dd hh:mm", as list rows show it
+    static QString formatTime(qint64 ts);
+    // The legacy "yyyy-MM-dd hh:mm" local time text; -1 if it does not parse.
+    // Only used where such text enters the database, e.g. imports.
+    static qint64 parseLegacyDate(const QString &text);
+};
+
+#endif
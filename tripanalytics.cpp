@@ -0,0 +1,140 @@
+#include "tripanalytics.h"
+#include "querymetrics.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QHash>
+#include <QPointF>
+#include <QXYSeries>
+#include <QDebug>
+#include <algorithm>
+
+TripColumns TripAnalytics::loadColumns(QSqlDatabase &db)
+{
+    TripColumns columns;
+    TracedQuery query(db, "TripAnalytics::loadColumns");
+    query.setForwardOnly(true);
+
+    if (query.exec("SELECT COUNT(*) FROM trips") && query.next()) {
+        const qsizetype count = query.value(0).toLongLong();
+        columns.ids.reserve(count);
+        columns.driverIds.reserve(count);
+        columns.vehicleIds.reserve(count);
+        columns.distanceKm.reserve(count);
+        columns.batteryUsage.reserve(count);
+        columns.energy.reserve(count);
+        columns.averageSpeed.reserve(count);
+        columns.violations.reserve(count);
+    }
+
+    if (!query.exec("SELECT id, driver, distance_m, start_battery, end_battery, energy_used, avg_speed, traffic_violations, start_ts, vehicle "
+                    "FROM trips ORDER BY start_ts ASC")) {
+        qWarning() << "Failed to load trip columns:" << query.lastError().text();
+        return columns;
+    }
+
+    auto intern = [](QHash<QString, quint32> &index, QStringList &names, const QString &name) {
+        auto it = index.constFind(name);
+        if (it == index.constEnd()) {
+            it = index.insert(name, quint32(names.size()));
+            names.append(name);
+        }
+        return it.value();
+    };
+
+    QHash<QString, quint32> driverIndex;
+    QHash<QString, quint32> vehicleIndex;
+    while (query.next()) {
+        columns.ids.append(query.value(0).toLongLong());
+        columns.driverIds.append(intern(driverIndex, columns.drivers, query.value(1).toString()));
+        columns.vehicleIds.append(intern(vehicleIndex, columns.vehicles, query.value(9).toString()));
+        columns.distanceKm.append(query.value(2).toDouble() / 1000.0); // Convert to km
+        columns.batteryUsage.append(query.value(3).toDouble() - query.value(4).toDouble());
+        columns.energy.append(query.value(5).toDouble());
+        columns.averageSpeed.append(query.value(6).toDouble());
+        columns.violations.append(query.value(7).toInt());
+        columns.lastStartTs = query.value(8).toLongLong();
+    }
+
+    return columns;
+}
+
+QVariantMap TripAnalytics::chartData(const TripColumns &columns)
+{
+    const qsizetype tripCount = columns.size();
+    const qsizetype driverCount = columns.drivers.size();
+
+    QList<double> driverEnergy(driverCount, 0.0);
+    QList<double> driverDistance(driverCount, 0.0);
+    QList<int> driverTrips(driverCount, 0);
+    QList<int> driverViolations(driverCount, 0);
+
+    double maxEnergy = 0.0;
+    double maxBattery = 0.0;
+    double maxSpeed = 0.0;
+
+    const double *energy = columns.energy.constData();
+    const double *battery = columns.batteryUsage.constData();
+    const double *speed = columns.averageSpeed.constData();
+    const double *distance = columns.distanceKm.constData();
+    const quint32 *driverIds = columns.driverIds.constData();
+    const int *violations = columns.violations.constData();
+
+    for (qsizetype i = 0; i < tripCount; ++i) {
+        const quint32 d = driverIds[i];
+        maxEnergy = std::max(maxEnergy, energy[i]);
+        maxBattery = std::max(maxBattery, battery[i]);
+        maxSpeed = std::max(maxSpeed, speed[i]);
+
+        driverEnergy[d] += energy[i];
+        driverDistance[d] += distance[i] > 0.0 ? distance[i] : 0.1; // Avoid div by zero
+        driverTrips[d] += 1;
+        driverViolations[d] += violations[i];
+    }
+
+    QList<double> driverEfficiency(driverCount, 0.0);
+    double maxEfficiency = 0.0;
+    int maxViolations = 0;
+    for (qsizetype d = 0; d < driverCount; ++d) {
+        driverEfficiency[d] = driverEnergy[d] / driverDistance[d]; // kWh per km
+        maxEfficiency = std::max(maxEfficiency, driverEfficiency[d]);
+        maxViolations = std::max(maxViolations, driverViolations[d]);
+    }
+
+    QVariantMap data;
+    data["tripCount"] = int(tripCount);
+    data["energy"] = QVariant::fromValue(columns.energy);
+    data["batteryUsage"] = QVariant::fromValue(columns.batteryUsage);
+    data["averageSpeed"] = QVariant::fromValue(columns.averageSpeed);
+    data["maxEnergy"] = maxEnergy;
+    data["maxBatteryUsage"] = maxBattery;
+    data["maxSpeed"] = maxSpeed;
+    data["drivers"] = columns.drivers;
+    data["driverTripCounts"] = QVariant::fromValue(driverTrips);
+    data["driverEfficiency"] = QVariant::fromValue(driverEfficiency);
+    data["driverViolations"] = QVariant::fromValue(driverViolations);
+    // Sums behind driverEfficiency, so a statistics delta can recompute one driver
+    data["driverEnergy"] = QVariant::fromValue(driverEnergy);
+    data["driverDistance"] = QVariant::fromValue(driverDistance);
+    data["lastStartTs"] = columns.lastStartTs;
+    data["maxEfficiency"] = maxEfficiency;
+    data["maxViolations"] = maxViolations;
+    return data;
+}
+
+void TripAnalytics::fillSeries(QObject *series, const QList<double> &yValues, const QList<double> &xValues)
+{
+    auto *xySeries = qobject_cast<QXYSeries *>(series);
+    if (!xySeries) {
+        qWarning() << "fillSeries: not an XY series:" << series;
+        return;
+    }
+
+    const bool hasX = xValues.size() == yValues.size();
+    QList<QPointF> points;
+    points.reserve(yValues.size());
+    for (qsizetype i = 0; i < yValues.size(); ++i)
+        points.append(QPointF(hasX ? xValues.at(i) : double(i + 1), yValues.at(i)));
+
+    // replace() emits a single pointsReplaced() instead of one signal per point
+    xySeries->replace(points);
+}
@@ -0,0 +1,41 @@
+#ifndef TRIPANALYTICS_H
+#define TRIPANALYTICS_H
+
+#include <QList>
+#include <QStringList>
+#include <QSqlDatabase>
+#include <QVariant>
+
+// Per-trip metrics held column by column, in chronological order. Drivers
+// and vehicles are interned, `driverIds[i]` indexes into `drivers`.
+struct TripColumns
+{
+    QList<qint64> ids;
+    QList<quint32> driverIds;
+    QStringList drivers;
+    QList<quint32> vehicleIds;
+    QStringList vehicles;
+    QList<double> distanceKm;
+    QList<double> batteryUsage;
+    QList<double> energy;
+    QList<double> averageSpeed;
+    QList<int> violations;
+    qint64 lastStartTs = -1; // newest trip, so later inserts know whether they append
+
+    qsizetype size() const { return ids.size(); }
+};
+
+namespace TripAnalytics
+{
+    TripColumns loadColumns(QSqlDatabase &db);
+
+    // Everything StatisticsPage draws, computed in one pass: per-trip series
+    // as packed number arrays plus per-driver aggregates already grouped
+    QVariantMap chartData(const TripColumns &columns);
+
+    // Replaces the points of a QML LineSeries/ScatterSeries in one call.
+    // When xValues is empty the points are numbered from 1.
+    void fillSeries(QObject *series, const QList<double> &yValues, const QList<double> &xValues = {});
+}
+
+#endif
@@ -0,0 +1,146 @@
+#include "tripchanges.h"
+#include "querymetrics.h"
+#include <QSqlError>
+#include <QDebug>
+
+QVariantMap TripChanges::tripUpdate(int tripId, const std::optional<bool> &favorite, const std::optional<QString> &notes)
+{
+    QVariantMap update;
+    update["id"] = tripId;
+    if (favorite)
+        update["favorite"] = *favorite;
+    if (notes)
+        update["notes"] = *notes;
+    return update;
+}
+
+QVariantMap TripChanges::insertedDelta(QSqlDatabase &db, qint64 firstId, qint64 lastId)
+{
+    QVariantMap delta;
+    if (lastId < firstId)
+        return delta;
+
+    // Everything below is a primary key range scan over the new rows only
+    TracedQuery query(db, "TripChanges::insertedDelta");
+    query.setForwardOnly(true);
+    query.prepare("SELECT COUNT(*), IFNULL(SUM(distance_m), 0), IFNULL(SUM(duration), 0), IFNULL(SUM(energy_used), 0), "
+                  "IFNULL(SUM(favorite), 0) FROM trips WHERE id BETWEEN :first AND :last");
+    query.bindValue(":first", firstId);
+    query.bindValue(":last", lastId);
+    if (!query.exec() || !query.next()) {
+        qWarning() << "ERROR: Failed to compute statistics delta:" << query.lastError().text();
+        delta["reload"] = true;
+        return delta;
+    }
+    const qint64 count = query.value(0).toLongLong();
+    if (count == 0)
+        return delta;
+    delta["trips"] = count;
+    delta["distance"] = query.value(1).toDouble() / 1000.0; // Convert to km
+    delta["duration"] = query.value(2).toLongLong();
+    delta["energy"] = query.value(3).toDouble();
+    delta["favorites"] = query.value(4).toLongLong();
+
+    if (count > kMaxDeltaTrips) {
+        delta["reload"] = true;
+        return delta;
+    }
+
+    // Same per-driver distance rule as TripAnalytics::chartData, so the
+    // efficiency recomputed from a delta matches a full reload
+    QVariantMap drivers;
+    query.prepare("SELECT driver, COUNT(*), SUM(CASE WHEN distance_m > 0 THEN distance_m / 1000.0 ELSE 0.1 END), "
+                  "SUM(energy_used), SUM(traffic_violations) FROM trips WHERE id BETWEEN :first AND :last GROUP BY driver");
+    query.bindValue(":first", firstId);
+    query.bindValue(":last", lastId);
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to compute driver delta:" << query.lastError().text();
+        delta["reload"] = true;
+        return delta;
+    }
+    while (query.next()) {
+        QVariantMap driver;
+        driver["trips"] = query.value(1).toLongLong();
+        driver["distance"] = query.value(2).toDouble();
+        driver["energy"] = query.value(3).toDouble();
+        driver["violations"] = query.value(4).toLongLong();
+        drivers[query.value(0).toString()] = driver;
+    }
+    delta["drivers"] = drivers;
+
+    QVariantMap vehicles;
+    query.prepare("SELECT vehicle, COUNT(*) FROM trips WHERE id BETWEEN :first AND :last GROUP BY vehicle");
+    query.bindValue(":first", firstId);
+    query.bindValue(":last", lastId);
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to compute vehicle delta:" << query.lastError().text();
+        delta["reload"] = true;
+        return delta;
+    }
+    while (query.next())
+        vehicles[query.value(0).toString()] = query.value(1).toLongLong();
+    delta["vehicles"] = vehicles;
+
+    QVariantList newTrips;
+    query.prepare("SELECT id, start_ts, driver, energy_used, start_battery - end_battery, avg_speed "
+                  "FROM trips WHERE id BETWEEN :first AND :last ORDER BY start_ts, id");
+    query.bindValue(":first", firstId);
+    query.bindValue(":last", lastId);
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to list new trips for delta:" << query.lastError().text();
+        delta["reload"] = true;
+        return delta;
+    }
+    while (query.next()) {
+        QVariantMap trip;
+        trip["id"] = query.value(0).toLongLong();
+        trip["startTs"] = query.value(1).toLongLong();
+        trip["driver"] = query.value(2).toString();
+        trip["energy"] = query.value(3).toDouble();
+        trip["batteryUsage"] = query.value(4).toDouble();
+        trip["averageSpeed"] = query.value(5).toDouble();
+        newTrips.append(trip);
+    }
+    delta["newTrips"] = newTrips;
+    return delta;
+}
+
+QVariantMap TripChanges::favoritesDelta(int switchedOn, int switchedOff)
+{
+    QVariantMap delta;
+    if (switchedOn != switchedOff)
+        delta["favorites"] = switchedOn - switchedOff;
+    return delta;
+}
+
+qint64 TripChanges::maxTripId(QSqlDatabase &db)
+{
+    TracedQuery query(db, "TripChanges::maxTripId");
+    if (query.exec("SELECT IFNULL(MAX(id), 0) FROM trips") && query.next())
+        return query.value(0).toLongLong();
+    return 0;
+}
+
+void TripChanges::applyToSummary(QVariantMap &summary, const QVariantMap &delta)
+{
+    if (summary.isEmpty())
+        return; // nothing shown yet, the next full read has it all
+
+    auto add = [&summary, &delta](const char *summaryKey, const char *deltaKey) {
+        if (delta.contains(deltaKey))
+            summary[summaryKey] = summary.value(summaryKey).toDouble() + delta.value(deltaKey).toDouble();
+    };
+    add("totalTrips", "trips");
+    add("totalDistance", "distance");
+    add("totalDuration", "duration");
+    add("totalEnergyUsed", "energy");
+    add("favoriteTrips", "favorites");
+
+    const QVariantMap vehicles = delta.value("vehicles").toMap();
+    if (!vehicles.isEmpty()) {
+        QVariantMap tripsPerVehicle = summary.value("tripsPerVehicle").toMap();
+        for (auto it = vehicles.cbegin(); it != vehicles.cend(); ++it)
+            tripsPerVehicle[it.key()] = tripsPerVehicle.value(it.key()).toLongLong() + it.value().toLongLong();
+        summary["tripsPerVehicle"] = tripsPerVehicle;
+    }
+}
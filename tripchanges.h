@@ -0,0 +1,38 @@
+#ifndef TRIPCHANGES_H
+#define TRIPCHANGES_H
+
+#include <QSqlDatabase>
+#include <QVariant>
+#include <optional>
+
+// Change sets DatabaseHandler emits once writes have committed, so views can
+// patch what they show at O(changes) instead of querying the table again.
+//
+// A statistics delta uses the FleetSummary::read() units and has the keys
+//   trips, distance (km), duration (min), energy (kWh), favorites,
+//   drivers { name: { trips, distance, energy, violations } },
+//   vehicles { name: trips },
+//   newTrips [{ id, startTs, driver, energy, batteryUsage, averageSpeed }],
+//   reload (the change was too large for a delta; query again instead).
+// Keys that did not change are left out.
+namespace TripChanges
+{
+    // Inserts beyond this are reported as reload instead of a delta
+    constexpr qint64 kMaxDeltaTrips = 500;
+
+    // { id, favorite?, notes? } with only the fields that changed
+    QVariantMap tripUpdate(int tripId, const std::optional<bool> &favorite, const std::optional<QString> &notes);
+
+    // Delta for trips with ids in [firstId, lastId] that were just inserted
+    QVariantMap insertedDelta(QSqlDatabase &db, qint64 firstId, qint64 lastId);
+
+    // Delta for favorite flags that were switched on and off
+    QVariantMap favoritesDelta(int switchedOn, int switchedOff);
+
+    qint64 maxTripId(QSqlDatabase &db);
+
+    // Applies the totals of a delta to FleetSummary::read() keys
+    void applyToSummary(QVariantMap &summary, const QVariantMap &delta);
+}
+
+#endif
@@ -0,0 +1,389 @@
+#include "tripexporter.h"
+#include "querymetrics.h"
+#include <QSqlError>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QDataStream>
+#include <QtEndian>
+#include <QLocale>
+#include <QDebug>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+enum class ColumnType : quint8 { Int64 = 0, Double = 1, Text = 2 };
+
+struct Column
+{
+    const char *name;
+    ColumnType type;
+};
+
+// Names match TripImporter's columns; the importer skips `id`
+const QList<Column> kTripColumns = {
+    { "id", ColumnType::Int64 },
+    { "start_ts", ColumnType::Int64 },
+    { "end_ts", ColumnType::Int64 },
+    { "duration", ColumnType::Int64 },
+    { "driver", ColumnType::Text },
+    { "location", ColumnType::Text },
+    { "vehicle", ColumnType::Text },
+    { "start_battery", ColumnType::Double },
+    { "end_battery", ColumnType::Double },
+    { "energy_used", ColumnType::Double },
+    { "distance_m", ColumnType::Double },
+    { "avg_speed", ColumnType::Double },
+    { "notes", ColumnType::Text },
+    { "favorite", ColumnType::Int64 },
+    { "traffic_violations", ColumnType::Int64 }
+};
+
+const QList<Column> kDailyColumns = {
+    { "bucket", ColumnType::Text },
+    { "driver", ColumnType::Text },
+    { "vehicle", ColumnType::Text },
+    { "trip_count", ColumnType::Int64 },
+    { "total_distance", ColumnType::Double },
+    { "total_duration", ColumnType::Int64 },
+    { "total_energy", ColumnType::Double },
+    { "total_violations", ColumnType::Int64 },
+    { "favorite_count", ColumnType::Int64 }
+};
+
+// CSV is flushed to the file in blocks of about this size
+constexpr qsizetype kCsvBufferBytes = 256 * 1024;
+constexpr qint64 kProgressEveryRows = 10000;
+constexpr quint32 kColumnarMagic = 0x44544243; // "DTBC"
+constexpr quint32 kRowGroupMagic = 0x52475250; // "RGRP"
+constexpr quint32 kFooterMagic = 0x44454E44;   // "DEND"
+constexpr quint16 kColumnarVersion = 1;
+
+class RowWriter
+{
+public:
+    virtual ~RowWriter() = default;
+    virtual bool begin(QIODevice *out, const QList<Column> &columns) = 0;
+    virtual bool writeRow(const TracedQuery &row) = 0;
+    virtual bool finish() = 0;
+};
+
+class CsvWriter : public RowWriter
+{
+public:
+    bool begin(QIODevice *out, const QList<Column> &columns) override
+    {
+        m_out = out;
+        m_columns = columns;
+        m_buffer.reserve(kCsvBufferBytes + 4096);
+        for (qsizetype i = 0; i < columns.size(); ++i) {
+            if (i > 0)
+                m_buffer += ',';
+            m_buffer += columns.at(i).name;
+        }
+        m_buffer += '\n';
+        return true;
+    }
+
+    bool writeRow(const TracedQuery &row) override
+    {
+        for (int i = 0; i < m_columns.size(); ++i) {
+            if (i > 0)
+                m_buffer += ',';
+            const QVariant value = row.value(i);
+            if (value.isNull())
+                continue;
+            switch (m_columns.at(i).type) {
+            case ColumnType::Int64:
+                m_buffer += QByteArray::number(value.toLongLong());
+                break;
+            case ColumnType::Double:
+                m_buffer += QByteArray::number(value.toDouble(), 'g', QLocale::FloatingPointShortest);
+                break;
+            case ColumnType::Text:
+                appendText(value.toString().toUtf8());
+                break;
+            }
+        }
+        m_buffer += '\n';
+        return m_buffer.size() < kCsvBufferBytes || flush();
+    }
+
+    bool finish() override { return flush(); }
+
+private:
+    void appendText(const QByteArray &text)
+    {
+        const bool quote = text.contains(',') || text.contains('"') || text.contains('\n') || text.contains('\r');
+        if (!quote) {
+            m_buffer += text;
+            return;
+        }
+        m_buffer += '"';
+        for (const char c : text) {
+            if (c == '"')
+                m_buffer += '"';
+            m_buffer += c;
+        }
+        m_buffer += '"';
+    }
+
+    bool flush()
+    {
+        if (m_out->write(m_buffer) != m_buffer.size())
+            return false;
+        m_buffer.clear(); // keeps the capacity
+        return true;
+    }
+
+    QIODevice *m_out = nullptr;
+    QList<Column> m_columns;
+    QByteArray m_buffer;
+};
+
+class ColumnarWriter : public RowWriter
+{
+public:
+    explicit ColumnarWriter(int rowGroupSize) : m_rowGroupSize(rowGroupSize) {}
+
+    bool begin(QIODevice *out, const QList<Column> &columns) override
+    {
+        m_out = out;
+        m_stream.setDevice(out);
+        m_stream.setVersion(QDataStream::Qt_6_5);
+        m_columns = columns;
+        m_blocks.resize(columns.size());
+
+        m_stream << kColumnarMagic << kColumnarVersion << quint16(columns.size());
+        for (const Column &column : columns)
+            m_stream << QString::fromLatin1(column.name) << quint8(column.type);
+        return m_stream.status() == QDataStream::Ok;
+    }
+
+    bool writeRow(const TracedQuery &row) override
+    {
+        const int bit = m_groupRows % 8;
+        for (int i = 0; i < m_columns.size(); ++i) {
+            Block &block = m_blocks[i];
+            if (bit == 0)
+                block.nulls += '\0';
+            const QVariant value = row.value(i);
+            if (value.isNull()) {
+                block.nulls.back() = char(block.nulls.back() | (1 << bit));
+                continue;
+            }
+            switch (m_columns.at(i).type) {
+            case ColumnType::Int64: {
+                const qint64 v = value.toLongLong();
+                // Ids and timestamps grow slowly, so deltas are mostly one or two bytes
+                const qint64 delta = qint64(quint64(v) - quint64(block.previous));
+                block.previous = v;
+                appendVarint(block.data, (quint64(delta) << 1) ^ quint64(delta >> 63));
+                break;
+            }
+            case ColumnType::Double: {
+                const double v = value.toDouble();
+                quint64 bits;
+                std::memcpy(&bits, &v, sizeof bits);
+                char bytes[8];
+                qToLittleEndian(bits, bytes);
+                block.data.append(bytes, 8);
+                break;
+            }
+            case ColumnType::Text: {
+                const QByteArray text = value.toString().toUtf8();
+                appendVarint(block.data, quint64(text.size()));
+                block.data += text;
+                break;
+            }
+            }
+        }
+        ++m_totalRows;
+        return ++m_groupRows < m_rowGroupSize || flushGroup();
+    }
+
+    bool finish() override
+    {
+        if (m_groupRows > 0 && !flushGroup())
+            return false;
+        const quint64 footerOffset = quint64(m_out->pos());
+        m_stream << kFooterMagic << quint64(m_totalRows) << quint32(m_groupOffsets.size());
+        for (const quint64 offset : std::as_const(m_groupOffsets))
+            m_stream << offset;
+        m_stream << footerOffset << kColumnarMagic;
+        return m_stream.status() == QDataStream::Ok;
+    }
+
+private:
+    struct Block
+    {
+        QByteArray nulls;
+        QByteArray data;
+        qint64 previous = 0;
+    };
+
+    static void appendVarint(QByteArray &out, quint64 value)
+    {
+        while (value >= 0x80) {
+            out += char(value | 0x80);
+            value >>= 7;
+        }
+        out += char(value);
+    }
+
+    bool flushGroup()
+    {
+        m_groupOffsets.append(quint64(m_out->pos()));
+        m_stream << kRowGroupMagic << quint32(m_groupRows);
+        for (Block &block : m_blocks) {
+            const QByteArray compressed = qCompress(block.nulls + block.data);
+            m_stream << quint32(compressed.size());
+            m_stream.writeRawData(compressed.constData(), int(compressed.size()));
+            // Capacity is kept, so the next group does not reallocate
+            block.nulls.clear();
+            block.data.clear();
+            block.previous = 0;
+        }
+        m_groupRows = 0;
+        return m_stream.status() == QDataStream::Ok;
+    }
+
+    QIODevice *m_out = nullptr;
+    QDataStream m_stream;
+    QList<Column> m_columns;
+    QList<Block> m_blocks;
+    QList<quint64> m_groupOffsets;
+    int m_rowGroupSize;
+    int m_groupRows = 0;
+    qint64 m_totalRows = 0;
+};
+
+QString selectFor(TripExporter::Dataset dataset, const QList<Column> &columns)
+{
+    QStringList names;
+    for (const Column &column : columns)
+        names << QString::fromLatin1(column.name);
+    if (dataset == TripExporter::Dataset::DailyStatistics)
+        return "SELECT " + names.join(", ") + " FROM rollup_daily ORDER BY bucket, driver, vehicle";
+    return "SELECT " + names.join(", ") + " FROM trips ORDER BY id";
+}
+
+} // namespace
+
+QVariantMap TripExporter::Result::toVariantMap() const
+{
+    QVariantMap map;
+    map["ok"] = ok;
+    map["rowsExported"] = rowsExported;
+    map["bytesWritten"] = bytesWritten;
+    map["elapsedMs"] = elapsedMs;
+    map["rowsPerSecond"] = rowsPerSecond;
+    map["error"] = error;
+    return map;
+}
+
+TripExporter::TripExporter(QSqlDatabase db, QObject *parent)
+    : QObject(parent)
+    , m_db(db)
+{
+}
+
+void TripExporter::setRowGroupSize(int rows)
+{
+    m_rowGroupSize = qMax(1, rows);
+}
+
+TripExporter::Format TripExporter::formatForPath(const QString &path)
+{
+    return QFileInfo(path).suffix().compare("dtbc", Qt::CaseInsensitive) == 0 ? Format::Columnar : Format::Csv;
+}
+
+bool TripExporter::datasetFromName(const QString &name, Dataset *dataset)
+{
+    if (name.isEmpty() || name == "trips") {
+        *dataset = Dataset::Trips;
+        return true;
+    }
+    if (name == "daily") {
+        *dataset = Dataset::DailyStatistics;
+        return true;
+    }
+    return false;
+}
+
+TripExporter::Result TripExporter::exportFile(const QString &path, Dataset dataset, Format format)
+{
+    Result result;
+    QElapsedTimer timer;
+    timer.start();
+
+    if (format == Format::Auto)
+        format = formatForPath(path);
+    const QList<Column> &columns = dataset == Dataset::Trips ? kTripColumns : kDailyColumns;
+
+    // Only for progress; the trips count comes from the rollup instead of a scan
+    qint64 rowsTotal = 0;
+    {
+        TracedQuery count(m_db, "TripExporter::count");
+        const QString sql = dataset == Dataset::Trips ? "SELECT trip_count FROM fleet_summary WHERE id = 1"
+                                                      : "SELECT COUNT(*) FROM rollup_daily";
+        if (count.exec(sql) && count.next())
+            rowsTotal = count.value(0).toLongLong();
+    }
+
+    TracedQuery query(m_db, "TripExporter::exportFile");
+    // Without this QSqlQuery caches every row it has seen
+    query.setForwardOnly(true);
+    if (!query.exec(selectFor(dataset, columns))) {
+        result.error = query.lastError().text();
+        qWarning() << "ERROR: Failed to read rows for export:" << result.error;
+        return result;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        result.error = QStringLiteral("%1: %2").arg(path, file.errorString());
+        qWarning() << "ERROR: Cannot write export:" << result.error;
+        return result;
+    }
+
+    std::unique_ptr<RowWriter> writer;
+    if (format == Format::Columnar)
+        writer = std::make_unique<ColumnarWriter>(m_rowGroupSize);
+    else
+        writer = std::make_unique<CsvWriter>();
+
+    auto rate = [&timer](qint64 rows) {
+        const qint64 ms = timer.elapsed();
+        return ms > 0 ? rows * 1000.0 / ms : 0.0;
+    };
+
+    bool written = writer->begin(&file, columns);
+    while (written && query.next()) {
+        written = writer->writeRow(query);
+        if (++result.rowsExported % kProgressEveryRows == 0)
+            emit progress(result.rowsExported, qMax(rowsTotal, result.rowsExported), rate(result.rowsExported));
+    }
+    written = written && writer->finish();
+
+    if (!written || query.lastError().isValid()) {
+        result.error = query.lastError().isValid() ? query.lastError().text() : file.errorString();
+        qWarning() << "ERROR: Export to" << path << "failed:" << result.error;
+        file.cancelWriting();
+        return result;
+    }
+    result.bytesWritten = file.pos();
+    if (!file.commit()) {
+        result.error = file.errorString();
+        qWarning() << "ERROR: Export to" << path << "failed:" << result.error;
+        return result;
+    }
+
+    result.ok = true;
+    result.elapsedMs = timer.elapsed();
+    result.rowsPerSecond = rate(result.rowsExported);
+    emit progress(result.rowsExported, result.rowsExported, result.rowsPerSecond);
+    qInfo() << "Exported" << result.rowsExported << "rows to" << path << "in" << result.elapsedMs << "ms";
+    return result;
+}
@@ -0,0 +1,70 @@
+#ifndef TRIPEXPORTER_H
+#define TRIPEXPORTER_H
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QVariant>
+
+// Streams a table out of SQLite into a file with constant memory: rows come
+// from a forward-only query and go straight into a buffered writer, so the
+// row count only changes how long it takes. The file is written through
+// QSaveFile and only appears once it is complete.
+//
+// CSV has a header row named like the TripImporter columns, so a trips
+// export can be imported again.
+//
+// The columnar format (.dtbc) is meant for analysis tools. All integers
+// are big-endian.
+//   header:    "DTBC" u32, version u16, column count u16, then for each
+//              column its name (QDataStream QString) and type u8
+//              (0 = int64, 1 = double, 2 = text)
+//   row group: "RGRP" u32, row count u32, then for each column the qCompress()ed
+//              block (length u32 + bytes). A block starts with a null bitmap,
+//              one bit per row (LSB first), followed by the non-null values:
+//              int64 as zigzag varints of the delta to the previous value
+//              (starting at 0 in every group), doubles as 8 bytes little-endian,
+//              text as varint byte length + UTF-8.
+//   footer:    "DEND" u32, total rows u64, group count u32, the file offset of
+//              every group (u64), then the footer offset u64 and "DTBC" u32
+class TripExporter : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Format { Auto, Csv, Columnar };
+    enum class Dataset { Trips, DailyStatistics };
+
+    struct Result
+    {
+        bool ok = false;
+        qint64 rowsExported = 0;
+        qint64 bytesWritten = 0;
+        qint64 elapsedMs = 0;
+        double rowsPerSecond = 0.0;
+        QString error;
+
+        QVariantMap toVariantMap() const;
+    };
+
+    explicit TripExporter(QSqlDatabase db, QObject *parent = nullptr);
+
+    // Rows buffered per columnar row group; bounds memory use
+    void setRowGroupSize(int rows);
+    int rowGroupSize() const { return m_rowGroupSize; }
+
+    // .dtbc is columnar, everything else CSV
+    static Format formatForPath(const QString &path);
+    // "trips" or "daily"; false for anything else
+    static bool datasetFromName(const QString &name, Dataset *dataset);
+
+    Result exportFile(const QString &path, Dataset dataset = Dataset::Trips, Format format = Format::Auto);
+
+signals:
+    // Emitted every few thousand rows and once at the end
+    void progress(qint64 rowsExported, qint64 rowsTotal, double rowsPerSecond);
+
+private:
+    QSqlDatabase m_db;
+    int m_rowGroupSize = 65536;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "tripimporter.h"
+#include "querymetrics.h"
+#include "trip.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonParseError>
+#include <QHash>
+#include <QDebug>
+
+namespace {
+
+// Order of the bound values in the INSERT below
+const char *const kColumns[] = {
+    "date", "duration", "driver", "location", "vehicle", "start_battery", "end_battery",
+    "energy_used", "distance_m", "avg_speed", "notes", "favorite", "photo", "traffic_violations",
+    "start_ts", "end_ts"
+};
+constexpr int kColumnCount = int(sizeof(kColumns) / sizeof(kColumns[0]));
+constexpr int kFavoriteColumn = 11;
+constexpr int kViolationsColumn = 13;
+constexpr int kDateColumn = 0;
+constexpr int kDurationColumn = 1;
+constexpr int kStartTsColumn = 14;
+constexpr int kEndTsColumn = 15;
+
+// Splits one CSV record into fields, handling quoted fields and "" escapes
+QStringList parseCsvRecord(const QString &record)
+{
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+
+    for (qsizetype i = 0; i < record.size(); ++i) {
+        const QChar c = record.at(i);
+        if (quoted) {
+            if (c == u'"') {
+                if (i + 1 < record.size() && record.at(i + 1) == u'"') {
+                    field += u'"';
+                    ++i;
+                } else {
+                    quoted = false;
+                }
+            } else {
+                field += c;
+            }
+        } else if (c == u'"') {
+            quoted = true;
+        } else if (c == u',') {
+            fields.append(field);
+            field.clear();
+        } else if (c != u'\r' && c != u'\n') {
+            field += c;
+        }
+    }
+    fields.append(field);
+    return fields;
+}
+
+// Files written before start_ts/end_ts existed only carry the text date
+void fillTimestamps(QVariantList &values)
+{
+    if (values.at(kStartTsColumn).isNull() && !values.at(kDateColumn).isNull()) {
+        const qint64 startTs = Trip::parseLegacyDate(values.at(kDateColumn).toString());
+        if (startTs >= 0)
+            values[kStartTsColumn] = startTs;
+    }
+    if (values.at(kEndTsColumn).isNull() && !values.at(kStartTsColumn).isNull())
+        values[kEndTsColumn] = values.at(kStartTsColumn).toLongLong() + values.at(kDurationColumn).toLongLong() * 60;
+}
+
+QVariant defaultFor(int column)
+{
+    if (column == kFavoriteColumn || column == kViolationsColumn)
+        return 0;
+    return QVariant();
+}
+
+} // namespace
+
+QVariantMap TripImporter::Result::toVariantMap() const
+{
+    QVariantMap map;
+    map["ok"] = ok;
+    map["resumed"] = resumed;
+    map["rowsImported"] = rowsImported;
+    map["rowsSkipped"] = rowsSkipped;
+    map["elapsedMs"] = elapsedMs;
+    map["rowsPerSecond"] = rowsPerSecond;
+    map["error"] = error;
+    return map;
+}
+
+TripImporter::TripImporter(QSqlDatabase db, QObject *parent)
+    : QObject(parent)
+    , m_db(db)
+{
+}
+
+void TripImporter::setBatchSize(int batchSize)
+{
+    m_batchSize = qMax(1, batchSize);
+}
+
+TripImporter::Result TripImporter::importFile(const QString &path, Format format)
+{
+    Result result;
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        result.error = QStringLiteral("Cannot open %1: %2").arg(path, file.errorString());
+        qWarning() << "ERROR:" << result.error;
+        return result;
+    }
+
+    if (format == Format::Auto) {
+        const QString suffix = QFileInfo(path).suffix().toLower();
+        format = (suffix == "jsonl" || suffix == "ndjson") ? Format::JsonLines : Format::Csv;
+    }
+
+    // Look up where a previous run of this file stopped. The hash of the
+    // file head tells a grown log apart from a different file at the same path.
+    const QString source = QFileInfo(path).canonicalFilePath();
+    const qint64 fileSize = file.size();
+    qint64 resumeOffset = 0;
+    qint64 previousRows = 0;
+    {
+        TracedQuery query(m_db, "TripImporter::importFile");
+        query.prepare("SELECT file_size, head_hash, byte_offset, rows_imported, completed FROM import_progress WHERE source = :source");
+        query.bindValue(":source", source);
+        if (query.exec() && query.next()) {
+            const qint64 recordedSize = query.value(0).toLongLong();
+            const QByteArray recordedHash = query.value(1).toByteArray();
+            const bool completed = query.value(4).toBool();
+            // A file that shrank or starts differently is not the one we saw
+            // before, start over. Progress from older builds has no hash.
+            const bool sameFile = recordedSize <= fileSize
+                && (recordedHash.isEmpty() || recordedHash == headHash(file, recordedSize));
+            if (sameFile) {
+                if (completed && recordedSize == fileSize) {
+                    qInfo() << "File" << source << "was already imported, nothing to do.";
+                    result.ok = true;
+                    return result;
+                }
+                // Unfinished, or finished and appended to since
+                resumeOffset = query.value(2).toLongLong();
+                previousRows = query.value(3).toLongLong();
+            }
+        }
+    }
+    const QByteArray fileHash = headHash(file, fileSize);
+    if (!file.seek(0)) {
+        result.error = QStringLiteral("Cannot read %1: %2").arg(path, file.errorString());
+        qWarning() << "ERROR:" << result.error;
+        return result;
+    }
+
+    // Map file columns onto the INSERT parameters
+    QList<int> csvMapping;
+    if (format == Format::Csv) {
+        QByteArray header;
+        if (!readRecord(file, header, format)) {
+            result.error = QStringLiteral("%1 has no header row").arg(path);
+            qWarning() << "ERROR:" << result.error;
+            return result;
+        }
+        const QStringList names = parseCsvRecord(QString::fromUtf8(header));
+        for (const QString &name : names) {
+            int column = -1;
+            for (int i = 0; i < kColumnCount; ++i) {
+                if (name.trimmed().compare(QLatin1String(kColumns[i]), Qt::CaseInsensitive) == 0) {
+                    column = i;
+                    break;
+                }
+            }
+            csvMapping.append(column);
+        }
+    }
+
+    if (resumeOffset > file.pos()) {
+        file.seek(resumeOffset);
+        result.resumed = true;
+        qInfo() << "Resuming import of" << source << "at byte" << resumeOffset;
+    }
+
+    if (!applyLoadPragmas()) {
+        result.error = QStringLiteral("Cannot apply load pragmas");
+        return result;
+    }
+
+    TracedQuery insert(m_db, "TripImporter::importFile");
+    if (!insert.prepare("INSERT INTO trips (date, duration, driver, location, vehicle, start_battery, end_battery, "
+                        "energy_used, distance_m, avg_speed, notes, favorite, photo, traffic_violations, start_ts, end_ts) "
+                        "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)")) {
+        result.error = insert.lastError().text();
+        qWarning() << "ERROR: Failed to prepare import statement:" << result.error;
+        restorePragmas();
+        return result;
+    }
+
+    TracedQuery checkpoint(m_db, "TripImporter::importFile");
+    checkpoint.prepare("INSERT INTO import_progress (source, file_size, head_hash, byte_offset, rows_imported, completed) "
+                       "VALUES (:source, :size, :hash, :offset, :rows, :completed) "
+                       "ON CONFLICT(source) DO UPDATE SET file_size = excluded.file_size, head_hash = excluded.head_hash, "
+                       "byte_offset = excluded.byte_offset, rows_imported = excluded.rows_imported, "
+                       "completed = excluded.completed");
+
+    QByteArray record;
+    QVariantList values(kColumnCount);
+    bool atEnd = false;
+    result.ok = true;
+
+    while (!atEnd) {
+        if (!m_db.transaction()) {
+            result.ok = false;
+            result.error = m_db.lastError().text();
+            break;
+        }
+
+        int inBatch = 0;
+        while (inBatch < m_batchSize) {
+            if (!readRecord(file, record, format)) {
+                atEnd = true;
+                break;
+            }
+            ++inBatch;
+
+            for (int i = 0; i < kColumnCount; ++i)
+                values[i] = defaultFor(i);
+
+            bool parsed = true;
+            if (format == Format::Csv) {
+                const QStringList fields = parseCsvRecord(QString::fromUtf8(record));
+                for (qsizetype i = 0; i < fields.size() && i < csvMapping.size(); ++i) {
+                    const int column = csvMapping.at(i);
+                    if (column >= 0 && !fields.at(i).isEmpty())
+                        values[column] = fields.at(i);
+                }
+            } else {
+                QJsonParseError error;
+                const QJsonDocument doc = QJsonDocument::fromJson(record, &error);
+                if (error.error != QJsonParseError::NoError || !doc.isObject()) {
+                    parsed = false;
+                } else {
+                    const QJsonObject object = doc.object();
+                    for (int i = 0; i < kColumnCount; ++i) {
+                        const QJsonValue value = object.value(QLatin1String(kColumns[i]));
+                        if (!value.isUndefined() && !value.isNull())
+                            values[i] = value.toVariant();
+                    }
+                }
+            }
+
+            if (!parsed) {
+                ++result.rowsSkipped;
+                continue;
+            }
+
+            fillTimestamps(values);
+            for (int i = 0; i < kColumnCount; ++i)
+                insert.bindValue(i, values.at(i));
+            if (!insert.exec()) {
+                if (result.rowsSkipped < 10)
+                    qWarning() << "Skipping trip row:" << insert.lastError().text();
+                ++result.rowsSkipped;
+                continue;
+            }
+            ++result.rowsImported;
+        }
+
+        // The checkpoint commits together with the rows it describes
+        checkpoint.bindValue(":source", source);
+        checkpoint.bindValue(":size", fileSize);
+        checkpoint.bindValue(":hash", fileHash);
+        checkpoint.bindValue(":offset", file.pos());
+        checkpoint.bindValue(":rows", previousRows + result.rowsImported);
+        checkpoint.bindValue(":completed", atEnd);
+        if (!checkpoint.exec() || !m_db.commit()) {
+            result.ok = false;
+            result.error = checkpoint.lastError().isValid() ? checkpoint.lastError().text() : m_db.lastError().text();
+            qWarning() << "ERROR: Import batch failed, rolling back:" << result.error;
+            m_db.rollback();
+            break;
+        }
+
+        const qint64 elapsed = qMax<qint64>(1, timer.elapsed());
+        emit progress(result.rowsImported, file.pos(), fileSize, result.rowsImported * 1000.0 / elapsed);
+    }
+
+    restorePragmas();
+
+    result.elapsedMs = timer.elapsed();
+    result.rowsPerSecond = result.rowsImported * 1000.0 / qMax<qint64>(1, result.elapsedMs);
+    qInfo() << "Imported" << result.rowsImported << "trips from" << source << "in" << result.elapsedMs << "ms"
+            << "(" << qRound(result.rowsPerSecond) << "rows/s," << result.rowsSkipped << "skipped)";
+    return result;
+}
+
+QByteArray TripImporter::headHash(QFile &file, qint64 size)
+{
+    if (!file.seek(0))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(file.read(qMin(size, kHeadHashBytes)));
+    return hash.result().toHex();
+}
+
+bool TripImporter::applyLoadPragmas()
+{
+    TracedQuery query(m_db, "TripImporter::applyLoadPragmas");
+    if (query.exec("PRAGMA synchronous") && query.next())
+        m_savedSynchronous = query.value(0);
+    if (query.exec("PRAGMA cache_size") && query.next())
+        m_savedCacheSize = query.value(0);
+
+    // WAL stays on after the import, it is the better mode for this app anyway
+    if (!query.exec("PRAGMA journal_mode = WAL")
+        || !query.exec("PRAGMA synchronous = NORMAL")
+        || !query.exec("PRAGMA cache_size = -65536")) { // 64 MiB
+        qWarning() << "ERROR: Failed to apply import pragmas:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+void TripImporter::restorePragmas()
+{
+    TracedQuery query(m_db, "TripImporter::restorePragmas");
+    if (m_savedSynchronous.isValid())
+        query.exec(QStringLiteral("PRAGMA synchronous = %1").arg(m_savedSynchronous.toInt()));
+    if (m_savedCacheSize.isValid())
+        query.exec(QStringLiteral("PRAGMA cache_size = %1").arg(m_savedCacheSize.toInt()));
+}
+
+bool TripImporter::readRecord(QFile &file, QByteArray &record, Format format)
+{
+    record.clear();
+    while (!file.atEnd()) {
+        const QByteArray line = file.readLine();
+        if (record.isEmpty() && line.trimmed().isEmpty())
+            continue;
+        record += line;
+
+        // A quoted CSV field may contain newlines; keep reading until quotes balance
+        if (format == Format::Csv && record.count('"') % 2 != 0)
+            continue;
+        return true;
+    }
+    return !record.isEmpty();
+}
@@ -0,0 +1,61 @@
+#ifndef TRIPIMPORTER_H
+#define TRIPIMPORTER_H
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QVariant>
+
+class QFile;
+
+// Streams trip logs (CSV with a header row, or JSON Lines) into the trips
+// table. One prepared INSERT is reused for the whole file and rows are
+// committed in batches inside explicit transactions. The byte offset of
+// the last committed batch is stored in `import_progress`, so an import
+// that stopped half way resumes from there the next time it is started,
+// and a log that was appended to since imports only the new rows.
+class TripImporter : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Format { Auto, Csv, JsonLines };
+
+    struct Result
+    {
+        bool ok = false;
+        bool resumed = false;
+        qint64 rowsImported = 0;
+        qint64 rowsSkipped = 0;
+        qint64 elapsedMs = 0;
+        double rowsPerSecond = 0.0;
+        QString error;
+
+        QVariantMap toVariantMap() const;
+    };
+
+    explicit TripImporter(QSqlDatabase db, QObject *parent = nullptr);
+
+    void setBatchSize(int batchSize);
+    int batchSize() const { return m_batchSize; }
+
+    Result importFile(const QString &path, Format format = Format::Auto);
+
+signals:
+    // Emitted after every committed batch
+    void progress(qint64 rowsImported, qint64 bytesRead, qint64 bytesTotal, double rowsPerSecond);
+
+private:
+    // Hash of the first bytes of the file, up to `size`
+    static QByteArray headHash(QFile &file, qint64 size);
+    bool applyLoadPragmas();
+    void restorePragmas();
+    bool readRecord(QFile &file, QByteArray &record, Format format);
+
+    static constexpr qint64 kHeadHashBytes = 64 * 1024;
+
+    QSqlDatabase m_db;
+    int m_batchSize = 5000;
+    QVariant m_savedSynchronous;
+    QVariant m_savedCacheSize;
+};
+
+#endif
@@ -0,0 +1,401 @@
+#include "triplistmodel.h"
+#include "querymetrics.h"
+#include "trip.h"
+#include "tripchanges.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QDebug>
+
+namespace {
+
+// Appends the rows of a SELECT id, start_ts, driver, vehicle, notes, favorite
+void readRows(TripPage &page, TracedQuery &query)
+{
+    while (query.next()) {
+        page.ids.append(query.value(0).toLongLong());
+        page.startTs.append(query.value(1).isNull() ? TripListModel::kNullStartTs : query.value(1).toLongLong());
+        page.drivers.append(query.value(2).toString());
+        page.vehicles.append(query.value(3).toString());
+        page.notes.append(query.value(4).toString());
+        page.favorites.append(query.value(5).toBool());
+    }
+}
+
+} // namespace
+
+TripListModel::TripListModel(QObject *parent) : QAbstractListModel(parent)
+{
+}
+
+void TripListModel::setWorker(DatabaseWorker *worker)
+{
+    m_worker = worker;
+    if (m_fromSnapshot)
+        fetchMore(QModelIndex()); // keep the snapshot rows up while the live page loads
+    else
+        reload();
+}
+
+void TripListModel::showSnapshot(const TripPage &page)
+{
+    beginResetModel();
+    ++m_generation;
+    m_atEnd = false;
+    clearRows();
+    endResetModel();
+
+    appendRows(page);
+    m_fromSnapshot = !page.ids.isEmpty();
+}
+
+int TripListModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return int(m_ids.size());
+}
+
+QVariant TripListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_ids.size())
+        return QVariant();
+
+    const int row = index.row();
+    switch (role) {
+    case IdRole:
+        return m_ids.at(row);
+    case NameRole:
+    case Qt::DisplayRole:
+        return m_driverPool.at(m_driverIds.at(row));
+    case StartDateRole:
+        return m_startTs.at(row) == kNullStartTs ? QString() : Trip::formatDateTime(m_startTs.at(row));
+    case VehicleRole:
+        return m_vehiclePool.at(m_vehicleIds.at(row));
+    case NotesRole:
+        return m_notes.at(row);
+    case FavoriteRole:
+        return m_favorites.at(row);
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> TripListModel::roleNames() const
+{
+    // Same keys getTrips() used, so existing delegates keep working
+    return {
+        { IdRole, "id" },
+        { NameRole, "name" },
+        { StartDateRole, "startDate" },
+        { VehicleRole, "vehicle" },
+        { NotesRole, "notes" },
+        { FavoriteRole, "favorite" }
+    };
+}
+
+bool TripListModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return false;
+    return m_worker && !m_atEnd && !m_loading;
+}
+
+void TripListModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent))
+        return;
+
+    // Seek past the last row we hold instead of counting an OFFSET. Snapshot
+    // rows are not trusted yet, so the first live page is fetched again.
+    const bool firstPage = m_fromSnapshot || m_ids.isEmpty();
+    const qint64 afterStartTs = firstPage ? kNullStartTs : m_startTs.last();
+    const qint64 afterId = firstPage ? 0 : m_ids.last();
+    const int limit = m_pageSize;
+    const quint64 generation = m_generation;
+
+    setLoading(true);
+    m_worker->submit([afterStartTs, afterId, limit](QSqlDatabase &db) {
+        return QVariant::fromValue(fetchPage(db, afterStartTs, afterId, limit));
+    }).then(this, [this, generation](const QVariant &result) {
+        appendPage(result.value<TripPage>(), generation);
+    });
+}
+
+void TripListModel::setPageSize(int pageSize)
+{
+    if (pageSize <= 0 || pageSize == m_pageSize)
+        return;
+    m_pageSize = pageSize;
+    emit pageSizeChanged();
+}
+
+void TripListModel::reload()
+{
+    beginResetModel();
+    ++m_generation;
+    m_atEnd = false;
+    m_fromSnapshot = false;
+    clearRows();
+    endResetModel();
+
+    setLoading(false);
+    fetchMore(QModelIndex());
+}
+
+TripPage TripListModel::fetchPage(QSqlDatabase &db, qint64 afterStartTs, qint64 afterId, int limit)
+{
+    TripPage page;
+    page.ids.reserve(limit);
+    page.startTs.reserve(limit);
+    page.drivers.reserve(limit);
+    page.vehicles.reserve(limit);
+    page.notes.reserve(limit);
+    page.favorites.reserve(limit);
+
+    TracedQuery query(db, "TripListModel::fetchPage");
+    query.setForwardOnly(true);
+
+    // Rows with a start_ts, unless the cursor is already among the NULL ones
+    const bool cursorIsNull = afterId > 0 && afterStartTs == kNullStartTs;
+    if (!cursorIsNull) {
+        if (afterId <= 0) {
+            query.prepare("SELECT id, start_ts, driver, vehicle, notes, favorite FROM trips "
+                          "WHERE start_ts IS NOT NULL "
+                          "ORDER BY start_ts DESC, id DESC LIMIT :limit");
+        } else {
+            query.prepare("SELECT id, start_ts, driver, vehicle, notes, favorite FROM trips "
+                          "WHERE (start_ts, id) < (:startTs, :id) "
+                          "ORDER BY start_ts DESC, id DESC LIMIT :limit");
+            query.bindValue(":startTs", afterStartTs);
+            query.bindValue(":id", afterId);
+        }
+        query.bindValue(":limit", limit);
+        if (!query.exec()) {
+            qWarning() << "ERROR: Failed to fetch trip page:" << query.lastError().text();
+            return page;
+        }
+        readRows(page, query);
+        if (page.ids.size() >= limit)
+            return page;
+    }
+
+    // Then the rows without one, which (start_ts, id) < (...) never matches.
+    // A separate seek keeps both on the (start_ts, id) index.
+    query.prepare("SELECT id, start_ts, driver, vehicle, notes, favorite FROM trips "
+                  "WHERE start_ts IS NULL AND id < :id ORDER BY id DESC LIMIT :limit");
+    query.bindValue(":id", cursorIsNull ? afterId : std::numeric_limits<qint64>::max());
+    query.bindValue(":limit", limit - int(page.ids.size()));
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to fetch trip page:" << query.lastError().text();
+        return page;
+    }
+    readRows(page, query);
+    return page;
+}
+
+TripPage TripListModel::fetchRange(QSqlDatabase &db, qint64 firstId, qint64 lastId)
+{
+    TripPage page;
+    TracedQuery query(db, "TripListModel::fetchRange");
+    query.setForwardOnly(true);
+    query.prepare("SELECT id, start_ts, driver, vehicle, notes, favorite FROM trips "
+                  "WHERE id BETWEEN :first AND :last ORDER BY start_ts DESC, id DESC");
+    query.bindValue(":first", firstId);
+    query.bindValue(":last", lastId);
+
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to fetch new trips:" << query.lastError().text();
+        return page;
+    }
+
+    readRows(page, query);
+    return page;
+}
+
+void TripListModel::applyUpdates(const QVariantList &updates)
+{
+    if (updates.isEmpty() || m_ids.isEmpty())
+        return;
+
+    QHash<qint64, QVariantMap> byId;
+    byId.reserve(updates.size());
+    for (const QVariant &update : updates) {
+        const QVariantMap map = update.toMap();
+        byId.insert(map.value("id").toLongLong(), map);
+    }
+
+    // One pass over the ids we hold; rows not loaded yet get the new values
+    // when their page is fetched
+    for (qsizetype row = 0; row < m_ids.size() && !byId.isEmpty(); ++row) {
+        auto it = byId.constFind(m_ids.at(row));
+        if (it == byId.constEnd())
+            continue;
+
+        QList<int> roles;
+        if (it->contains("favorite")) {
+            m_favorites[row] = it->value("favorite").toBool();
+            roles.append(FavoriteRole);
+        }
+        if (it->contains("notes")) {
+            m_notes[row] = it->value("notes").toString();
+            roles.append(NotesRole);
+        }
+        byId.erase(it);
+
+        if (!roles.isEmpty()) {
+            const QModelIndex changed = index(int(row));
+            emit dataChanged(changed, changed, roles);
+        }
+    }
+}
+
+void TripListModel::insertTrips(qint64 firstId, qint64 lastId)
+{
+    if (!m_worker || lastId < firstId)
+        return;
+    if (lastId - firstId + 1 > TripChanges::kMaxDeltaTrips) {
+        reload(); // a bulk import; starting over is cheaper than merging
+        return;
+    }
+
+    // Queued behind any page already in flight, so it merges into that page's rows
+    const quint64 generation = m_generation;
+    m_worker->submit([firstId, lastId](QSqlDatabase &db) {
+        return QVariant::fromValue(fetchRange(db, firstId, lastId));
+    }).then(this, [this, generation](const QVariant &result) {
+        mergeRows(result.value<TripPage>(), generation);
+    });
+}
+
+void TripListModel::appendPage(const TripPage &page, quint64 generation)
+{
+    if (generation != m_generation)
+        return; // a reload happened while this page was in flight
+
+    setLoading(false);
+    const int count = int(page.ids.size());
+    if (count < m_pageSize)
+        m_atEnd = true;
+
+    if (m_fromSnapshot) {
+        // First live page: keep the rows when the snapshot was current,
+        // otherwise swap them in one reset
+        m_fromSnapshot = false;
+        if (rowsMatch(page))
+            return;
+        beginResetModel();
+        clearRows();
+        endResetModel();
+    }
+    appendRows(page);
+}
+
+void TripListModel::appendRows(const TripPage &page)
+{
+    const int count = int(page.ids.size());
+    if (count == 0)
+        return;
+
+    const int first = int(m_ids.size());
+    beginInsertRows(QModelIndex(), first, first + count - 1);
+    m_ids.append(page.ids);
+    m_startTs.append(page.startTs);
+    m_notes.append(page.notes);
+    m_favorites.append(page.favorites);
+    m_driverIds.reserve(first + count);
+    m_vehicleIds.reserve(first + count);
+    for (int i = 0; i < count; ++i) {
+        m_driverIds.append(intern(m_driverPool, m_driverIndex, page.drivers.at(i)));
+        m_vehicleIds.append(intern(m_vehiclePool, m_vehicleIndex, page.vehicles.at(i)));
+    }
+    endInsertRows();
+}
+
+void TripListModel::mergeRows(const TripPage &page, quint64 generation)
+{
+    if (generation != m_generation)
+        return; // the reload fetches these rows anyway
+
+    // List order is (start_ts DESC, id DESC)
+    auto before = [this](qsizetype row, qint64 startTs, qint64 id) {
+        return m_startTs.at(row) > startTs || (m_startTs.at(row) == startTs && m_ids.at(row) > id);
+    };
+
+    for (qsizetype i = 0; i < page.ids.size(); ++i) {
+        const qint64 id = page.ids.at(i);
+        const qint64 startTs = page.startTs.at(i);
+
+        qsizetype low = 0;
+        qsizetype high = m_ids.size();
+        while (low < high) {
+            const qsizetype mid = (low + high) / 2;
+            if (before(mid, startTs, id))
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        // Past the last row held: the next page brings it in
+        if (low == m_ids.size() && !m_atEnd)
+            continue;
+        // Already fetched by a page that ran after the insert
+        if (low < m_ids.size() && m_ids.at(low) == id)
+            continue;
+
+        const int row = int(low);
+        beginInsertRows(QModelIndex(), row, row);
+        m_ids.insert(row, id);
+        m_startTs.insert(row, startTs);
+        m_notes.insert(row, page.notes.at(i));
+        m_favorites.insert(row, page.favorites.at(i));
+        m_driverIds.insert(row, intern(m_driverPool, m_driverIndex, page.drivers.at(i)));
+        m_vehicleIds.insert(row, intern(m_vehiclePool, m_vehicleIndex, page.vehicles.at(i)));
+        endInsertRows();
+    }
+}
+
+void TripListModel::clearRows()
+{
+    m_ids.clear();
+    m_startTs.clear();
+    m_driverIds.clear();
+    m_vehicleIds.clear();
+    m_notes.clear();
+    m_favorites.clear();
+    m_driverPool.clear();
+    m_driverIndex.clear();
+    m_vehiclePool.clear();
+    m_vehicleIndex.clear();
+}
+
+bool TripListModel::rowsMatch(const TripPage &page) const
+{
+    if (page.ids != m_ids || page.startTs != m_startTs || page.notes != m_notes || page.favorites != m_favorites)
+        return false;
+    for (qsizetype i = 0; i < page.ids.size(); ++i) {
+        if (page.drivers.at(i) != m_driverPool.at(m_driverIds.at(i))
+            || page.vehicles.at(i) != m_vehiclePool.at(m_vehicleIds.at(i)))
+            return false;
+    }
+    return true;
+}
+
+quint32 TripListModel::intern(QStringList &pool, QHash<QString, quint32> &index, const QString &value)
+{
+    auto it = index.constFind(value);
+    if (it != index.constEnd())
+        return it.value();
+
+    const quint32 id = quint32(pool.size());
+    pool.append(value);
+    index.insert(value, id);
+    return id;
+}
+
+void TripListModel::setLoading(bool loading)
+{
+    if (m_loading == loading)
+        return;
+    m_loading = loading;
+    emit loadingChanged();
+}
@@ -0,0 +1,115 @@
+#ifndef TRIPLISTMODEL_H
+#define TRIPLISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QPointer>
+#include <QSqlDatabase>
+#include <limits>
+
+#include "databaseworker.h"
+
+// Compact page of trip rows in struct-of-arrays layout, as produced by the
+// worker thread. Driver and vehicle names are not interned yet here.
+struct TripPage
+{
+    QList<qint64> ids;
+    QList<qint64> startTs;
+    QList<QString> drivers;
+    QList<QString> vehicles;
+    QList<QString> notes;
+    QList<bool> favorites;
+};
+Q_DECLARE_METATYPE(TripPage)
+
+// List model for JourneysPage. Rows are fetched in pages with keyset (seek)
+// pagination on (start_ts, id), so every page costs the same no matter how deep
+// the user has scrolled.
+class TripListModel : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(bool loading READ isLoading NOTIFY loadingChanged)
+    Q_PROPERTY(int pageSize READ pageSize WRITE setPageSize NOTIFY pageSizeChanged)
+public:
+    enum Roles {
+        IdRole = Qt::UserRole + 1,
+        NameRole,
+        StartDateRole,
+        VehicleRole,
+        NotesRole,
+        FavoriteRole
+    };
+
+    explicit TripListModel(QObject *parent = nullptr);
+
+    void setWorker(DatabaseWorker *worker);
+    // Shows a page from the startup snapshot until the worker delivers the
+    // live first page; call before setWorker()
+    void showSnapshot(const TripPage &page);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+    bool isLoading() const { return m_loading; }
+    int pageSize() const { return m_pageSize; }
+    void setPageSize(int pageSize);
+
+    // Drops the cache and starts again from the newest trip
+    Q_INVOKABLE void reload();
+
+    // Stands for a NULL start_ts (rows not backfilled yet). It sorts below
+    // every timestamp, as NULL does in SQLite, so those rows come last.
+    static constexpr qint64 kNullStartTs = std::numeric_limits<qint64>::min();
+
+    // Seeks past the row (afterStartTs, afterId); afterId <= 0 starts at the newest trip
+    static TripPage fetchPage(QSqlDatabase &db, qint64 afterStartTs, qint64 afterId, int limit);
+    // Trips with ids in [firstId, lastId], in list order
+    static TripPage fetchRange(QSqlDatabase &db, qint64 firstId, qint64 lastId);
+
+public slots:
+    // Patches favorite/notes of the rows held; see TripChanges::tripUpdate()
+    void applyUpdates(const QVariantList &updates);
+    // Fetches just the new rows and inserts them where they sort
+    void insertTrips(qint64 firstId, qint64 lastId);
+
+signals:
+    void loadingChanged();
+    void pageSizeChanged();
+
+private:
+    void appendPage(const TripPage &page, quint64 generation);
+    void appendRows(const TripPage &page);
+    void mergeRows(const TripPage &page, quint64 generation);
+    void clearRows();
+    bool rowsMatch(const TripPage &page) const;
+    quint32 intern(QStringList &pool, QHash<QString, quint32> &index, const QString &value);
+    void setLoading(bool loading);
+
+    QPointer<DatabaseWorker> m_worker;
+    int m_pageSize = 50;
+    bool m_loading = false;
+    bool m_atEnd = false;
+    bool m_fromSnapshot = false; // rows shown are the snapshot, not yet checked against the database
+    quint64 m_generation = 0; // bumped on reload so stale pages are dropped
+
+    // Row cache, one column per field
+    QList<qint64> m_ids;
+    QList<qint64> m_startTs; // formatted only when a delegate asks
+    QList<quint32> m_driverIds;
+    QList<quint32> m_vehicleIds;
+    QList<QString> m_notes;
+    QList<bool> m_favorites;
+
+    // Interned strings, shared by every row that uses them
+    QStringList m_driverPool;
+    QHash<QString, quint32> m_driverIndex;
+    QStringList m_vehiclePool;
+    QHash<QString, quint32> m_vehicleIndex;
+};
+
+#endif
@@ -0,0 +1,481 @@
+#include "triprollups.h"
+#include "querymetrics.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QElapsedTimer>
+#include <QDebug>
+
+const QStringList TripRollups::kMetrics = {
+    "tripCount", "distance", "duration", "energy", "violations", "favorites", "efficiency"
+};
+
+namespace {
+
+struct Granularity
+{
+    const char *table;
+    // Start of the bucket a trip falls into; %1 is the row alias
+    const char *bucket;
+};
+
+// Buckets are local calendar days, weeks and months, as the trips are shown
+const Granularity kDaily { "rollup_daily", "date(%1.start_ts, 'unixepoch', 'localtime')" };
+const Granularity kWeekly { "rollup_weekly", "date(%1.start_ts, 'unixepoch', 'localtime', 'weekday 0', '-6 days')" };
+const Granularity kMonthly { "rollup_monthly", "date(%1.start_ts, 'unixepoch', 'localtime', 'start of month')" };
+const Granularity *const kGranularities[] = { &kDaily, &kWeekly, &kMonthly };
+
+QString bucketOf(const Granularity &granularity, const QString &alias)
+{
+    return QStringLiteral("IFNULL(%1, '')").arg(QString::fromLatin1(granularity.bucket).arg(alias));
+}
+
+QString addRowStatement(const Granularity &granularity)
+{
+    return QStringLiteral(
+        "INSERT INTO %1 (bucket, driver, vehicle, trip_count, total_distance, total_duration, total_energy, "
+        "total_violations, favorite_count) "
+        "VALUES (%2, IFNULL(NEW.driver, ''), IFNULL(NEW.vehicle, ''), 1, IFNULL(NEW.distance_m, 0), "
+        "IFNULL(NEW.duration, 0), IFNULL(NEW.energy_used, 0), IFNULL(NEW.traffic_violations, 0), IFNULL(NEW.favorite = 1, 0)) "
+        "ON CONFLICT(bucket, driver, vehicle) DO UPDATE SET "
+        "trip_count = trip_count + 1, "
+        "total_distance = total_distance + excluded.total_distance, "
+        "total_duration = total_duration + excluded.total_duration, "
+        "total_energy = total_energy + excluded.total_energy, "
+        "total_violations = total_violations + excluded.total_violations, "
+        "favorite_count = favorite_count + excluded.favorite_count; ")
+        .arg(granularity.table, bucketOf(granularity, "NEW"));
+}
+
+QString removeRowStatements(const Granularity &granularity)
+{
+    const QString key = QStringLiteral("bucket = %1 AND driver = IFNULL(OLD.driver, '') AND vehicle = IFNULL(OLD.vehicle, '')")
+                            .arg(bucketOf(granularity, "OLD"));
+    return QStringLiteral(
+        "UPDATE %1 SET "
+        "trip_count = trip_count - 1, "
+        "total_distance = total_distance - IFNULL(OLD.distance_m, 0), "
+        "total_duration = total_duration - IFNULL(OLD.duration, 0), "
+        "total_energy = total_energy - IFNULL(OLD.energy_used, 0), "
+        "total_violations = total_violations - IFNULL(OLD.traffic_violations, 0), "
+        "favorite_count = favorite_count - IFNULL(OLD.favorite = 1, 0) "
+        "WHERE %2; "
+        "DELETE FROM %1 WHERE %2 AND trip_count <= 0; ")
+        .arg(granularity.table, key);
+}
+
+bool execAll(QSqlDatabase &db, const QStringList &statements)
+{
+    TracedQuery query(db, "TripRollups::execAll");
+    for (const QString &statement : statements) {
+        if (!query.exec(statement)) {
+            qWarning() << "ERROR: Trip rollup statement failed:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Grouped trips per bucket, driver and vehicle, in the rollup columns;
+// `where` narrows the scanned trips
+QString scanSelect(const Granularity &granularity, const QString &where = QString())
+{
+    return QStringLiteral(
+               "SELECT %1, IFNULL(driver, ''), IFNULL(vehicle, ''), COUNT(*), TOTAL(distance_m), "
+               "TOTAL(duration), TOTAL(energy_used), TOTAL(traffic_violations), TOTAL(favorite = 1) "
+               "FROM trips %2 GROUP BY 1, 2, 3")
+        .arg(bucketOf(granularity, "trips"), where);
+}
+
+QStringList fillStatements()
+{
+    QStringList statements;
+    for (const Granularity *granularity : kGranularities) {
+        statements << QStringLiteral("DELETE FROM %1").arg(granularity->table)
+                   << QStringLiteral(
+                          "INSERT INTO %1 (bucket, driver, vehicle, trip_count, total_distance, total_duration, "
+                          "total_energy, total_violations, favorite_count) %2")
+                          .arg(granularity->table, scanSelect(*granularity));
+    }
+    return statements;
+}
+
+// A run of days answered by one rollup table. For the weekly and monthly
+// tables `from` and `to` are bucket starts.
+struct Segment
+{
+    const Granularity *granularity;
+    QDate from;
+    QDate to;
+};
+
+// Whole Monday-to-Sunday weeks from the weekly table, the ragged ends from the daily one
+void planWeeksAndDays(const QDate &from, const QDate &to, QList<Segment> &segments)
+{
+    const QDate firstMonday = from.addDays((8 - from.dayOfWeek()) % 7);
+    const QDate lastSunday = to.addDays(-(to.dayOfWeek() % 7));
+    if (firstMonday > lastSunday) {
+        segments.append({ &kDaily, from, to });
+        return;
+    }
+    if (from < firstMonday)
+        segments.append({ &kDaily, from, firstMonday.addDays(-1) });
+    segments.append({ &kWeekly, firstMonday, lastSunday.addDays(-6) });
+    if (lastSunday < to)
+        segments.append({ &kDaily, lastSunday.addDays(1), to });
+}
+
+// Coarsest buckets covering [from, to] whose labels stay exact for `period`
+QList<Segment> planSegments(const QDate &from, const QDate &to, TripRollups::Period period)
+{
+    using TripRollups::Period;
+    QList<Segment> segments;
+    if (period == Period::Day) {
+        segments.append({ &kDaily, from, to });
+        return segments;
+    }
+    if (period == Period::Week) {
+        planWeeksAndDays(from, to, segments);
+        return segments;
+    }
+
+    // Split at month boundaries so no week bucket straddles two months
+    QDate monthsFrom;
+    QDate monthsTo;
+    for (QDate start = from; start <= to;) {
+        const QDate monthStart(start.year(), start.month(), 1);
+        const QDate monthEnd = monthStart.addMonths(1).addDays(-1);
+        const QDate end = qMin(monthEnd, to);
+        if (start == monthStart && end == monthEnd) {
+            if (!monthsFrom.isValid())
+                monthsFrom = monthStart;
+            monthsTo = monthStart;
+        } else {
+            planWeeksAndDays(start, end, segments);
+        }
+        start = end.addDays(1);
+    }
+    if (monthsFrom.isValid())
+        segments.append({ &kMonthly, monthsFrom, monthsTo });
+    return segments;
+}
+
+QString periodLabel(const Segment &segment, TripRollups::Period period)
+{
+    using TripRollups::Period;
+    switch (period) {
+    case Period::Day:
+        return "bucket";
+    case Period::Week:
+        return segment.granularity == &kDaily ? "date(bucket, 'weekday 0', '-6 days')" : "bucket";
+    case Period::Month:
+        return "substr(bucket, 1, 7)";
+    case Period::All:
+        break;
+    }
+    return "''";
+}
+
+QString dateKey(const QDate &date)
+{
+    return date.toString(Qt::ISODate);
+}
+
+} // namespace
+
+TripRollups::RangeQuery TripRollups::RangeQuery::fromVariantMap(const QVariantMap &map)
+{
+    RangeQuery query;
+    query.from = QDate::fromString(map.value("from").toString().left(10), Qt::ISODate);
+    query.to = QDate::fromString(map.value("to").toString().left(10), Qt::ISODate);
+    if (map.contains("lastDays")) {
+        query.to = QDate::currentDate();
+        query.from = query.to.addDays(1 - qMax(1, map.value("lastDays").toInt()));
+    }
+
+    const QString period = map.value("period").toString();
+    if (period == "day")
+        query.period = Period::Day;
+    else if (period == "week")
+        query.period = Period::Week;
+    else if (period == "month")
+        query.period = Period::Month;
+
+    const QString groupBy = map.value("groupBy").toString();
+    if (groupBy == "driver")
+        query.groupBy = GroupBy::Driver;
+    else if (groupBy == "vehicle")
+        query.groupBy = GroupBy::Vehicle;
+
+    query.driver = map.value("driver").toString();
+    query.vehicle = map.value("vehicle").toString();
+    query.metrics = map.value("metrics").toStringList();
+    return query;
+}
+
+bool TripRollups::createTables(QSqlDatabase &db)
+{
+    QStringList statements;
+    for (const Granularity *granularity : kGranularities) {
+        statements << QStringLiteral(
+                          "CREATE TABLE IF NOT EXISTS %1 ("
+                          "bucket TEXT NOT NULL, "
+                          "driver TEXT NOT NULL, "
+                          "vehicle TEXT NOT NULL, "
+                          "trip_count INTEGER NOT NULL DEFAULT 0, "
+                          "total_distance REAL NOT NULL DEFAULT 0, "
+                          "total_duration INTEGER NOT NULL DEFAULT 0, "
+                          "total_energy REAL NOT NULL DEFAULT 0, "
+                          "total_violations INTEGER NOT NULL DEFAULT 0, "
+                          "favorite_count INTEGER NOT NULL DEFAULT 0, "
+                          "PRIMARY KEY (bucket, driver, vehicle)) WITHOUT ROWID")
+                          .arg(granularity->table);
+    }
+    return execAll(db, statements);
+}
+
+bool TripRollups::install(QSqlDatabase &db)
+{
+    // Triggers from an older bucket definition are replaced, then all rows refilled
+    QStringList statements = {
+        "DROP TRIGGER IF EXISTS trips_rollup_insert",
+        "DROP TRIGGER IF EXISTS trips_rollup_delete",
+        "DROP TRIGGER IF EXISTS trips_rollup_update"
+    };
+
+    QString addRows;
+    QString removeRows;
+    for (const Granularity *granularity : kGranularities) {
+        addRows += addRowStatement(*granularity);
+        removeRows += removeRowStatements(*granularity);
+    }
+    statements << "CREATE TRIGGER IF NOT EXISTS trips_rollup_insert AFTER INSERT ON trips BEGIN " + addRows + "END"
+               << "CREATE TRIGGER IF NOT EXISTS trips_rollup_delete AFTER DELETE ON trips BEGIN " + removeRows + "END"
+               << "CREATE TRIGGER IF NOT EXISTS trips_rollup_update "
+                  "AFTER UPDATE OF start_ts, driver, vehicle, distance_m, duration, energy_used, favorite, traffic_violations "
+                  "ON trips BEGIN " + removeRows + addRows + "END";
+
+    for (const Granularity *granularity : kGranularities)
+        statements << QStringLiteral("DELETE FROM %1").arg(granularity->table);
+
+    return createTables(db) && execAll(db, statements);
+}
+
+bool TripRollups::fill(QSqlDatabase &db, int chunkRows)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    TracedQuery query(db, "TripRollups::fill");
+    // Same id-range walk as the backfills in schemamigrations.cpp. Without
+    // the range the rollups would stay empty, so a failed read is an error.
+    if (!query.exec("SELECT IFNULL(MAX(id), 0) FROM trips") || !query.next()) {
+        qWarning() << "ERROR: Failed to read the trip id range:" << query.lastError().text();
+        return false;
+    }
+    const qint64 maxId = query.value(0).toLongLong();
+    query.finish();
+
+    // Chunks add to the buckets earlier chunks created
+    QStringList inserts;
+    for (const Granularity *granularity : kGranularities) {
+        inserts << QStringLiteral(
+                       "INSERT INTO %1 (bucket, driver, vehicle, trip_count, total_distance, total_duration, "
+                       "total_energy, total_violations, favorite_count) %2 "
+                       "ON CONFLICT(bucket, driver, vehicle) DO UPDATE SET "
+                       "trip_count = trip_count + excluded.trip_count, "
+                       "total_distance = total_distance + excluded.total_distance, "
+                       "total_duration = total_duration + excluded.total_duration, "
+                       "total_energy = total_energy + excluded.total_energy, "
+                       "total_violations = total_violations + excluded.total_violations, "
+                       "favorite_count = favorite_count + excluded.favorite_count")
+                       .arg(granularity->table, scanSelect(*granularity, "WHERE id > :from AND id <= :to"));
+    }
+
+    for (qint64 from = 0; from < maxId; from += chunkRows) {
+        if (!db.transaction()) {
+            qWarning() << "ERROR: Failed to start trip rollup chunk:" << db.lastError().text();
+            return false;
+        }
+        for (const QString &insert : std::as_const(inserts)) {
+            query.prepare(insert);
+            query.bindValue(":from", from);
+            query.bindValue(":to", from + chunkRows);
+            if (!query.exec()) {
+                qWarning() << "ERROR: Trip rollup chunk failed:" << query.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        if (!db.commit()) {
+            qWarning() << "ERROR: Failed to commit trip rollup chunk:" << db.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    qInfo() << "Trip rollups filled up to trip" << maxId << "in" << timer.elapsed() << "ms.";
+    return true;
+}
+
+bool TripRollups::rebuild(QSqlDatabase &db)
+{
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start trip rollup rebuild:" << db.lastError().text();
+        return false;
+    }
+    if (!execAll(db, fillStatements()) || !db.commit()) {
+        qWarning() << "ERROR: Failed to rebuild trip rollups:" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    qInfo() << "Trip rollups rebuilt from trips table.";
+    return true;
+}
+
+bool TripRollups::verify(QSqlDatabase &db, bool repair)
+{
+    // Scan and compare inside one read transaction so they see the same data
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start trip rollup check:" << db.lastError().text();
+        return false;
+    }
+
+    int mismatches = 0;
+    TracedQuery query(db, "TripRollups::verify");
+    for (const Granularity *granularity : kGranularities) {
+        const QString table = QStringLiteral(
+                                  "SELECT bucket, driver, vehicle, trip_count, ROUND(total_distance, 3), total_duration, "
+                                  "ROUND(total_energy, 3), total_violations, favorite_count FROM %1")
+                                  .arg(granularity->table);
+        const QString scan = "SELECT c1, c2, c3, c4, ROUND(c5, 3), c6, ROUND(c7, 3), c8, c9 FROM temp.rollup_scan";
+        const QStringList statements = {
+            "DROP TABLE IF EXISTS temp.rollup_scan",
+            "CREATE TEMP TABLE rollup_scan (c1, c2, c3, c4, c5, c6, c7, c8, c9)",
+            "INSERT INTO temp.rollup_scan " + scanSelect(*granularity),
+            "SELECT COUNT(*) FROM (" + table + " EXCEPT " + scan + ")",
+            "SELECT COUNT(*) FROM (" + scan + " EXCEPT " + table + ")"
+        };
+        for (const QString &sql : statements) {
+            if (!query.exec(sql)) {
+                qWarning() << "ERROR: Trip rollup check failed:" << query.lastError().text();
+                db.rollback();
+                return false;
+            }
+            if (query.next())
+                mismatches += query.value(0).toInt();
+        }
+    }
+    query.exec("DROP TABLE IF EXISTS temp.rollup_scan");
+    query.finish();
+    db.commit();
+
+    if (mismatches == 0)
+        return true;
+
+    qWarning() << "Trip rollups are out of date," << mismatches << "rows differ from the trips table.";
+    return repair && rebuild(db);
+}
+
+QVariantMap TripRollups::query(QSqlDatabase &db, const RangeQuery &range)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QVariantMap result;
+
+    QDate from = range.from;
+    QDate to = range.to;
+    if (!from.isValid() || !to.isValid()) {
+        TracedQuery bounds(db, "TripRollups::query");
+        if (bounds.exec("SELECT MIN(bucket), MAX(bucket) FROM rollup_daily WHERE bucket <> ''") && bounds.next()) {
+            if (!from.isValid())
+                from = QDate::fromString(bounds.value(0).toString(), Qt::ISODate);
+            if (!to.isValid())
+                to = QDate::fromString(bounds.value(1).toString(), Qt::ISODate);
+        }
+    }
+    result["rows"] = QVariantList();
+    if (!from.isValid() || !to.isValid() || from > to)
+        return result; // no trips in range
+
+    const QList<Segment> segments = planSegments(from, to, range.period);
+    const QString key = range.groupBy == GroupBy::Driver ? "driver"
+                        : range.groupBy == GroupBy::Vehicle ? "vehicle" : "''";
+
+    QStringList selects;
+    QVariantList segmentInfo;
+    for (qsizetype i = 0; i < segments.size(); ++i) {
+        const Segment &segment = segments.at(i);
+        QString select = QStringLiteral(
+                             "SELECT %1 AS period, %2 AS key, trip_count, total_distance, total_duration, total_energy, "
+                             "total_violations, favorite_count FROM %3 WHERE bucket BETWEEN :from%4 AND :to%4")
+                             .arg(periodLabel(segment, range.period), key, segment.granularity->table)
+                             .arg(i);
+        if (!range.driver.isEmpty())
+            select += " AND driver = :driver";
+        if (!range.vehicle.isEmpty())
+            select += " AND vehicle = :vehicle";
+        selects << select;
+
+        QVariantMap info;
+        info["table"] = segment.granularity->table;
+        info["from"] = dateKey(segment.from);
+        info["to"] = dateKey(segment.to);
+        segmentInfo.append(info);
+    }
+
+    TracedQuery query(db, "TripRollups::query");
+    query.setForwardOnly(true);
+    query.prepare("SELECT period, key, SUM(trip_count), SUM(total_distance), SUM(total_duration), SUM(total_energy), "
+                  "SUM(total_violations), SUM(favorite_count), COUNT(*) FROM (" + selects.join(" UNION ALL ")
+                  + ") GROUP BY period, key ORDER BY period, key");
+    for (qsizetype i = 0; i < segments.size(); ++i) {
+        query.bindValue(QStringLiteral(":from%1").arg(i), dateKey(segments.at(i).from));
+        query.bindValue(QStringLiteral(":to%1").arg(i), dateKey(segments.at(i).to));
+    }
+    if (!range.driver.isEmpty())
+        query.bindValue(":driver", range.driver);
+    if (!range.vehicle.isEmpty())
+        query.bindValue(":vehicle", range.vehicle);
+
+    if (!query.exec()) {
+        qWarning() << "ERROR: Failed to query trip rollups:" << query.lastError().text();
+        return result;
+    }
+
+    const QStringList &metrics = range.metrics.isEmpty() ? kMetrics : range.metrics;
+    QVariantList rows;
+    qint64 rowsRead = 0;
+    while (query.next()) {
+        const double distanceKm = query.value(3).toDouble() / 1000.0;
+        const double energy = query.value(5).toDouble();
+        QVariantMap row;
+        row["period"] = query.value(0).toString();
+        row["key"] = query.value(1).toString();
+        for (const QString &metric : metrics) {
+            if (metric == "tripCount")
+                row[metric] = query.value(2).toLongLong();
+            else if (metric == "distance")
+                row[metric] = distanceKm;
+            else if (metric == "duration")
+                row[metric] = query.value(4).toLongLong();
+            else if (metric == "energy")
+                row[metric] = energy;
+            else if (metric == "violations")
+                row[metric] = query.value(6).toLongLong();
+            else if (metric == "favorites")
+                row[metric] = query.value(7).toLongLong();
+            else if (metric == "efficiency")
+                row[metric] = distanceKm > 0 ? energy / distanceKm : 0.0;
+        }
+        rowsRead += query.value(8).toLongLong();
+        rows.append(row);
+    }
+
+    result["rows"] = rows;
+    result["from"] = dateKey(from);
+    result["to"] = dateKey(to);
+    result["segments"] = segmentInfo;
+    result["rollupRowsRead"] = rowsRead;
+    result["elapsedMs"] = timer.nsecsElapsed() / 1e6;
+    return result;
+}
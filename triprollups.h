@@ -0,0 +1,62 @@
+#ifndef TRIPROLLUPS_H
+#define TRIPROLLUPS_H
+
+#include <QDate>
+#include <QSqlDatabase>
+#include <QStringList>
+#include <QVariant>
+
+// Daily, weekly (Monday based) and monthly rollups of the trip metrics per
+// driver and vehicle. Like the fleet summary they are maintained by
+// triggers on `trips`, so a range query reads a few rollup rows per bucket
+// instead of the trips themselves.
+namespace TripRollups
+{
+    enum class Period { All, Day, Week, Month };
+    enum class GroupBy { None, Driver, Vehicle };
+
+    struct RangeQuery
+    {
+        QDate from;            // inclusive; invalid means the first trip
+        QDate to;              // inclusive; invalid means the last trip
+        Period period = Period::All;
+        GroupBy groupBy = GroupBy::None;
+        QString driver;        // optional filters
+        QString vehicle;
+        QStringList metrics;   // empty means all of kMetrics
+
+        // Keys: from, to ("yyyy-MM-dd"), lastDays, period ("all", "day",
+        // "week", "month"), groupBy ("none", "driver", "vehicle"), driver,
+        // vehicle and metrics (a list of kMetrics names)
+        static RangeQuery fromVariantMap(const QVariantMap &map);
+    };
+
+    // tripCount, distance (km), duration (min), energy, violations,
+    // favorites and efficiency (energy per km)
+    extern const QStringList kMetrics;
+
+    // Creates the (empty) rollup tables
+    bool createTables(QSqlDatabase &db);
+
+    // Creates the tables if needed, (re)creates the triggers and empties
+    // the rollups; fill() then adds the existing trips. Buckets come from
+    // trips.start_ts.
+    bool install(QSqlDatabase &db);
+
+    // Adds the trips to empty rollups `chunkRows` ids at a time, committing
+    // every chunk so a large table never holds one huge transaction
+    bool fill(QSqlDatabase &db, int chunkRows);
+
+    // Recomputes every rollup with one grouped scan per granularity
+    bool rebuild(QSqlDatabase &db);
+
+    // Compares every rollup with a grouped scan of `trips`. Returns true when
+    // they match, or when they did not and `repair` rebuilt them successfully.
+    bool verify(QSqlDatabase &db, bool repair = true);
+
+    // Result keys: rows (period, key and the requested metrics), from, to,
+    // segments (which rollup answered which days), rollupRowsRead and elapsedMs
+    QVariantMap query(QSqlDatabase &db, const RangeQuery &query);
+}
+
+#endif
@@ -0,0 +1,358 @@
+#include "tripsearch.h"
+#include "querymetrics.h"
+#include "trip.h"
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QElapsedTimer>
+#include <QDate>
+#include <QDateTime>
+#include <QRegularExpression>
+#include <QMutexLocker>
+#include <QDebug>
+#ifdef DIGITALTRIPBOOK_SQLITE_INTERRUPT
+#include <QSqlDriver>
+#include <sqlite3.h>
+#endif
+
+namespace {
+
+// Maximum number of values returned per facet
+constexpr int kFacetValues = 20;
+
+// bm25 column weights: notes, location, driver
+const char *const kRankExpression = "bm25(trips_fts, 4.0, 2.0, 1.0)";
+
+enum Skip {
+    SkipNone = 0,
+    SkipDriver = 1,
+    SkipVehicle = 2,
+    SkipFavorites = 4
+};
+
+// FROM and WHERE for the matched set, with each facet able to leave out its own filter
+struct Filter
+{
+    QString from;
+    QStringList clauses;
+    QList<QPair<QString, QVariant>> binds;
+
+    QString sql() const
+    {
+        return from + (clauses.isEmpty() ? QString() : " WHERE " + clauses.join(" AND "));
+    }
+
+    void bindTo(TracedQuery &query) const
+    {
+        for (const auto &[name, value] : binds)
+            query.bindValue(name, value);
+    }
+};
+
+Filter buildFilter(const TripSearch::Query &query, const QString &match, int skip)
+{
+    Filter filter;
+    if (match.isEmpty()) {
+        filter.from = "FROM trips t";
+    } else {
+        filter.from = "FROM trips_fts JOIN trips t ON t.id = trips_fts.rowid";
+        filter.clauses << "trips_fts MATCH :match";
+        filter.binds.append({ ":match", match });
+    }
+    if (!query.driver.isEmpty() && !(skip & SkipDriver)) {
+        filter.clauses << "t.driver = :driver";
+        filter.binds.append({ ":driver", query.driver });
+    }
+    if (!query.vehicle.isEmpty() && !(skip & SkipVehicle)) {
+        filter.clauses << "t.vehicle = :vehicle";
+        filter.binds.append({ ":vehicle", query.vehicle });
+    }
+    // Local calendar days, turned into a half-open start_ts range on the index
+    const QDate fromDate = QDate::fromString(query.fromDate.left(10), Qt::ISODate);
+    const QDate toDate = QDate::fromString(query.toDate.left(10), Qt::ISODate);
+    if (fromDate.isValid()) {
+        filter.clauses << "t.start_ts >= :fromTs";
+        filter.binds.append({ ":fromTs", fromDate.startOfDay().toSecsSinceEpoch() });
+    }
+    if (toDate.isValid()) {
+        filter.clauses << "t.start_ts < :toTs";
+        filter.binds.append({ ":toTs", toDate.addDays(1).startOfDay().toSecsSinceEpoch() });
+    }
+    if (query.favoritesOnly && !(skip & SkipFavorites))
+        filter.clauses << "t.favorite = 1";
+    return filter;
+}
+
+// Statements aborted by TripSearch::Interrupter fail with SQLITE_INTERRUPT
+bool wasInterrupted(const TracedQuery &query)
+{
+    return query.lastError().nativeErrorCode() == QLatin1String("9");
+}
+
+// Counts rows of the filtered set, stopping at kCountLimit
+qint64 countMatches(QSqlDatabase &db, const Filter &filter)
+{
+    TracedQuery query(db, "TripSearch::count");
+    query.prepare("SELECT COUNT(*) FROM (SELECT 1 " + filter.sql() + " LIMIT :cap)");
+    filter.bindTo(query);
+    query.bindValue(":cap", TripSearch::kCountLimit);
+    if (query.exec() && query.next())
+        return query.value(0).toLongLong();
+    if (!wasInterrupted(query))
+        qWarning() << "ERROR: Failed to count search matches:" << query.lastError().text();
+    return 0;
+}
+
+// Rows are value and count, plus the size of the counted set when
+// `lowerBound` is wanted; a set cut off at kCountLimit gives lower bounds
+QVariantList facetFromQuery(TracedQuery &query, bool *lowerBound = nullptr)
+{
+    QVariantList values;
+    if (lowerBound)
+        *lowerBound = false;
+    if (!query.exec()) {
+        if (!wasInterrupted(query))
+            qWarning() << "ERROR: Failed to compute search facet:" << query.lastError().text();
+        return values;
+    }
+    while (query.next()) {
+        QVariantMap entry;
+        entry["value"] = query.value(0).toString();
+        entry["count"] = query.value(1).toLongLong();
+        values.append(entry);
+        if (lowerBound)
+            *lowerBound = query.value(2).toLongLong() >= TripSearch::kCountLimit;
+    }
+    return values;
+}
+
+// Value counts of `column` over the first kCountLimit rows of the filtered set
+QVariantList facet(QSqlDatabase &db, const Filter &filter, const QString &column, bool *lowerBound)
+{
+    TracedQuery query(db, "TripSearch::facet");
+    // The window sum runs before LIMIT, so it is the number of rows counted
+    query.prepare(QStringLiteral("SELECT value, COUNT(*), SUM(COUNT(*)) OVER () "
+                                 "FROM (SELECT IFNULL(t.%1, '') AS value %2 LIMIT :cap) "
+                                 "GROUP BY value ORDER BY 2 DESC, 1 LIMIT :values")
+                      .arg(column, filter.sql()));
+    filter.bindTo(query);
+    query.bindValue(":cap", TripSearch::kCountLimit);
+    query.bindValue(":values", kFacetValues);
+    return facetFromQuery(query, lowerBound);
+}
+
+// Facet straight from a FleetSummary rollup when nothing else narrows the set
+QVariantList facetFromSummary(QSqlDatabase &db, const QString &table, const QString &column)
+{
+    TracedQuery query(db, "TripSearch::facet");
+    query.prepare(QStringLiteral("SELECT %1, trip_count FROM %2 ORDER BY 2 DESC, 1 LIMIT :values").arg(column, table));
+    query.bindValue(":values", kFacetValues);
+    return facetFromQuery(query);
+}
+
+} // namespace
+
+TripSearch::Query TripSearch::Query::fromVariantMap(const QVariantMap &map)
+{
+    Query query;
+    query.text = map.value("text").toString();
+    query.driver = map.value("driver").toString();
+    query.vehicle = map.value("vehicle").toString();
+    query.fromDate = map.value("fromDate").toString();
+    query.toDate = map.value("toDate").toString();
+    query.favoritesOnly = map.value("favoritesOnly").toBool();
+    if (map.contains("limit"))
+        query.limit = qBound(1, map.value("limit").toInt(), 500);
+    return query;
+}
+
+bool TripSearch::Query::hasFilters() const
+{
+    return !driver.isEmpty() || !vehicle.isEmpty() || !fromDate.isEmpty() || !toDate.isEmpty() || favoritesOnly;
+}
+
+bool TripSearch::install(QSqlDatabase &db)
+{
+    // External content table: the index stores only tokens, the text stays in `trips`.
+    // The prefix indexes make "ab*" and "abc*" lookups direct instead of term scans.
+    const QStringList statements = {
+        "CREATE VIRTUAL TABLE IF NOT EXISTS trips_fts USING fts5("
+        "notes, location, driver, "
+        "content='trips', content_rowid='id', "
+        "tokenize='unicode61 remove_diacritics 2', prefix='2 3')",
+        "CREATE TRIGGER IF NOT EXISTS trips_fts_insert AFTER INSERT ON trips BEGIN "
+        "INSERT INTO trips_fts (rowid, notes, location, driver) VALUES (NEW.id, NEW.notes, NEW.location, NEW.driver); "
+        "END",
+        "CREATE TRIGGER IF NOT EXISTS trips_fts_delete AFTER DELETE ON trips BEGIN "
+        "INSERT INTO trips_fts (trips_fts, rowid, notes, location, driver) VALUES ('delete', OLD.id, OLD.notes, OLD.location, OLD.driver); "
+        "END",
+        "CREATE TRIGGER IF NOT EXISTS trips_fts_update AFTER UPDATE OF notes, location, driver ON trips BEGIN "
+        "INSERT INTO trips_fts (trips_fts, rowid, notes, location, driver) VALUES ('delete', OLD.id, OLD.notes, OLD.location, OLD.driver); "
+        "INSERT INTO trips_fts (rowid, notes, location, driver) VALUES (NEW.id, NEW.notes, NEW.location, NEW.driver); "
+        "END",
+        // Index the rows that existed before the triggers
+        "INSERT INTO trips_fts (trips_fts) VALUES ('rebuild')"
+    };
+
+    TracedQuery query(db, "TripSearch::install");
+    for (const QString &statement : statements) {
+        if (!query.exec(statement)) {
+            qWarning() << "ERROR: Failed to set up trip search index:" << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+QString TripSearch::matchExpression(const QString &text)
+{
+    static const QRegularExpression separators(QStringLiteral("\\s+"));
+    QStringList terms;
+    for (QString term : text.split(separators, Qt::SkipEmptyParts)) {
+        term.replace(u'"', QStringLiteral("\"\""));
+        // Quoting keeps operators and punctuation literal; '*' makes it a prefix
+        terms << QStringLiteral("\"%1\"*").arg(term);
+    }
+    return terms.join(u' ');
+}
+
+QVariantMap TripSearch::search(QSqlDatabase &db, const Query &query, const CancelCheck &cancelled)
+{
+    QElapsedTimer timer;
+    timer.start();
+    auto isCancelled = [&cancelled]() { return cancelled && cancelled(); };
+
+    const QString match = matchExpression(query.text);
+    const Filter filter = buildFilter(query, match, SkipNone);
+
+    QVariantList results;
+    {
+        TracedQuery select(db, "TripSearch::results");
+        select.setForwardOnly(true);
+        const QString columns = "SELECT t.id, t.start_ts, t.driver, t.vehicle, t.location, t.notes, t.favorite, ";
+        if (match.isEmpty()) {
+            select.prepare(columns + "'' " + filter.sql() + " ORDER BY t.start_ts DESC, t.id DESC LIMIT :limit");
+        } else {
+            select.prepare(columns + "snippet(trips_fts, 0, '<b>', '</b>', '…', 8) " + filter.sql()
+                           + " ORDER BY " + kRankExpression + " LIMIT :limit");
+        }
+        filter.bindTo(select);
+        select.bindValue(":limit", query.limit);
+        if (!select.exec()) {
+            if (!wasInterrupted(select))
+                qWarning() << "ERROR: Trip search failed:" << select.lastError().text();
+            return QVariantMap();
+        }
+        while (select.next()) {
+            QVariantMap trip;
+            trip["id"] = select.value(0).toInt();
+            trip["startDate"] = Trip::formatDateTime(select.value(1).toLongLong());
+            trip["name"] = select.value(2).toString();
+            trip["vehicle"] = select.value(3).toString();
+            trip["location"] = select.value(4).toString();
+            trip["notes"] = select.value(5).toString();
+            trip["favorite"] = select.value(6).toBool();
+            trip["snippet"] = select.value(7).toString();
+            results.append(trip);
+        }
+    }
+
+    if (isCancelled())
+        return QVariantMap();
+
+    // Without text or filters the rollups already hold every count
+    const bool unfiltered = match.isEmpty() && !query.hasFilters();
+    const bool onlyDriverFilter = match.isEmpty() && query.vehicle.isEmpty() && query.fromDate.isEmpty()
+                                  && query.toDate.isEmpty() && !query.favoritesOnly;
+    const bool onlyVehicleFilter = match.isEmpty() && query.driver.isEmpty() && query.fromDate.isEmpty()
+                                   && query.toDate.isEmpty() && !query.favoritesOnly;
+
+    qint64 total = 0;
+    if (unfiltered) {
+        TracedQuery count(db, "TripSearch::count");
+        if (count.exec("SELECT trip_count FROM fleet_summary WHERE id = 1") && count.next())
+            total = count.value(0).toLongLong();
+    } else {
+        total = countMatches(db, filter);
+    }
+
+    if (isCancelled())
+        return QVariantMap();
+
+    // Each facet ignores its own filter so the other choices stay visible.
+    // Summary facets are exact; counted ones are lower bounds once capped.
+    QVariantMap facets;
+    bool driversAreLowerBound = false;
+    facets["drivers"] = onlyDriverFilter ? facetFromSummary(db, "driver_summary", "driver")
+                                         : facet(db, buildFilter(query, match, SkipDriver), "driver", &driversAreLowerBound);
+    facets["driversAreLowerBound"] = driversAreLowerBound;
+    if (isCancelled())
+        return QVariantMap();
+    bool vehiclesAreLowerBound = false;
+    facets["vehicles"] = onlyVehicleFilter ? facetFromSummary(db, "vehicle_summary", "vehicle")
+                                           : facet(db, buildFilter(query, match, SkipVehicle), "vehicle", &vehiclesAreLowerBound);
+    facets["vehiclesAreLowerBound"] = vehiclesAreLowerBound;
+    if (isCancelled())
+        return QVariantMap();
+
+    Filter favorites = buildFilter(query, match, SkipFavorites);
+    favorites.clauses << "t.favorite = 1";
+    const qint64 favoriteCount = countMatches(db, favorites);
+    facets["favorites"] = favoriteCount;
+    facets["favoritesIsLowerBound"] = favoriteCount >= kCountLimit;
+    if (isCancelled())
+        return QVariantMap();
+
+    QVariantMap result;
+    result["results"] = results;
+    result["total"] = total;
+    result["totalIsLowerBound"] = !unfiltered && total >= kCountLimit;
+    result["facets"] = facets;
+    result["elapsedMs"] = timer.nsecsElapsed() / 1e6;
+    return result;
+}
+
+void TripSearch::Interrupter::attach(QSqlDatabase &db, quint64 generation)
+{
+#ifdef DIGITALTRIPBOOK_SQLITE_INTERRUPT
+    // The handle is only safe to pass to the SQLite this was linked against
+    // when the driver runs that same build; Qt may bundle its own copy
+    static const bool sameLibrary = [&db]() {
+        TracedQuery query(db, "TripSearch::Interrupter");
+        const bool same = query.exec("SELECT sqlite_source_id()") && query.next()
+                          && query.value(0).toString() == QLatin1String(sqlite3_sourceid());
+        if (!same)
+            qInfo() << "Qt's SQLite driver uses its own SQLite, superseded searches stop between statements.";
+        return same;
+    }();
+    if (!sameLibrary)
+        return;
+    const QVariant handle = db.driver()->handle();
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0)
+        return;
+    QMutexLocker locker(&m_mutex);
+    if (generation < m_generation)
+        return;
+    m_handle = *static_cast<sqlite3 *const *>(handle.constData());
+    m_generation = generation;
+#else
+    Q_UNUSED(db);
+    Q_UNUSED(generation);
+#endif
+}
+
+void TripSearch::Interrupter::detach(quint64 generation)
+{
+    QMutexLocker locker(&m_mutex);
+    if (generation == m_generation)
+        m_handle = nullptr;
+}
+
+void TripSearch::Interrupter::interrupt()
+{
+#ifdef DIGITALTRIPBOOK_SQLITE_INTERRUPT
+    // Under the lock the connection cannot have moved on to another job
+    QMutexLocker locker(&m_mutex);
+    if (m_handle)
+        sqlite3_interrupt(static_cast<sqlite3 *>(m_handle));
+#endif
+}
@@ -0,0 +1,70 @@
+#ifndef TRIPSEARCH_H
+#define TRIPSEARCH_H
+
+#include <QSqlDatabase>
+#include <QVariant>
+#include <QMutex>
+#include <functional>
+
+// Full-text and faceted trip search. An FTS5 index over notes, location and
+// driver is kept in sync with `trips` by triggers, so every write path
+// (updateTripNotes, imports, migrations) updates it without extra code.
+namespace TripSearch
+{
+    // Match counts and facets stop counting here, so a one-letter prefix
+    // over a million trips still answers in milliseconds
+    constexpr int kCountLimit = 10000;
+
+    struct Query
+    {
+        QString text;      // words, each matched as a prefix
+        QString driver;    // exact match, empty for any
+        QString vehicle;   // exact match, empty for any
+        QString fromDate;  // inclusive local day, "yyyy-MM-dd"
+        QString toDate;    // inclusive
+        bool favoritesOnly = false;
+        int limit = 50;
+
+        // Keys as above, as passed from QML
+        static Query fromVariantMap(const QVariantMap &map);
+        bool hasFilters() const;
+    };
+
+    // Returns true when a newer search has superseded this one
+    using CancelCheck = std::function<bool()>;
+
+    // Creates the index and its triggers and indexes existing rows
+    bool install(QSqlDatabase &db);
+
+    // Result keys: results (id, name, startDate, vehicle, location, notes,
+    // favorite, snippet), total, totalIsLowerBound, facets (drivers and
+    // vehicles as [{ value, count }], favorites, and driversAreLowerBound,
+    // vehiclesAreLowerBound and favoritesIsLowerBound for counts cut off at
+    // kCountLimit) and elapsedMs. Returns an empty map when cancelled.
+    QVariantMap search(QSqlDatabase &db, const Query &query, const CancelCheck &cancelled = {});
+
+    // Aborts the statement a superseded search is still running, e.g. a
+    // bm25-ranked scan, instead of waiting for it to finish. The search
+    // thread attaches its connection under its generation while it runs;
+    // interrupt() may be called from any thread. Needs
+    // DIGITALTRIPBOOK_SQLITE_INTERRUPT and the same SQLite build as Qt's
+    // driver, otherwise it does nothing.
+    class Interrupter
+    {
+    public:
+        void attach(QSqlDatabase &db, quint64 generation);
+        // Leaves a newer search's connection attached
+        void detach(quint64 generation);
+        void interrupt();
+
+    private:
+        QMutex m_mutex;
+        void *m_handle = nullptr; // sqlite3 *
+        quint64 m_generation = 0;
+    };
+
+    // FTS5 MATCH expression for free text, every term as a quoted prefix
+    QString matchExpression(const QString &text);
+}
+
+#endif
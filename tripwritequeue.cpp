@@ -0,0 +1,170 @@
+#include "tripwritequeue.h"
+#include "statementcache.h"
+#include "querymetrics.h"
+#include "tripchanges.h"
+#include <QSqlError>
+#include <QDebug>
+#include <memory>
+
+TripWriteQueue::TripWriteQueue(DatabaseWorker *worker, QObject *parent)
+    : QObject(parent)
+    , m_worker(worker)
+{
+    m_debounce.setSingleShot(true);
+    m_debounce.setInterval(kDebounceMs);
+    connect(&m_debounce, &QTimer::timeout, this, [this]() { flush(); });
+}
+
+TripWriteQueue::~TripWriteQueue()
+{
+    // The worker runs jobs in order, so this batch is written before it stops
+    flush();
+}
+
+void TripWriteQueue::setFavorite(int tripId, bool isFavorite, Callback callback)
+{
+    m_pending[tripId].favorite = isFavorite;
+    enqueued(std::move(callback));
+}
+
+void TripWriteQueue::setNotes(int tripId, const QString &notes, Callback callback)
+{
+    m_pending[tripId].notes = notes;
+    enqueued(std::move(callback));
+}
+
+void TripWriteQueue::enqueued(Callback callback)
+{
+    if (callback)
+        m_callbacks.append(std::move(callback));
+    if (!m_oldestPending.isValid())
+        m_oldestPending.start();
+
+    if (m_pending.size() >= kMaxPendingTrips || m_oldestPending.elapsed() >= kMaxDelayMs)
+        flush();
+    else
+        m_debounce.start(); // restarts, so a burst of edits becomes one batch
+}
+
+void TripWriteQueue::setFavorites(const QList<int> &tripIds, bool isFavorite, Callback callback)
+{
+    for (int tripId : tripIds)
+        m_pending[tripId].favorite = isFavorite;
+    enqueuedBulk(tripIds.size(), std::move(callback));
+}
+
+void TripWriteQueue::setNotes(const QList<int> &tripIds, const QString &notes, Callback callback)
+{
+    for (int tripId : tripIds)
+        m_pending[tripId].notes = notes;
+    enqueuedBulk(tripIds.size(), std::move(callback));
+}
+
+void TripWriteQueue::enqueuedBulk(qsizetype count, Callback callback)
+{
+    if (count == 0) {
+        if (callback)
+            callback(true);
+        return;
+    }
+    // No size check in between, so the whole list commits in one transaction
+    if (callback)
+        m_callbacks.append(std::move(callback));
+    flush();
+}
+
+QFuture<QVariant> TripWriteQueue::flush()
+{
+    m_debounce.stop();
+    if (m_pending.isEmpty())
+        return m_lastFlush;
+
+    auto edits = std::make_shared<const QHash<int, Edit>>(std::move(m_pending));
+    const QList<Callback> callbacks = std::move(m_callbacks);
+    m_pending.clear();
+    m_callbacks.clear();
+    m_oldestPending.invalidate();
+
+    if (!m_worker) {
+        qWarning() << "ERROR: Database is not initialized, dropping" << edits->size() << "trip edits.";
+        for (const Callback &callback : callbacks)
+            callback(false);
+        return m_lastFlush;
+    }
+
+    // Written by the worker, read here only after the future finished
+    auto changes = std::make_shared<BatchChanges>();
+    m_lastFlush = m_worker->submit([edits, changes](QSqlDatabase &db) {
+        return QVariant(writeBatch(db, *edits, changes.get()));
+    });
+    m_lastFlush.then(this, [this, edits, changes, callbacks](const QVariant &result) {
+        const bool ok = result.toBool();
+        for (const Callback &callback : callbacks)
+            callback(ok);
+        emit batchWritten(edits->keys(), ok);
+        if (ok && !changes->updates.isEmpty())
+            emit tripsChanged(changes->updates, TripChanges::favoritesDelta(changes->favoritesOn, changes->favoritesOff));
+    });
+    return m_lastFlush;
+}
+
+bool TripWriteQueue::writeBatch(QSqlDatabase &db, const QHash<int, Edit> &edits, BatchChanges *changes)
+{
+    // Unchanged values are skipped, so the affected row count says exactly
+    // which edits changed something and no-op edits do not fire the triggers
+    TracedQuery *favorite = StatementCache::prepare(db, "UPDATE trips SET favorite = :favorite WHERE id = :id AND favorite IS NOT :favorite",
+                                                    "writeTripFavoriteStatus");
+    TracedQuery *notes = StatementCache::prepare(db, "UPDATE trips SET notes = :notes WHERE id = :id AND notes IS NOT :notes",
+                                                 "writeTripNotes");
+    if (!favorite || !notes)
+        return false;
+
+    // One transaction, so the whole batch costs a single sync to disk
+    if (!db.transaction()) {
+        qWarning() << "ERROR: Failed to start trip edit batch:" << db.lastError().text();
+        return false;
+    }
+
+    BatchChanges applied;
+    for (auto it = edits.cbegin(); it != edits.cend(); ++it) {
+        const Edit &edit = it.value();
+        std::optional<bool> favoriteChanged;
+        std::optional<QString> notesChanged;
+        if (edit.favorite) {
+            favorite->bindValue(":favorite", *edit.favorite);
+            favorite->bindValue(":id", it.key());
+            if (!favorite->exec()) {
+                qWarning() << "ERROR: Failed to update favorite status:" << favorite->lastError().text();
+                db.rollback();
+                return false;
+            }
+            if (favorite->numRowsAffected() > 0) {
+                favoriteChanged = *edit.favorite;
+                ++(*edit.favorite ? applied.favoritesOn : applied.favoritesOff);
+            }
+        }
+        if (edit.notes) {
+            notes->bindValue(":notes", *edit.notes);
+            notes->bindValue(":id", it.key());
+            if (!notes->exec()) {
+                qWarning() << "ERROR: Failed to update notes:" << notes->lastError().text();
+                db.rollback();
+                return false;
+            }
+            if (notes->numRowsAffected() > 0)
+                notesChanged = *edit.notes;
+        }
+        if (favoriteChanged || notesChanged)
+            applied.updates.append(TripChanges::tripUpdate(it.key(), favoriteChanged, notesChanged));
+    }
+
+    if (!db.commit()) {
+        qWarning() << "ERROR: Failed to commit trip edit batch:" << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+
+    *changes = std::move(applied);
+    qInfo() << "Wrote edits of" << edits.size() << "trips in one batch.";
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef TRIPWRITEQUEUE_H
+#define TRIPWRITEQUEUE_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <functional>
+#include <optional>
+
+#include "databaseworker.h"
+
+// Write-behind queue for favorite and notes edits. Edits are kept per trip,
+// so repeated edits of the same trip collapse into the last value, and are
+// written by the worker thread in one transaction per batch. A batch is
+// flushed once edits stop arriving for kDebounceMs, once the oldest edit
+// waited kMaxDelayMs, or once kMaxPendingTrips trips are pending.
+class TripWriteQueue : public QObject
+{
+    Q_OBJECT
+public:
+    using Callback = std::function<void(bool ok)>;
+
+    static constexpr int kDebounceMs = 250;
+    static constexpr int kMaxDelayMs = 2000;
+    static constexpr int kMaxPendingTrips = 1000;
+
+    explicit TripWriteQueue(DatabaseWorker *worker, QObject *parent = nullptr);
+    // Flushes whatever is still pending
+    ~TripWriteQueue() override;
+
+    // The callback runs on this object's thread once the batch holding the edit committed
+    void setFavorite(int tripId, bool isFavorite, Callback callback = {});
+    void setNotes(int tripId, const QString &notes, Callback callback = {});
+    // Bulk edits: every trip goes into one batch, flushed right away, and the
+    // callback runs once. An empty list calls back with true straight away.
+    void setFavorites(const QList<int> &tripIds, bool isFavorite, Callback callback = {});
+    void setNotes(const QList<int> &tripIds, const QString &notes, Callback callback = {});
+
+    int pendingCount() const { return int(m_pending.size()); }
+
+    // Hands pending edits to the worker now. Jobs submitted afterwards see
+    // them. The future finishes with the batch's result, or with the result
+    // of the last batch when nothing was pending.
+    QFuture<QVariant> flush();
+
+signals:
+    void batchWritten(const QList<int> &tripIds, bool ok);
+    // After a committed batch, only for values that actually changed; see
+    // tripchanges.h for the keys
+    void tripsChanged(const QVariantList &updates, const QVariantMap &statisticsDelta);
+
+private:
+    struct Edit
+    {
+        std::optional<bool> favorite;
+        std::optional<QString> notes;
+    };
+
+    // What a batch changed, filled in on the worker thread
+    struct BatchChanges
+    {
+        QVariantList updates;
+        int favoritesOn = 0;
+        int favoritesOff = 0;
+    };
+
+    void enqueued(Callback callback);
+    void enqueuedBulk(qsizetype count, Callback callback);
+    static bool writeBatch(QSqlDatabase &db, const QHash<int, Edit> &edits, BatchChanges *changes);
+
+    QPointer<DatabaseWorker> m_worker;
+    QHash<int, Edit> m_pending;
+    QList<Callback> m_callbacks;
+    QTimer m_debounce;
+    QElapsedTimer m_oldestPending;
+    QFuture<QVariant> m_lastFlush;
+};
+
+#endif